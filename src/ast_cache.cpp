@@ -0,0 +1,417 @@
+#include <cstring>
+#include <utility>
+
+#include "ast_cache.h"
+#include "visitor.h"
+
+
+namespace {
+
+const char MAGIC[4] = {'J', 'B', 'C', '\0'};
+const uint8_t NO_NODE = 0xff;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+};
+
+
+class Writer final : private NodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
+public:
+    explicit Writer(std::string &out) : out(out) {}
+
+    void node(Node &node) {
+        this->u8(static_cast<uint8_t>(node.kind));
+        this->u32(node.pos_start.offset);
+        this->u32(node.pos_end.offset);
+        node_dispatch(*this, node);
+    }
+
+    void optional(const Node::Ptr &node) {
+        if (node) {
+            this->node(*node);
+        } else {
+            this->u8(NO_NODE);
+        }
+    }
+
+    template<class T>
+    void raw(const T &value) {
+        this->out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void u8(uint8_t value) { this->raw(value); }
+    void u32(uint32_t value) { this->raw(value); }
+
+private:
+    void string(const ustring &str) {
+        this->u32(static_cast<uint32_t>(str.size()));
+        this->out.append(reinterpret_cast<const char *>(str.data()), str.size() * sizeof(unichar));
+    }
+
+    void list(const std::vector<Node::Ptr> &nodes) {
+        this->u32(static_cast<uint32_t>(nodes.size()));
+        for (const Node::Ptr &node : nodes) {
+            this->node(*node);
+        }
+    }
+
+    virtual void visit_block(S_Block &block) { this->list(block.stmts); }
+    virtual void visit_program(Program &prog) { this->list(prog.stmts); }
+    virtual void visit_declare_list(S_DeclareList &decls) {
+        this->u32(static_cast<uint32_t>(decls.decls.size()));
+        for (const auto &pair : decls.decls) {
+            this->string(pair.name);
+            this->optional(pair.initial);
+        }
+    }
+    virtual void visit_condition(S_Condition &cond) {
+        this->node(*cond.condition);
+        this->node(*cond.then_block);
+        this->optional(cond.else_block);
+    }
+    virtual void visit_while(S_While &wh) {
+        this->node(*wh.condition);
+        this->node(*wh.block);
+    }
+    virtual void visit_for(S_For &loop) {
+        this->node(*loop.var);
+        this->optional(loop.start);
+        this->optional(loop.stop);
+        this->optional(loop.step);
+        this->optional(loop.iterable);
+        this->node(*loop.block);
+    }
+    virtual void visit_return(S_Return &ret) { this->optional(ret.value); }
+    virtual void visit_stmt_exp(S_Exp &stmt) { this->node(*stmt.value); }
+    virtual void visit_op(E_Op &op) {
+        this->u32(static_cast<uint32_t>(op.op_code));
+        this->list(op.args);
+    }
+    virtual void visit_var(E_Var &var) { this->string(var.name); }
+    virtual void visit_func(E_Func &func) {
+        this->optional(func.args);
+        this->node(*func.block);
+        this->u8(func.attr.lazy_source != nullptr);
+    }
+    virtual void visit_bool(E_Bool &bool_node) { this->u8(bool_node.value); }
+    virtual void visit_int(E_Int &int_node) { this->raw(int_node.value); }
+    virtual void visit_float(E_Float &float_node) { this->raw(float_node.value); }
+    virtual void visit_string(E_String &str) { this->string(str.value); }
+    virtual void visit_list(E_List &list) { this->list(list.value); }
+    // fused nodes only appear after analysis, never dumped
+    virtual void visit_fused_var_update(E_FusedVarUpdate &) { assert(!"analyzed node"); }
+    virtual void visit_fused_set_item(E_FusedSetItem &) { assert(!"analyzed node"); }
+    virtual void visit_fused_condition(S_FusedCondition &) { assert(!"analyzed node"); }
+    virtual void visit_fused_while(S_FusedWhile &) { assert(!"analyzed node"); }
+
+    std::string &out;
+};
+
+
+struct BadImage {};
+
+
+class Reader {
+public:
+    Reader(const char *cur, const char *end, const SourceText &source)
+        : cur(cur), end(end), source(source)
+    {}
+
+    Node::Ptr node() {
+        uint8_t kind = this->u8();
+        if (kind == NO_NODE) {
+            return Node::Ptr();
+        }
+        SourceLoc pos_start(this->u32());
+        SourceLoc pos_end(this->u32());
+        Node::Ptr node = this->body(static_cast<NodeKind>(kind));
+        node->pos_start = pos_start;
+        node->pos_end = pos_end;
+        return node;
+    }
+
+    Node::Ptr required() {
+        Node::Ptr node = this->node();
+        if (!node) {
+            throw BadImage();
+        }
+        return node;
+    }
+
+    // the interpreter relies on the shapes produced by the parser
+    Node::Ptr required(NodeKind kind) {
+        Node::Ptr node = this->required();
+        expect(node.get(), kind);
+        return node;
+    }
+
+    template<class T>
+    T raw() {
+        if (static_cast<size_t>(this->end - this->cur) < sizeof(T)) {
+            throw BadImage();
+        }
+        T value;
+        std::memcpy(&value, this->cur, sizeof(T));
+        this->cur += sizeof(T);
+        return value;
+    }
+
+    uint8_t u8() { return this->raw<uint8_t>(); }
+    uint32_t u32() { return this->raw<uint32_t>(); }
+
+    bool at_end() const {
+        return this->cur == this->end;
+    }
+
+private:
+    static void expect(const Node *node, NodeKind kind) {
+        if (node != nullptr && node->kind != kind) {
+            throw BadImage();
+        }
+    }
+
+    static void check_op(const E_Op &op) {
+        size_t nargs = op.args.size();
+        bool good;
+        switch (op.op_code) {
+        case OpCode::PLUS:
+        case OpCode::MINUS:
+            good = nargs == 1 || nargs == 2;
+            break;
+        case OpCode::NOT:
+            good = nargs == 1;
+            break;
+        case OpCode::EXPLIST:
+            good = true;
+            break;
+        case OpCode::CALL:
+            good = nargs == 2 && op.args[1]->kind == NodeKind::E_OP
+                && static_cast<E_Op &>(*op.args[1]).op_code == OpCode::EXPLIST;
+            break;
+        case OpCode::ASSIGN:
+        case OpCode::PLUS_ASSIGN:
+        case OpCode::MINUS_ASSIGN:
+        case OpCode::STAR_ASSIGN:
+        case OpCode::SLASH_ASSIGN:
+        case OpCode::PERCENT_ASSIGN:
+            good = nargs == 2 && (
+                op.args[0]->kind == NodeKind::E_VAR
+                || (op.args[0]->kind == NodeKind::E_OP
+                    && static_cast<E_Op &>(*op.args[0]).op_code == OpCode::SUBSCRIPT));
+            break;
+        case OpCode::STAR: case OpCode::SLASH: case OpCode::PERCENT:
+        case OpCode::LESS: case OpCode::LESSEQ: case OpCode::GREAT: case OpCode::GREATEQ:
+        case OpCode::EQ: case OpCode::NEQ: case OpCode::AND: case OpCode::OR:
+        case OpCode::SUBSCRIPT:
+            good = nargs == 2;
+            break;
+        default:
+            good = false;
+        }
+        if (!good) {
+            throw BadImage();
+        }
+    }
+
+    ustring string() {
+        uint32_t len = this->u32();
+        if (static_cast<size_t>(this->end - this->cur) / sizeof(unichar) < len) {
+            throw BadImage();
+        }
+        ustring str(len, 0);
+        std::memcpy(&str[0], this->cur, len * sizeof(unichar));
+        this->cur += len * sizeof(unichar);
+        return str;
+    }
+
+    void list(std::vector<Node::Ptr> &nodes) {
+        uint32_t count = this->u32();
+        // every node takes at least a kind byte
+        if (static_cast<size_t>(this->end - this->cur) < count) {
+            throw BadImage();
+        }
+        nodes.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            nodes.push_back(this->required());
+        }
+    }
+
+    Node::Ptr body(NodeKind kind) {
+        switch (kind) {
+        case NodeKind::S_BLOCK:
+        case NodeKind::PROGRAM: {
+            S_Block *block = kind == NodeKind::PROGRAM ? new Program() : new S_Block();
+            Node::Ptr node(block);
+            this->list(block->stmts);
+            return node;
+        }
+        case NodeKind::S_DECLARE_LIST: {
+            S_DeclareList *decls = new S_DeclareList();
+            Node::Ptr node(decls);
+            uint32_t count = this->u32();
+            for (uint32_t i = 0; i < count; ++i) {
+                ustring name = this->string();
+                decls->decls.emplace_back(name, this->node());
+            }
+            return node;
+        }
+        case NodeKind::S_CONDITION: {
+            S_Condition *cond = new S_Condition();
+            Node::Ptr node(cond);
+            cond->condition = this->required();
+            cond->then_block = this->required(NodeKind::S_BLOCK);
+            cond->else_block = this->node();
+            if (cond->else_block && cond->else_block->kind != NodeKind::S_CONDITION) {
+                expect(cond->else_block.get(), NodeKind::S_BLOCK);
+            }
+            return node;
+        }
+        case NodeKind::S_WHILE: {
+            S_While *wh = new S_While();
+            Node::Ptr node(wh);
+            wh->condition = this->required();
+            wh->block = this->required(NodeKind::S_BLOCK);
+            return node;
+        }
+        case NodeKind::S_FOR: {
+            S_For *loop = new S_For();
+            Node::Ptr node(loop);
+            loop->var = this->required(NodeKind::S_DECLARE_LIST);
+            loop->start = this->node();
+            loop->stop = this->node();
+            loop->step = this->node();
+            loop->iterable = this->node();
+            loop->block = this->required(NodeKind::S_BLOCK);
+            bool is_range = loop->start && loop->stop && !loop->iterable;
+            bool is_in = !loop->start && !loop->stop && !loop->step && loop->iterable;
+            if (static_cast<S_DeclareList &>(*loop->var).decls.size() != 1 || !(is_range || is_in)) {
+                throw BadImage();
+            }
+            return node;
+        }
+        case NodeKind::S_RETURN: {
+            S_Return *ret = new S_Return();
+            Node::Ptr node(ret);
+            ret->value = this->node();
+            return node;
+        }
+        case NodeKind::S_BREAK:
+            return Node::Ptr(new S_Break());
+        case NodeKind::S_CONTINUE:
+            return Node::Ptr(new S_Continue());
+        case NodeKind::S_EXP: {
+            S_Exp *stmt = new S_Exp();
+            Node::Ptr node(stmt);
+            stmt->value = this->required();
+            return node;
+        }
+        case NodeKind::S_EMPTY:
+            return Node::Ptr(new S_Empty());
+        case NodeKind::E_OP: {
+            E_Op *op = new E_Op(static_cast<OpCode>(this->u32()));
+            Node::Ptr node(op);
+            this->list(op->args);
+            check_op(*op);
+            return node;
+        }
+        case NodeKind::E_VAR:
+            return Node::Ptr(new E_Var(this->string()));
+        case NodeKind::E_FUNC: {
+            E_Func *func = new E_Func();
+            Node::Ptr node(func);
+            func->args = this->node();
+            expect(func->args.get(), NodeKind::S_DECLARE_LIST);
+            func->block = this->required(NodeKind::S_BLOCK);
+            if (this->u8() != 0) {
+                // the body is still skipped, the braces are in the source
+                const S_Block &body = static_cast<S_Block &>(*func->block);
+                if (!body.stmts.empty() || body.pos_start.offset > body.pos_end.offset
+                    || body.pos_end.offset >= this->source.size())
+                {
+                    throw BadImage();
+                }
+                func->attr.lazy_source = &this->source;
+            }
+            return node;
+        }
+        case NodeKind::E_BOOL:
+            return Node::Ptr(new E_Bool(this->u8() != 0));
+        case NodeKind::E_INT:
+            return Node::Ptr(new E_Int(this->raw<int64_t>()));
+        case NodeKind::E_FLOAT:
+            return Node::Ptr(new E_Float(this->raw<double>()));
+        case NodeKind::E_STRING:
+            return Node::Ptr(new E_String(this->string()));
+        case NodeKind::E_LIST: {
+            E_List *list = new E_List();
+            Node::Ptr node(list);
+            this->list(list->value);
+            return node;
+        }
+        case NodeKind::E_NULL:
+            return Node::Ptr(new E_Null());
+        default:
+            throw BadImage();
+        }
+    }
+
+    const char *cur;
+    const char *end;
+    const SourceText &source;
+};
+
+}   // namespace
+
+
+// FNV-1a
+uint64_t ast_cache_source_hash(const char *source, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<uint8_t>(source[i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+
+std::string dump_ast_cache(Node &program, const SourceText &source) {
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = AST_CACHE_VERSION;
+    header.source_hash = ast_cache_source_hash(source.data(), source.size());
+    header.source_size = source.size();
+
+    std::string out;
+    Writer writer(out);
+    writer.raw(header);
+    writer.node(program);
+    return out;
+}
+
+
+Node::Ptr load_ast_cache(const char *data, size_t size, const SourceText &source) {
+    Reader reader(data, data + size, source);
+    try {
+        Header header = reader.raw<Header>();
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != AST_CACHE_VERSION
+            || header.source_size != source.size()
+            || header.source_hash != ast_cache_source_hash(source.data(), source.size()))
+        {
+            return Node::Ptr();
+        }
+
+        Node::Ptr program = reader.required();
+        if (program->kind != NodeKind::PROGRAM || !reader.at_end()) {
+            return Node::Ptr();
+        }
+        return program;
+    } catch (BadImage &) {
+        return Node::Ptr();
+    }
+}
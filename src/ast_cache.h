@@ -0,0 +1,23 @@
+#ifndef JIAOBENSCRIPT_AST_CACHE_H
+#define JIAOBENSCRIPT_AST_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "node.h"
+
+
+// Binary image of a parsed, not yet analyzed, program, with source positions. The header
+// holds a format version and the hash and size of the source it was parsed from, so a stale
+// cache is rejected. Loading reads the image in place, it can be a MappedFile. Function bodies
+// skipped by a lazy parser stay skipped, and are parsed from the source on the first call.
+const uint32_t AST_CACHE_VERSION = 2;
+
+uint64_t ast_cache_source_hash(const char *source, size_t size);
+std::string dump_ast_cache(Node &program, const SourceText &source);
+// nullptr if the image is malformed or not made from the source
+Node::Ptr load_ast_cache(const char *data, size_t size, const SourceText &source);
+
+
+#endif //JIAOBENSCRIPT_AST_CACHE_H
@@ -1,7 +1,6 @@
 #include <algorithm>
 #include <cmath>
 #include <functional>
-#include <iosfwd>
 #include <string>
 
 #include "builtins.h"
@@ -239,40 +238,51 @@ JBValue &Builtins::builtin_list_dup(JBList &lhs, JBValue &n) {
     }
 
 
-JBValue &Builtins::builtin_func_list_size(const std::vector<JBValue *> &args) {
+JBValue &Builtins::builtin_func_list_size(JBArgs args) {
     ARG_NUM(1);
+    return this->builtin_func_list_size(*args[0]);
+}
+
 
-    if (JBList *list = dynamic_cast<JBList *>(args[0])) {
-        return this->create<JBInt>(list->value.size());
+JBValue &Builtins::builtin_func_list_size(JBValue &list) {
+    if (JBList *list_obj = dynamic_cast<JBList *>(&list)) {
+        return this->create<JBInt>(list_obj->value.size());
     } else {
         throw JBError("Type error: expect list");
     }
 }
 
 
-JBValue &Builtins::builtin_func_list_append(const std::vector<JBValue *> &args) {
+JBValue &Builtins::builtin_func_list_append(JBArgs args) {
     ARG_NUM(2);
+    return this->builtin_func_list_append(*args[0], *args[1]);
+}
 
-    if (JBList *list = dynamic_cast<JBList *>(args[0])) {
-        list->value.push_back(args[1]);
-        return *list;
+
+JBValue &Builtins::builtin_func_list_append(JBValue &list, JBValue &item) {
+    if (JBList *list_obj = dynamic_cast<JBList *>(&list)) {
+        list_obj->value.push_back(&item);
+        return *list_obj;
     } else {
         throw JBError("Type error: expect list");
     }
 }
 
 
-JBValue &Builtins::builtin_func_print(const std::vector<JBValue *> &args) {
-    const char *space = "";
+JBValue &Builtins::builtin_func_print(JBArgs args) {
+    bool first = true;
     for (JBValue *item : args) {
         if (JBString *str = dynamic_cast<JBString *>(item)) {
-            std::cout << u8_encode(str->value);
+            this->output->write(str->value);
         } else {
-            std::cout << space << item->repr();
+            if (!first) {
+                this->output->put(' ');
+            }
+            item->write_repr(*this->output);
         }
-        space = " ";
+        first = false;
     }
-    std::cout << std::endl;
+    this->output->end_line();
     return this->create<JBNull>();
 }
 
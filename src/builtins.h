@@ -5,11 +5,22 @@
 
 #include "jbobject.h"
 #include "allocator.h"
+#include "output.h"
 
 
 class Builtins {
 public:
-    explicit Builtins(Allocator &allocator) : allocator(allocator) {}
+    explicit Builtins(Allocator &allocator)
+        : allocator(allocator), output(&standard_output())
+    {}
+
+    // the destination of print(), which must outlive this
+    void set_output(OutputSink &output) {
+        this->output = &output;
+    }
+    OutputSink &get_output() {
+        return *this->output;
+    }
 
     // TODO: slice
     JBValue &builtin_pos(JBValue &lhs);
@@ -34,9 +45,11 @@ public:
     JBValue &builtin_list_cat(JBList &lhs, JBValue &rhs);
     JBValue &builtin_list_dup(JBList &lhs, JBValue &n);
 
-    JBValue &builtin_func_list_size(const std::vector<JBValue *> &args);
-    JBValue &builtin_func_list_append(const std::vector<JBValue *> &args);
-    JBValue &builtin_func_print(const std::vector<JBValue *> &args);
+    JBValue &builtin_func_list_size(JBArgs args);
+    JBValue &builtin_func_list_size(JBValue &list);
+    JBValue &builtin_func_list_append(JBArgs args);
+    JBValue &builtin_func_list_append(JBValue &list, JBValue &item);
+    JBValue &builtin_func_print(JBArgs args);
 
 private:
     // FIXME: duplicated code
@@ -46,6 +59,7 @@ private:
     }
 
     Allocator &allocator;
+    OutputSink *output;
 };
 
 
@@ -1,50 +1,78 @@
 #include "check_control_flow.h"
 #include "visitor.h"
-#include "replace_restore.hpp"
 
 
-class CFChecker : private TraversalNodeVisitor {
+void ControlFlowContext::check_return(S_Return &ret) const {
+    if (!this->state.inside_func) {
+        throw BadReturn(ret);
+    }
+    E_Op *call = dynamic_cast<E_Op *>(ret.value.get());
+    ret.attr.is_tail_call = call != nullptr && call->op_code == OpCode::CALL;
+}
+
+
+void ControlFlowContext::check_break(const S_Break &brk) const {
+    if (!this->state.inside_loop) {
+        throw BadBreak(brk);
+    }
+}
+
+
+void ControlFlowContext::check_continue(const S_Continue &cont) const {
+    if (!this->state.inside_loop) {
+        throw BadContinue(cont);
+    }
+}
+
+
+class CFChecker final : private TraversalNodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
 public:
+    explicit CFChecker(bool inside_func = false) : flow(inside_func) {}
+
     void check(Node &block) {
-        block.accept(*this);
+        node_dispatch(*this, block);
     }
 
 private:
     virtual void visit_while(S_While &wh) {
-        ReplaceRestore<bool> _(&this->inside_loop, true);
+        auto _ = this->flow.enter_loop();
         TraversalNodeVisitor::visit_while(wh);
     }
 
+    virtual void visit_for(S_For &loop) {
+        auto _ = this->flow.enter_loop();
+        TraversalNodeVisitor::visit_for(loop);
+    }
+
     virtual void visit_func(E_Func &func) {
-        ReplaceRestore<bool> _l(&this->inside_loop, false);
-        ReplaceRestore<bool> _f(&this->inside_func, true);
+        auto _ = this->flow.enter_func();
         TraversalNodeVisitor::visit_func(func);
     }
 
     virtual void visit_return(S_Return &ret) {
-        if (!this->inside_func) {
-            throw BadReturn(ret);
-        }
+        this->flow.check_return(ret);
         TraversalNodeVisitor::visit_return(ret);
     }
 
     virtual void visit_break(S_Break &brk) {
-        if (!this->inside_loop) {
-            throw BadBreak(brk);
-        }
+        this->flow.check_break(brk);
     }
 
     virtual void visit_continue(S_Continue &cont) {
-        if (!this->inside_loop) {
-            throw BadContinue(cont);
-        }
+        this->flow.check_continue(cont);
     }
 
-    bool inside_func = false;
-    bool inside_loop = false;
+    ControlFlowContext flow;
 };
 
 
 void check_control_flow(Node &node) {
     CFChecker().check(node);
 }
+
+
+void check_control_flow_in_func(S_Block &body) {
+    CFChecker(true).check(body);
+}
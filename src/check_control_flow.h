@@ -5,9 +5,42 @@
 
 #include "exceptions.h"
 #include "node.h"
+#include "replace_restore.hpp"
+
+
+// The function and loop enclosing the node being visited, for checking jump statements while
+// traversing. Shared by check_control_flow() and the analysis of name_resolve.h.
+class ControlFlowContext {
+public:
+    struct State {
+        bool inside_func;
+        bool inside_loop;
+    };
+
+    explicit ControlFlowContext(bool inside_func = false) : state {inside_func, false} {}
+
+    ReplaceRestore<State> enter_loop() {
+        return ReplaceRestore<State>(&this->state, {this->state.inside_func, true});
+    }
+
+    // loops outside are not visible to the function body
+    ReplaceRestore<State> enter_func() {
+        return ReplaceRestore<State>(&this->state, {true, false});
+    }
+
+    // marks tail calls
+    void check_return(S_Return &ret) const;
+    void check_break(const S_Break &brk) const;
+    void check_continue(const S_Continue &cont) const;
+
+private:
+    State state;
+};
 
 
 void check_control_flow(Node &node);
+// the body of a lazy function after parse_lazy_body()
+void check_control_flow_in_func(S_Block &body);
 
 
 #endif //JIAOBENSCRIPT_CHECK_CONTROL_FLOW_H
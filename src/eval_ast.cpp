@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <functional>
 #include <utility>
@@ -5,13 +6,30 @@
 #include "builtins.h"
 #include "eval_ast.h"
 #include "name_resolve.h"
-#include "check_control_flow.h"
+#include "parser.h"
+#include "phase_timer.h"
 #include "string_fmt.hpp"
 
 
 struct Signal {};
 
 
+// pops the arguments pushed by push_args() when leaving the call
+class ArgStackMark {
+public:
+    ArgStackMark(std::vector<JBValue *> &stack, const JBArgs &args)
+        : stack(stack), base(stack.size() - args.size())
+    {}
+    ~ArgStackMark() {
+        this->stack.resize(this->base);
+    }
+
+private:
+    std::vector<JBValue *> &stack;
+    size_t base;
+};
+
+
 class BreakSignal : public Signal {};
 
 
@@ -25,6 +43,14 @@ public:
 };
 
 
+// unwinds to AstInterpreter::call_func(), arguments are in AstInterpreter::tail_args
+class TailCallSignal : public Signal {
+public:
+    explicit TailCallSignal(JBFunc &func) : func(func) {}
+    JBFunc &func;
+};
+
+
 void Frame::each_ref(std::function<void(JBObject &child)> callback) {
     for (JBObject *v : this->vars) {
         if (v != nullptr) {
@@ -37,7 +63,7 @@ void Frame::each_ref(std::function<void(JBObject &child)> callback) {
 }
 
 
-void AstInterpreter::set_builtin_table(const std::vector<std::pair<ustring, JBValue *>> &table) {
+void BaseInterpreter::set_builtin_table(const std::vector<std::pair<ustring, JBValue *>> &table) {
     assert(this->cur_frame == nullptr);
 
     S_Block *block = new S_Block();
@@ -57,28 +83,43 @@ void AstInterpreter::set_builtin_table(const std::vector<std::pair<ustring, JBVa
 }
 
 
-#define BUILTIN_ITEM(name) { \
+#define THUNK(name) &JBBuiltinFunc::thunk<Builtins, &Builtins::builtin_func_ ## name>
+#define THUNK1(name) &JBBuiltinFunc::thunk1<Builtins, &Builtins::builtin_func_ ## name>
+#define THUNK2(name) &JBBuiltinFunc::thunk2<Builtins, &Builtins::builtin_func_ ## name>
+
+#define BUILTIN_ITEM(name, func1, func2) { \
     USTRING(#name), \
-    &this->create<JBBuiltinFunc>(\
-        std::bind(&Builtins::builtin_func_ ## name, &this->builtins, std::placeholders::_1)) \
+    &this->create<JBBuiltinFunc>(&this->builtins, THUNK(name), func1, func2) \
 }
 
 
-void AstInterpreter::set_default_builtin_table() {
-    using namespace std::placeholders;
+void BaseInterpreter::set_default_builtin_table() {
     this->set_builtin_table(std::vector<std::pair<ustring, JBValue *>> {
-        BUILTIN_ITEM(print),
-        BUILTIN_ITEM(list_size),
-        BUILTIN_ITEM(list_append),
+        BUILTIN_ITEM(print, nullptr, nullptr),
+        BUILTIN_ITEM(list_size, THUNK1(list_size), nullptr),
+        BUILTIN_ITEM(list_append, nullptr, THUNK2(list_append)),
     });
 }
 
 
 #undef BUILTIN_ITEM
+#undef THUNK
+#undef THUNK1
+#undef THUNK2
 
 
 void AstInterpreter::eval_incomplete_raw_block(S_Block &block) {
+    this->analyze_raw_block(block);
+    this->eval_analyzed_block(block);
+}
+
+
+void AstInterpreter::analyze_raw_block(S_Block &block) {
     this->analyze_node(block);
+}
+
+
+void AstInterpreter::eval_analyzed_block(S_Block &block) {
     this->cur_frame = &this->create_frame(this->cur_frame, block);
     this->handle_block(block);
 }
@@ -86,14 +127,8 @@ void AstInterpreter::eval_incomplete_raw_block(S_Block &block) {
 
 void AstInterpreter::eval_raw_decl_list(S_DeclareList &decls) {
     this->analyze_node(decls);
-    assert(this->cur_frame);
-    Frame &frame = *this->cur_frame;
-    // extend frame.vars
-    frame.vars.reserve(frame.vars.size() + decls.decls.size());
-    for (size_t i = 0; i < decls.decls.size(); ++i) {
-        frame.vars.push_back(nullptr);
-    }
-    decls.accept(*this);
+    this->extend_frame(decls);
+    node_dispatch(*this, decls);
 }
 
 
@@ -105,11 +140,11 @@ JBValue& AstInterpreter::eval_raw_exp(Node &exp) {
 
 
 void AstInterpreter::eval_raw_stmt(Node &node) {
-    if (S_DeclareList *decls = dynamic_cast<S_DeclareList *>(&node)) {
-        this->eval_raw_decl_list(*decls);
+    if (node.kind == NodeKind::S_DECLARE_LIST) {
+        this->eval_raw_decl_list(static_cast<S_DeclareList &>(node));
     } else {
         this->analyze_node(node);
-        node.accept(*this);
+        node_dispatch(*this, node);
     }
 }
 
@@ -141,9 +176,9 @@ void AstInterpreter::visit_declare_list(S_DeclareList &decls) {
 void AstInterpreter::visit_condition(S_Condition &cond) {
     JBValue &test = this->eval_exp(*cond.condition);
     if (this->builtins.is_truthy(test)) {
-        cond.then_block->accept(*this);
+        node_dispatch(*this, *cond.then_block);
     } else if (cond.else_block) {
-        cond.else_block->accept(*this);
+        node_dispatch(*this, *cond.else_block);
     }
 }
 
@@ -152,7 +187,7 @@ void AstInterpreter::visit_while(S_While &wh) {
     S_Block &block = static_cast<S_Block &>(*wh.block);
     while (this->builtins.is_truthy(this->eval_exp(*wh.condition))) {
         try {
-            block.accept(*this);
+            node_dispatch(*this, block);
         } catch (BreakSignal &) {
             break;
         } catch (ContinueSignal &) {
@@ -162,8 +197,64 @@ void AstInterpreter::visit_while(S_While &wh) {
 }
 
 
+void AstInterpreter::visit_for(S_For &loop) {
+    S_Block &block = static_cast<S_Block &>(*loop.block);
+    Frame *frame = nullptr;
+
+    if (loop.is_range()) {
+        int64_t start = this->get_range_arg(this->eval_exp(*loop.start), *loop.start);
+        int64_t stop = this->get_range_arg(this->eval_exp(*loop.stop), *loop.stop);
+        int64_t step = 1;
+        if (loop.step) {
+            step = this->get_range_arg(this->eval_exp(*loop.step), *loop.step);
+            if (step == 0) {
+                throw JBError("Bad range: step is zero", loop.step->pos_start, loop.step->pos_end);
+            }
+        }
+
+        JBInt *counter = nullptr;
+        int64_t i = start;
+        for (uint64_t left = range_count(start, stop, step); left > 0; --left) {
+            frame = &this->next_loop_frame(frame, block);
+            if (counter != nullptr && loop.attr.reuse_counter) {
+                counter->value = i;
+            } else {
+                counter = &this->create<JBInt>(i);
+            }
+            frame->vars[0] = counter;
+            if (!this->handle_loop_body(block, *frame)) {
+                break;
+            }
+            // not past stop, so never overflows
+            if (left > 1) {
+                i += step;
+            }
+        }
+    } else {
+        JBValue &iterable = this->eval_exp(*loop.iterable);
+        JBList *list = dynamic_cast<JBList *>(&iterable);
+        if (list == nullptr) {
+            throw JBError(
+                "Type error: expect list", loop.iterable->pos_start, loop.iterable->pos_end
+            );
+        }
+
+        // the list may grow inside the loop
+        for (size_t i = 0; i < list->value.size(); ++i) {
+            frame = &this->next_loop_frame(frame, block);
+            frame->vars[0] = list->value[i];
+            if (!this->handle_loop_body(block, *frame)) {
+                break;
+            }
+        }
+    }
+}
+
+
 void AstInterpreter::visit_return(S_Return &ret) {
-    if (ret.value) {
+    if (ret.attr.is_tail_call) {
+        throw ReturnSignal(this->handle_tail_call(static_cast<E_Op &>(*ret.value)));
+    } else if (ret.value) {
         throw ReturnSignal(this->eval_exp(*ret.value));
     } else{
         throw ReturnSignal(this->create<JBNull>());
@@ -268,10 +359,7 @@ void AstInterpreter::visit_var(E_Var &var) {
 
 
 void AstInterpreter::visit_func(E_Func &func) {
-    // TODO: set frame to nullptr if func.block and its children do not have non-local variable
-    // S_Block &block = static_cast<S_Block &>(*func.block);
-    assert(this->cur_frame);
-    this->return_value(this->create<JBFunc>(this->cur_frame, func));
+    this->return_value(this->create_func(func));
 }
 
 
@@ -309,7 +397,54 @@ void AstInterpreter::visit_null(E_Null &) {
 }
 
 
-Frame &AstInterpreter::create_frame(Frame *parent, S_Block &block) {
+void AstInterpreter::visit_fused_var_update(E_FusedVarUpdate &fused) {
+    JBValue **slot = this->resolve_var(fused.var);
+    if (*slot == nullptr) {
+        throw JBError(
+            "Unbound variable: " + u8_encode(fused.var.name),
+            fused.var.pos_start, fused.var.pos_end
+        );
+    }
+    JBValue &lhs = **slot;
+    JBValue &rhs = this->eval_exp(fused.value);
+    *slot = &this->apply_binop(fused.op_code, lhs, rhs);
+    this->return_value(**slot);
+}
+
+
+void AstInterpreter::visit_fused_set_item(E_FusedSetItem &fused) {
+    JBValue &value = this->eval_exp(fused.value);
+    JBValue &base = this->eval_exp(fused.base);
+    JBValue &index = this->eval_exp(fused.index);
+    this->return_value(this->builtins.builtin_setitem(base, index, value));
+}
+
+
+void AstInterpreter::visit_fused_condition(S_FusedCondition &fused) {
+    S_Condition &cond = fused.cond();
+    if (this->eval_compare(fused.test)) {
+        node_dispatch(*this, *cond.then_block);
+    } else if (cond.else_block) {
+        node_dispatch(*this, *cond.else_block);
+    }
+}
+
+
+void AstInterpreter::visit_fused_while(S_FusedWhile &fused) {
+    S_Block &block = static_cast<S_Block &>(*fused.wh().block);
+    while (this->eval_compare(fused.test)) {
+        try {
+            node_dispatch(*this, block);
+        } catch (BreakSignal &) {
+            break;
+        } catch (ContinueSignal &) {
+            continue;
+        }
+    }
+}
+
+
+Frame &BaseInterpreter::create_frame(Frame *parent, S_Block &block) {
     Frame &frame = this->create<Frame>();
     frame.parent = parent;
     frame.block = &block;
@@ -318,13 +453,75 @@ Frame &AstInterpreter::create_frame(Frame *parent, S_Block &block) {
 }
 
 
+JBFunc &BaseInterpreter::create_func(E_Func &func) {
+    // TODO: set frame to nullptr if func.block and its children do not have non-local variable
+    // S_Block &block = static_cast<S_Block &>(*func.block);
+    assert(this->cur_frame);
+    for (Frame *frame = this->cur_frame; frame != nullptr && !frame->captured; frame = frame->parent) {
+        frame->captured = true;
+    }
+    return this->create<JBFunc>(this->cur_frame, func);
+}
+
+
+int64_t BaseInterpreter::get_range_arg(JBValue &value, const Node &node) {
+    if (JBInt *int_obj = dynamic_cast<JBInt *>(&value)) {
+        return int_obj->value;
+    } else {
+        throw JBError("Type error: expect int", node.pos_start, node.pos_end);
+    }
+}
+
+
+// the number of counters from start to stop, in unsigned so that no difference overflows
+uint64_t BaseInterpreter::range_count(int64_t start, int64_t stop, int64_t step) {
+    uint64_t distance, stride;
+    if (step > 0) {
+        if (start >= stop) {
+            return 0;
+        }
+        distance = static_cast<uint64_t>(stop) - static_cast<uint64_t>(start);
+        stride = static_cast<uint64_t>(step);
+    } else {
+        if (start <= stop) {
+            return 0;
+        }
+        distance = static_cast<uint64_t>(start) - static_cast<uint64_t>(stop);
+        stride = 0 - static_cast<uint64_t>(step);
+    }
+    return (distance - 1) / stride + 1;
+}
+
+
+Frame &BaseInterpreter::next_loop_frame(Frame *frame, S_Block &block) {
+    if (frame != nullptr && !frame->captured) {
+        // locals of the previous iteration are not referenced anymore
+        std::fill(frame->vars.begin(), frame->vars.end(), nullptr);
+        return *frame;
+    } else {
+        return this->create_frame(this->cur_frame, block);
+    }
+}
+
+
+void BaseInterpreter::extend_frame(S_DeclareList &decls) {
+    assert(this->cur_frame);
+    Frame &frame = *this->cur_frame;
+    // extend frame.vars
+    frame.vars.reserve(frame.vars.size() + decls.decls.size());
+    for (size_t i = 0; i < decls.decls.size(); ++i) {
+        frame.vars.push_back(nullptr);
+    }
+}
+
+
 void AstInterpreter::return_value(JBValue &value) {
     this->returned = &value;
 }
 
 
 JBValue &AstInterpreter::eval_exp(Node &node) {
-    node.accept(*this);
+    node_dispatch(*this, node);
     assert(this->returned);
     JBValue *ret = nullptr;
     std::swap(this->returned, ret);
@@ -340,7 +537,7 @@ ReplaceRestore<Frame *> AstInterpreter::enter(S_Block &block, Frame *parent_fram
 }
 
 
-JBValue **AstInterpreter::resolve_var(const E_Var &var) {
+JBValue **BaseInterpreter::resolve_var(const E_Var &var) {
     assert(this->cur_frame);
     Frame &frame = *this->cur_frame;
     if (var.attr.is_local) {
@@ -358,14 +555,104 @@ JBValue **AstInterpreter::resolve_var(const E_Var &var) {
 }
 
 
-void AstInterpreter::analyze_node(Node &node) {
+void BaseInterpreter::analyze_node(Node &node) {
     if (this->cur_frame) {
         assert(this->cur_frame->block);
     }
 
     S_Block *block = this->cur_frame ? this->cur_frame->block : nullptr;
-    ::resolve_names_in_block(block, node);
-    ::check_control_flow(node);
+    PhaseTimer _(Phase::ANALYZE);
+    ::analyze_in_block(block, node, this->fuse);
+}
+
+
+// the body of a function from a lazy parser is parsed and analyzed before its first call
+void BaseInterpreter::compile_func(const E_Func &func) {
+    if (func.attr.lazy_source != nullptr) {
+        {
+            PhaseTimer _(Phase::LOAD);
+            ::parse_lazy_body(func);
+        }
+        this->analyze_func(func);
+    }
+}
+
+
+void BaseInterpreter::analyze_func(const E_Func &func) {
+    PhaseTimer _(Phase::ANALYZE);
+    ::analyze_func_body(func, this->fuse);
+}
+
+
+JBValue &BaseInterpreter::apply_binop(OpCode op_code, JBValue &lhs, JBValue &rhs) {
+    JBInt *lint = dynamic_cast<JBInt *>(&lhs);
+    JBInt *rint = dynamic_cast<JBInt *>(&rhs);
+    switch (op_code) {
+    case OpCode::PLUS:
+    case OpCode::PLUS_ASSIGN:
+        if (lint && rint) {
+            return this->create<JBInt>(lint->value + rint->value);
+        }
+        return this->builtins.builtin_add(lhs, rhs);
+    case OpCode::MINUS:
+    case OpCode::MINUS_ASSIGN:
+        if (lint && rint) {
+            return this->create<JBInt>(lint->value - rint->value);
+        }
+        return this->builtins.builtin_sub(lhs, rhs);
+    case OpCode::STAR:
+    case OpCode::STAR_ASSIGN:
+        if (lint && rint) {
+            return this->create<JBInt>(lint->value * rint->value);
+        }
+        return this->builtins.builtin_mul(lhs, rhs);
+    case OpCode::SLASH:
+    case OpCode::SLASH_ASSIGN:
+        return this->builtins.builtin_div(lhs, rhs);
+    case OpCode::PERCENT:
+    case OpCode::PERCENT_ASSIGN:
+        return this->builtins.builtin_mod(lhs, rhs);
+    case OpCode::LESS:
+        return this->builtins.builtin_lt(lhs, rhs);
+    case OpCode::LESSEQ:
+        return this->builtins.builtin_le(lhs, rhs);
+    case OpCode::GREAT:
+        return this->builtins.builtin_gt(lhs, rhs);
+    case OpCode::GREATEQ:
+        return this->builtins.builtin_ge(lhs, rhs);
+    case OpCode::EQ:
+        return this->builtins.builtin_eq(lhs, rhs);
+    case OpCode::NEQ:
+        return this->builtins.builtin_ne(lhs, rhs);
+    default:
+        assert(!"Unreachable");
+        throw JBError("Unknown operator");
+    }
+}
+
+
+bool BaseInterpreter::compare(OpCode op_code, JBValue &lhs, JBValue &rhs) {
+    JBInt *lint = dynamic_cast<JBInt *>(&lhs);
+    JBInt *rint = dynamic_cast<JBInt *>(&rhs);
+    if (lint && rint) {
+        switch (op_code) {
+        case OpCode::LESS:
+            return lint->value < rint->value;
+        case OpCode::LESSEQ:
+            return lint->value <= rint->value;
+        case OpCode::GREAT:
+            return lint->value > rint->value;
+        case OpCode::GREATEQ:
+            return lint->value >= rint->value;
+        case OpCode::EQ:
+            return lint->value == rint->value;
+        case OpCode::NEQ:
+            return lint->value != rint->value;
+        default:
+            break;
+        }
+    }
+    return this->builtins.is_truthy(this->apply_binop(op_code, lhs, rhs));
 }
 
 
@@ -385,10 +672,10 @@ void AstInterpreter::handle_unary_or_binary_op(
 
 void AstInterpreter::handle_binary_op(E_Op &exp, AstInterpreter::BinaryFunc binary_func) {
     assert(exp.args.size() == 2);
-    this->return_value(binary_func(
-        this->eval_exp(*exp.args[0]),
-        this->eval_exp(*exp.args[1])
-    ));
+    // from left to right, like the fused nodes
+    JBValue &lhs = this->eval_exp(*exp.args[0]);
+    JBValue &rhs = this->eval_exp(*exp.args[1]);
+    this->return_value(binary_func(lhs, rhs));
 }
 
 
@@ -439,11 +726,9 @@ void AstInterpreter::do_assign(Node &lhs, JBValue &value) {
     } else if (E_Op *subscript = dynamic_cast<E_Op *>(&lhs)) {
         assert(subscript->op_code == OpCode::SUBSCRIPT);
         assert(subscript->args.size() == 2);
-        this->return_value(this->builtins.builtin_setitem(
-            this->eval_exp(*subscript->args[0]),
-            this->eval_exp(*subscript->args[1]),
-            value
-        ));
+        JBValue &base = this->eval_exp(*subscript->args[0]);
+        JBValue &index = this->eval_exp(*subscript->args[1]);
+        this->return_value(this->builtins.builtin_setitem(base, index, value));
     } else {
         assert(!"Unreachable");
     }
@@ -453,11 +738,9 @@ void AstInterpreter::do_assign(Node &lhs, JBValue &value) {
 void AstInterpreter::handle_binop_assign(E_Op &exp, AstInterpreter::BinaryFunc binary_func) {
     assert(exp.args.size() == 2);
     Node &lhs = *exp.args[0];
-    JBValue &result = binary_func(
-        this->eval_exp(lhs),
-        this->eval_exp(*exp.args[1])
-    );
-    this->do_assign(lhs, result);
+    JBValue &lhs_value = this->eval_exp(lhs);
+    JBValue &rhs_value = this->eval_exp(*exp.args[1]);
+    this->do_assign(lhs, binary_func(lhs_value, rhs_value));
 }
 
 
@@ -465,85 +748,141 @@ void AstInterpreter::handle_call(E_Op &call) {
     assert(call.op_code == OpCode::CALL);
     assert(call.args.size() == 2);
     Node &lhs = *call.args[0];
-    if (JBFunc *func = dynamic_cast<JBFunc *>(&this->eval_exp(lhs))) {
-        E_Op &supplied = static_cast<E_Op &>(*call.args[1]);
-        S_DeclareList *decl_list = nullptr;
-        if (func->code.args) {
-            decl_list = static_cast<S_DeclareList *>(func->code.args.get());
-        }
-
-        // check number of argument
-        size_t func_max_args = decl_list ? decl_list->decls.size() : 0;
-        if (supplied.args.size() > func_max_args) {
-            // TODO: mark missing args
-            throw JBError(string_fmt(
-                "Bad call: too many args, expect %zu, got %zu",
-                func_max_args, supplied.args.size()
-            ), supplied.pos_start, supplied.pos_end);
-        }
-        if (supplied.args.size() < func_max_args) {
-            if (!decl_list->decls[supplied.args.size()].initial) {
-                // TODO: mark extra args
-                throw JBError("Bad Call: missing args", supplied.pos_start, supplied.pos_end);
-            }
-        }
+    JBValue &callee = this->eval_exp(lhs);
+    E_Op &supplied = static_cast<E_Op &>(*call.args[1]);
 
+    if (JBFunc *func = dynamic_cast<JBFunc *>(&callee)) {
+        this->check_call_args(*func, supplied);
         // eval supplied arguments in current block
-        std::vector<JBValue *> evaluated_args;
-        for (Node::Ptr &item : supplied.args) {
-            evaluated_args.push_back(&this->eval_exp(*item));
-        }
+        JBArgs args = this->push_args(supplied);
+        ArgStackMark mark(this->arg_stack, args);
+        this->call_func(*func, args);
+    } else if (JBBuiltinFunc *builtin_func = dynamic_cast<JBBuiltinFunc *>(&callee)) {
+        this->call_builtin(*builtin_func, supplied);
+    } else {
+        throw JBError("Bad call: not a function", lhs.pos_start, lhs.pos_end);
+    }
+}
 
-        // create new frame and enter function block
-        S_Block &func_block = static_cast<S_Block &>(*func->code.block);
-        auto _ = this->enter(func_block, func->parent_frame);
-        Frame &func_frame = *this->cur_frame;
 
-        for (size_t i = 0; i < func_max_args; ++i) {
-            if (i < supplied.args.size()) {
-                // supplied arguments
-                func_frame.vars[i] = evaluated_args[i];
-            } else {
-                // eval default arguments in function block
-                assert(decl_list->decls[i].initial);
-                func_frame.vars[i] = &this->eval_exp(*decl_list->decls[i].initial);
-            }
-        }
+JBValue &AstInterpreter::handle_tail_call(E_Op &call) {
+    assert(call.op_code == OpCode::CALL);
+    assert(call.args.size() == 2);
+    Node &lhs = *call.args[0];
+    JBValue &callee = this->eval_exp(lhs);
+    E_Op &supplied = static_cast<E_Op &>(*call.args[1]);
+
+    if (JBFunc *func = dynamic_cast<JBFunc *>(&callee)) {
+        this->check_call_args(*func, supplied);
+        JBArgs args = this->push_args(supplied);
+        ArgStackMark mark(this->arg_stack, args);
+        this->tail_args.assign(args.begin(), args.end());
+        throw TailCallSignal(*func);
+    } else if (JBBuiltinFunc *builtin_func = dynamic_cast<JBBuiltinFunc *>(&callee)) {
+        this->call_builtin(*builtin_func, supplied);
+        JBValue *ret = nullptr;
+        std::swap(this->returned, ret);
+        return *ret;
+    } else {
+        throw JBError("Bad call: not a function", lhs.pos_start, lhs.pos_end);
+    }
+}
 
-        // execute function
-        this->handle_func_body(func_block);
-    } else if (JBBuiltinFunc *builtin_func = dynamic_cast<JBBuiltinFunc *>(&this->eval_exp(lhs))) {
-        E_Op &supplied = static_cast<E_Op &>(*call.args[1]);
-        std::vector<JBValue *> args;
-        for (Node::Ptr &item : supplied.args) {
-            args.push_back(&this->eval_exp(*item));
+
+void BaseInterpreter::check_call_args(JBFunc &func, E_Op &supplied) {
+    S_DeclareList *decl_list = static_cast<S_DeclareList *>(func.code.args.get());
+
+    // check number of argument
+    size_t func_max_args = decl_list ? decl_list->decls.size() : 0;
+    if (supplied.args.size() > func_max_args) {
+        // TODO: mark missing args
+        throw JBError(string_fmt(
+            "Bad call: too many args, expect %zu, got %zu",
+            func_max_args, supplied.args.size()
+        ), supplied.pos_start, supplied.pos_end);
+    }
+    if (supplied.args.size() < func_max_args) {
+        if (!decl_list->decls[supplied.args.size()].initial) {
+            // TODO: mark extra args
+            throw JBError("Bad Call: missing args", supplied.pos_start, supplied.pos_end);
         }
+    }
+}
 
-        this->return_value(builtin_func->func(args));
-    } else {
-        throw JBError("Bad call: not a function", lhs.pos_start, lhs.pos_end);
+
+JBArgs AstInterpreter::push_args(E_Op &supplied) {
+    // arguments are evaluated onto a reusable stack instead of a fresh vector per call,
+    // nested calls push above us and pop before we take the view
+    size_t base = this->arg_stack.size();
+    for (Node::Ptr &item : supplied.args) {
+        JBValue &value = this->eval_exp(*item);
+        this->arg_stack.push_back(&value);
     }
+    return JBArgs(this->arg_stack.data() + base, this->arg_stack.size() - base);
 }
 
 
-void AstInterpreter::handle_func_body(S_Block &block) {
-    try {
-        this->handle_block(block);
-    } catch (ReturnSignal &ret) {
-        return this->return_value(ret.value);
+void AstInterpreter::call_builtin(JBBuiltinFunc &func, E_Op &supplied) {
+    JBArgs args = this->push_args(supplied);
+    ArgStackMark mark(this->arg_stack, args);
+    this->return_value(func.call(args));
+}
+
+
+void AstInterpreter::call_func(JBFunc &first_func, JBArgs first_args) {
+    JBFunc *func = &first_func;
+    JBArgs args = first_args;
+    Frame *func_frame = nullptr;
+    ReplaceRestore<Frame *> _(&this->cur_frame, this->cur_frame);
+
+    // tail calls unwind back to here, so the native stack does not grow
+    while (true) {
+        this->compile_func(func->code);
+        S_Block &func_block = static_cast<S_Block &>(*func->code.block);
+        S_DeclareList *decl_list = static_cast<S_DeclareList *>(func->code.args.get());
+        size_t func_max_args = decl_list ? decl_list->decls.size() : 0;
+
+        if (func_frame && !func_frame->captured && func_frame->block == &func_block) {
+            // nothing refers to the frame of the caller anymore
+            func_frame->parent = func->parent_frame;
+            std::fill(func_frame->vars.begin(), func_frame->vars.end(), nullptr);
+        } else {
+            func_frame = &this->create_frame(func->parent_frame, func_block);
+        }
+        this->cur_frame = func_frame;
+
+        // supplied arguments
+        for (size_t i = 0; i < args.size(); ++i) {
+            func_frame->vars[i] = args[i];
+        }
+        // eval default arguments in function block
+        for (size_t i = args.size(); i < func_max_args; ++i) {
+            assert(decl_list->decls[i].initial);
+            func_frame->vars[i] = &this->eval_exp(*decl_list->decls[i].initial);
+        }
+
+        // execute function
+        try {
+            this->handle_block(func_block);
+        } catch (ReturnSignal &ret) {
+            return this->return_value(ret.value);
+        } catch (TailCallSignal &tail) {
+            func = &tail.func;
+            args = JBArgs(this->tail_args);
+            continue;
+        }
+        // default return value of function of null
+        return this->return_value(this->create<JBNull>());
     }
-    // default return value of function of null
-    this->return_value(this->create<JBNull>());
 }
 
 
 void AstInterpreter::handle_getitem(E_Op &exp) {
     assert(exp.op_code == OpCode::SUBSCRIPT);
     assert(exp.args.size() == 2);
-    this->return_value(this->builtins.builtin_getitem(
-        this->eval_exp(*exp.args[0]),
-        this->eval_exp(*exp.args[1])
-    ));
+    JBValue &base = this->eval_exp(*exp.args[0]);
+    JBValue &index = this->eval_exp(*exp.args[1]);
+    this->return_value(this->builtins.builtin_getitem(base, index));
 }
 
 
@@ -560,6 +899,25 @@ void AstInterpreter::handle_explist(E_Op &exp) {
 
 void AstInterpreter::handle_block(S_Block &block) {
     for (Node::Ptr &stmt : block.stmts) {
-        stmt->accept(*this);
+        node_dispatch(*this, *stmt);
     }
 }
+
+
+bool AstInterpreter::eval_compare(const FusedCompare &test) {
+    JBValue &lhs = this->eval_exp(test.lhs);
+    JBValue &rhs = this->eval_exp(test.rhs);
+    return this->compare(test.op_code, lhs, rhs);
+}
+
+
+// returns false on break
+bool AstInterpreter::handle_loop_body(S_Block &block, Frame &frame) {
+    ReplaceRestore<Frame *> _(&this->cur_frame, &frame);
+    try {
+        this->handle_block(block);
+    } catch (BreakSignal &) {
+        return false;
+    } catch (ContinueSignal &) {}
+    return true;
+}
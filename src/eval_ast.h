@@ -10,6 +10,7 @@
 #include "builtins.h"
 #include "jbobject.h"
 #include "node.h"
+#include "output.h"
 #include "visitor.h"
 #include "replace_restore.hpp"
 
@@ -19,18 +20,69 @@ public:
     Frame *parent = nullptr;
     S_Block *block = nullptr;
     std::vector<JBValue *> vars;
+    bool captured = false;  // referenced by a closure, can not be reused by tail calls
 
     virtual void each_ref(std::function<void (JBObject &)> callback) override;
 };
 
 
-class AstInterpreter : private NodeVisitor {
+// frames, builtins and analysis shared by AstInterpreter and StackInterpreter
+class BaseInterpreter {
 public:
-    AstInterpreter() : allocator(), builtins(allocator) {}
+    // superinstructions are only evaluated by AstInterpreter, see fuse_nodes()
+    explicit BaseInterpreter(bool fuse = false) : allocator(), builtins(allocator), fuse(fuse) {}
+    virtual ~BaseInterpreter() {}
 
     void set_builtin_table(const std::vector<std::pair<ustring, JBValue *>> &table);
     void set_default_builtin_table();
+    // print() writes to standard_output() by default
+    void set_output(OutputSink &output) {
+        this->builtins.set_output(output);
+    }
+    OutputSink &get_output() {
+        return this->builtins.get_output();
+    }
+
+protected:
+    template<class T, class ...Args>
+    T &create(Args &&...args) {
+        return *this->allocator.construct<T>(std::forward<Args>(args)...);
+    }
+    Frame &create_frame(Frame *parent, S_Block &block);
+    JBFunc &create_func(E_Func &func);
+    void extend_frame(S_DeclareList &decls);
+
+    JBValue **resolve_var(const E_Var &var);
+    void analyze_node(Node &node);
+    void compile_func(const E_Func &func);
+    void analyze_func(const E_Func &func);
+    void check_call_args(JBFunc &func, E_Op &supplied);
+    int64_t get_range_arg(JBValue &value, const Node &node);
+    static uint64_t range_count(int64_t start, int64_t stop, int64_t step);
+    Frame &next_loop_frame(Frame *frame, S_Block &block);
+    JBValue &apply_binop(OpCode op_code, JBValue &lhs, JBValue &rhs);
+    bool compare(OpCode op_code, JBValue &lhs, JBValue &rhs);
+
+    Frame *cur_frame = nullptr;
+
+    Allocator allocator;
+    Builtins builtins;
+    Node::Ptr builtin_block;
+    const bool fuse;
+};
+
+
+class AstInterpreter final : public BaseInterpreter, private NodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
+public:
+    AstInterpreter() : BaseInterpreter(true) {}
+
     void eval_incomplete_raw_block(S_Block &block);
+    // eval_incomplete_raw_block() in two steps, the analysis does not depend on evaluation, so
+    // the interpreter can be moved to another thread between them
+    void analyze_raw_block(S_Block &block);
+    void eval_analyzed_block(S_Block &block);
     void eval_raw_decl_list(S_DeclareList &decls);
     JBValue &eval_raw_exp(Node &exp);
     void eval_raw_stmt(Node &node);
@@ -41,6 +93,7 @@ private:
     virtual void visit_declare_list(S_DeclareList &decls);
     virtual void visit_condition(S_Condition &cond);
     virtual void visit_while(S_While &wh);
+    virtual void visit_for(S_For &loop);
     virtual void visit_return(S_Return &ret);
     virtual void visit_break(S_Break &brk);
     virtual void visit_continue(S_Continue &cont);
@@ -55,18 +108,14 @@ private:
     virtual void visit_string(E_String &str);
     virtual void visit_list(E_List &list);
     virtual void visit_null(E_Null &nil);
-
-    template<class T, class ...Args>
-    T &create(Args &&...args) {
-        return *this->allocator.construct<T>(std::forward<Args>(args)...);
-    }
-    Frame &create_frame(Frame *parent, S_Block &block);
+    virtual void visit_fused_var_update(E_FusedVarUpdate &fused);
+    virtual void visit_fused_set_item(E_FusedSetItem &fused);
+    virtual void visit_fused_condition(S_FusedCondition &fused);
+    virtual void visit_fused_while(S_FusedWhile &fused);
 
     void return_value(JBValue &value);
     ReplaceRestore<Frame *> enter(S_Block &block, Frame *parent_frame = nullptr);
     JBValue &eval_exp(Node &node);
-    JBValue **resolve_var(const E_Var &var);
-    void analyze_node(Node &node);
 
     using UnaryFunc = std::function<JBValue &(JBValue &)>;
     using BinaryFunc = std::function<JBValue &(JBValue &, JBValue &)>;
@@ -80,17 +129,19 @@ private:
     void do_assign(Node &lhs, JBValue &value);
     void handle_binop_assign(E_Op &exp, BinaryFunc binary_func);
     void handle_call(E_Op &call);
-    void handle_func_body(S_Block &block);
+    JBValue &handle_tail_call(E_Op &call);
+    JBArgs push_args(E_Op &supplied);
+    void call_builtin(JBBuiltinFunc &func, E_Op &supplied);
+    void call_func(JBFunc &func, JBArgs args);
     void handle_getitem(E_Op &exp);
     void handle_explist(E_Op &exp);
     void handle_block(S_Block &block);
+    bool handle_loop_body(S_Block &block, Frame &frame);
+    bool eval_compare(const FusedCompare &test);
 
-    Frame *cur_frame = nullptr;
     JBValue *returned = nullptr;
-
-    Allocator allocator;
-    Builtins builtins;
-    Node::Ptr builtin_block;
+    std::vector<JBValue *> arg_stack;
+    std::vector<JBValue *> tail_args;
 };
 
 
@@ -0,0 +1,652 @@
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include "eval_stack.h"
+#include "string_fmt.hpp"
+
+
+void StackInterpreter::eval_incomplete_raw_block(S_Block &block) {
+    this->start_incomplete_raw_block(block);
+    this->resume();
+}
+
+
+void StackInterpreter::eval_raw_decl_list(S_DeclareList &decls) {
+    this->start_raw_stmt(decls);
+    this->resume();
+}
+
+
+JBValue &StackInterpreter::eval_raw_exp(Node &exp) {
+    this->start_raw_exp(exp);
+    this->resume();
+    return this->take_result();
+}
+
+
+void StackInterpreter::eval_raw_stmt(Node &node) {
+    this->start_raw_stmt(node);
+    this->resume();
+}
+
+
+void StackInterpreter::start_incomplete_raw_block(S_Block &block) {
+    assert(this->is_finished());
+    this->analyze_node(block);
+    this->cur_frame = &this->create_frame(this->cur_frame, block);
+    this->push(block);
+    // frame is created already and kept after the block finished
+    this->conts.back().step = 1;
+}
+
+
+void StackInterpreter::start_raw_exp(Node &exp) {
+    assert(this->is_finished());
+    this->values.clear();
+    this->analyze_node(exp);
+    this->push(exp);
+}
+
+
+void StackInterpreter::start_raw_stmt(Node &node) {
+    assert(this->is_finished());
+    this->values.clear();
+    this->analyze_node(node);
+    if (S_DeclareList *decls = dynamic_cast<S_DeclareList *>(&node)) {
+        this->extend_frame(*decls);
+    }
+    this->push(node);
+}
+
+
+bool StackInterpreter::resume(size_t max_steps) {
+    try {
+        for (size_t i = 0; i < max_steps && !this->conts.empty(); ++i) {
+            node_dispatch(*this, *this->conts.back().node);
+        }
+    } catch (...) {
+        this->abort();
+        throw;
+    }
+    return this->is_finished();
+}
+
+
+bool StackInterpreter::is_finished() const {
+    return this->conts.empty();
+}
+
+
+JBValue &StackInterpreter::take_result() {
+    assert(this->is_finished());
+    assert(this->values.size() == 1);
+    JBValue &ret = *this->values.back();
+    this->values.clear();
+    return ret;
+}
+
+
+void StackInterpreter::set_stack_limit(size_t bytes) {
+    this->stack_limit = bytes;
+}
+
+
+size_t StackInterpreter::stack_bytes() const {
+    return this->conts.size() * sizeof(Continuation) + this->values.size() * sizeof(JBValue *);
+}
+
+
+void StackInterpreter::push(Node &node) {
+    if (this->stack_bytes() + sizeof(Continuation) > this->stack_limit) {
+        throw JBError(
+            string_fmt("Stack overflow: exceeds %zu bytes", this->stack_limit),
+            node.pos_start, node.pos_end
+        );
+    }
+    this->conts.emplace_back(node, this->cur_frame, this->values.size());
+}
+
+
+void StackInterpreter::pop() {
+    assert(!this->conts.empty());
+    Continuation &c = this->conts.back();
+    this->values.resize(c.value_base);
+    this->cur_frame = c.frame;
+    this->conts.pop_back();
+}
+
+
+void StackInterpreter::replace(Node &node) {
+    this->pop();
+    this->push(node);
+}
+
+
+void StackInterpreter::finish(JBValue &value) {
+    this->pop();
+    this->push_value(value);
+}
+
+
+void StackInterpreter::push_value(JBValue &value) {
+    this->values.push_back(&value);
+}
+
+
+JBValue &StackInterpreter::pop_value() {
+    assert(!this->values.empty());
+    JBValue *value = this->values.back();
+    this->values.pop_back();
+    return *value;
+}
+
+
+JBValue &StackInterpreter::operand(size_t i) {
+    assert(this->conts.back().value_base + i < this->values.size());
+    return *this->values[this->conts.back().value_base + i];
+}
+
+
+bool StackInterpreter::eval_next(const std::vector<Node::Ptr> &nodes) {
+    Continuation &c = this->conts.back();
+    if (c.index < nodes.size()) {
+        this->push(*nodes[c.index++]);
+        return false;
+    }
+    return true;
+}
+
+
+void StackInterpreter::abort() {
+    while (!this->conts.empty()) {
+        this->pop();
+    }
+    this->values.clear();
+}
+
+
+void StackInterpreter::visit_block(S_Block &block) {
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        this->cur_frame = &this->create_frame(this->cur_frame, block);
+        c.step = 1;
+    }
+    if (c.index < block.stmts.size()) {
+        this->push(*block.stmts[c.index++]);
+    } else {
+        this->pop();
+    }
+}
+
+
+void StackInterpreter::visit_program(Program &prog) {
+    this->visit_block(prog);
+}
+
+
+void StackInterpreter::visit_declare_list(S_DeclareList &decls) {
+    Continuation &c = this->conts.back();
+    if (c.step == 1) {
+        assert(decls.attr.start_index + c.index < this->cur_frame->vars.size());
+        this->cur_frame->vars[decls.attr.start_index + c.index] = &this->pop_value();
+        c.index++;
+    }
+    while (c.index < decls.decls.size() && !decls.decls[c.index].initial) {
+        c.index++;
+    }
+    if (c.index < decls.decls.size()) {
+        c.step = 1;
+        this->push(*decls.decls[c.index].initial);
+    } else {
+        this->pop();
+    }
+}
+
+
+void StackInterpreter::visit_condition(S_Condition &cond) {
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        c.step = 1;
+        this->push(*cond.condition);
+    } else if (this->builtins.is_truthy(this->pop_value())) {
+        this->replace(*cond.then_block);
+    } else if (cond.else_block) {
+        this->replace(*cond.else_block);
+    } else {
+        this->pop();
+    }
+}
+
+
+void StackInterpreter::visit_while(S_While &wh) {
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        c.kind = ContKind::LOOP;
+        c.step = 1;
+        this->push(*wh.condition);
+    } else if (this->builtins.is_truthy(this->pop_value())) {
+        c.step = 0;
+        this->push(*wh.block);
+    } else {
+        this->pop();
+    }
+}
+
+
+void StackInterpreter::visit_for(S_For &loop) {
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        c.kind = ContKind::LOOP;
+        c.step = 1;
+        this->push(loop.is_range() ? *loop.start : *loop.iterable);
+    } else if (!loop.is_range()) {
+        // operands: list
+        JBList *list = dynamic_cast<JBList *>(&this->operand(0));
+        if (list == nullptr) {
+            throw JBError(
+                "Type error: expect list", loop.iterable->pos_start, loop.iterable->pos_end
+            );
+        }
+        // the list may grow inside the loop
+        if (c.index < list->value.size()) {
+            this->enter_loop_body(loop, *list->value[c.index++]);
+        } else {
+            this->pop();
+        }
+    } else if (c.step == 1) {
+        c.step = 2;
+        this->push(*loop.stop);
+    } else if (c.step == 2) {
+        c.step = 3;
+        if (loop.step) {
+            this->push(*loop.step);
+        } else {
+            this->push_value(this->create<JBInt>(1));
+        }
+    } else if (c.step == 3) {
+        // operands: start, stop, step
+        c.counter = this->get_range_arg(this->operand(0), *loop.start);
+        int64_t stop = this->get_range_arg(this->operand(1), *loop.stop);
+        int64_t step = this->get_range_arg(this->operand(2), loop.step ? *loop.step : loop);
+        if (step == 0) {
+            throw JBError("Bad range: step is zero", loop.step->pos_start, loop.step->pos_end);
+        }
+        c.step = 4;
+        c.index = range_count(c.counter, stop, step);     // iterations left
+    } else {
+        if (c.index > 0) {
+            // step 5 after the first iteration, the counter is not past stop so never overflows
+            if (c.step == 5) {
+                c.counter += static_cast<JBInt &>(this->operand(2)).value;
+            }
+            --c.index;
+            JBInt *counter = nullptr;
+            if (loop.attr.reuse_counter && c.step == 5) {
+                counter = &static_cast<JBInt &>(*c.loop_frame->vars[0]);
+                counter->value = c.counter;
+            } else {
+                counter = &this->create<JBInt>(c.counter);
+            }
+            c.step = 5;
+            this->enter_loop_body(loop, *counter);
+        } else {
+            this->pop();
+        }
+    }
+}
+
+
+void StackInterpreter::visit_return(S_Return &ret) {
+    Continuation &c = this->conts.back();
+    if (c.step == 0 && ret.value) {
+        c.step = 1;
+        this->push(*ret.value);
+        if (ret.attr.is_tail_call) {
+            this->conts.back().kind = ContKind::TAIL_CALL;
+        }
+    } else if (c.step == 1) {
+        this->return_from_call(this->pop_value());
+    } else {
+        this->return_from_call(this->create<JBNull>());
+    }
+}
+
+
+void StackInterpreter::visit_break(S_Break &) {
+    this->unwind_to(ContKind::LOOP);
+    this->pop();
+}
+
+
+void StackInterpreter::visit_continue(S_Continue &) {
+    // loops set the step to resume at before entering the body
+    this->unwind_to(ContKind::LOOP);
+}
+
+
+void StackInterpreter::visit_stmt_exp(S_Exp &stmt) {
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        c.step = 1;
+        this->push(*stmt.value);
+    } else {
+        this->pop();
+    }
+}
+
+
+void StackInterpreter::visit_stmt_empty(S_Empty &) {
+    this->pop();
+}
+
+
+void StackInterpreter::visit_op(E_Op &exp) {
+    switch (exp.op_code) {
+    case OpCode::AND:
+        return this->handle_logic(exp, false);
+    case OpCode::OR:
+        return this->handle_logic(exp, true);
+    case OpCode::ASSIGN:
+        return this->handle_assign(exp);
+    case OpCode::PLUS_ASSIGN:
+    case OpCode::MINUS_ASSIGN:
+    case OpCode::STAR_ASSIGN:
+    case OpCode::SLASH_ASSIGN:
+    case OpCode::PERCENT_ASSIGN:
+        return this->handle_binop_assign(exp);
+    case OpCode::CALL:
+        return this->handle_call(exp);
+    case OpCode::SUBSCRIPT:
+        return this->handle_getitem(exp);
+    case OpCode::EXPLIST:
+        return this->handle_explist(exp);
+    default:
+        return this->handle_arith(exp);
+    }
+}
+
+
+void StackInterpreter::visit_var(E_Var &var) {
+    if (JBValue *value = *this->resolve_var(var)) {
+        this->finish(*value);
+    } else {
+        throw JBError("Unbound variable: " + u8_encode(var.name), var.pos_start, var.pos_end);
+    }
+}
+
+
+void StackInterpreter::visit_func(E_Func &func) {
+    this->finish(this->create_func(func));
+}
+
+
+void StackInterpreter::visit_bool(E_Bool &bool_node) {
+    this->finish(this->create<JBBool>(bool_node.value));
+}
+
+
+void StackInterpreter::visit_int(E_Int &int_node) {
+    this->finish(this->create<JBInt>(int_node.value));
+}
+
+
+void StackInterpreter::visit_float(E_Float &float_node) {
+    this->finish(this->create<JBFloat>(float_node.value));
+}
+
+
+void StackInterpreter::visit_string(E_String &str) {
+    this->finish(this->create<JBString>(str.value));
+}
+
+
+void StackInterpreter::visit_list(E_List &list) {
+    if (!this->eval_next(list.value)) {
+        return;
+    }
+    JBList &jblist = this->create<JBList>();
+    size_t base = this->conts.back().value_base;
+    jblist.value.assign(this->values.begin() + base, this->values.end());
+    this->finish(jblist);
+}
+
+
+void StackInterpreter::visit_null(E_Null &) {
+    this->finish(this->create<JBNull>());
+}
+
+
+void StackInterpreter::handle_arith(E_Op &exp) {
+    if (!this->eval_next(exp.args)) {
+        return;
+    }
+    if (exp.args.size() == 1) {
+        JBValue &value = this->operand(0);
+        switch (exp.op_code) {
+        case OpCode::PLUS:
+            return this->finish(this->builtins.builtin_pos(value));
+        case OpCode::MINUS:
+            return this->finish(this->builtins.builtin_neg(value));
+        case OpCode::NOT:
+            return this->finish(this->builtins.builtin_not(value));
+        default:
+            assert(!"Unreachable");
+        }
+    } else {
+        assert(exp.args.size() == 2);
+        this->finish(this->apply_binop(exp.op_code, this->operand(0), this->operand(1)));
+    }
+}
+
+
+void StackInterpreter::handle_logic(E_Op &exp, bool stop_on) {
+    assert(exp.args.size() == 2);
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        c.step = 1;
+        this->push(*exp.args[0]);
+    } else if (this->builtins.is_truthy(this->operand(0)) == stop_on) {
+        this->finish(this->operand(0));
+    } else {
+        // eval rhs in place of this node
+        this->replace(*exp.args[1]);
+    }
+}
+
+
+void StackInterpreter::handle_assign(E_Op &exp) {
+    assert(exp.args.size() == 2);
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        c.step = 1;
+        this->push(*exp.args[1]);
+        return;
+    }
+
+    Node &lhs = *exp.args[0];
+    if (E_Var *var = dynamic_cast<E_Var *>(&lhs)) {
+        JBValue &value = this->operand(0);
+        *this->resolve_var(*var) = &value;
+        this->finish(value);
+    } else {
+        E_Op &subscript = static_cast<E_Op &>(lhs);
+        assert(subscript.op_code == OpCode::SUBSCRIPT);
+        if (this->eval_next(subscript.args)) {
+            this->finish(this->builtins.builtin_setitem(
+                this->operand(1), this->operand(2), this->operand(0)
+            ));
+        }
+    }
+}
+
+
+void StackInterpreter::handle_binop_assign(E_Op &exp) {
+    assert(exp.args.size() == 2);
+    Continuation &c = this->conts.back();
+    if (c.step == 0) {
+        if (!this->eval_next(exp.args)) {
+            return;
+        }
+        JBValue &result = this->apply_binop(exp.op_code, this->operand(0), this->operand(1));
+        this->values.resize(c.value_base);
+        this->push_value(result);
+        c.step = 1;
+        c.index = 0;
+    }
+
+    Node &lhs = *exp.args[0];
+    if (E_Var *var = dynamic_cast<E_Var *>(&lhs)) {
+        JBValue &value = this->operand(0);
+        *this->resolve_var(*var) = &value;
+        this->finish(value);
+    } else {
+        // subscript is evaluated again like AstInterpreter::do_assign()
+        E_Op &subscript = static_cast<E_Op &>(lhs);
+        assert(subscript.op_code == OpCode::SUBSCRIPT);
+        if (this->eval_next(subscript.args)) {
+            this->finish(this->builtins.builtin_setitem(
+                this->operand(1), this->operand(2), this->operand(0)
+            ));
+        }
+    }
+}
+
+
+void StackInterpreter::handle_call(E_Op &call) {
+    assert(call.args.size() == 2);
+    Continuation &c = this->conts.back();
+    E_Op &supplied = static_cast<E_Op &>(*call.args[1]);
+
+    if (c.step == 0) {
+        // eval callee
+        c.step = 1;
+        this->push(*call.args[0]);
+        return;
+    } else if (c.step == 1) {
+        // eval supplied arguments in current block
+        if (!this->eval_next(supplied.args)) {
+            return;
+        }
+
+        JBValue &callee = this->operand(0);
+        size_t nargs = supplied.args.size();
+        if (JBFunc *func = dynamic_cast<JBFunc *>(&callee)) {
+            this->check_call_args(*func, supplied);
+            if (c.kind != ContKind::TAIL_CALL) {
+                return this->enter_func(this->conts.size() - 1, *func, nargs, false);
+            }
+
+            // move callee and arguments down to the caller, and reuse its continuation
+            this->tail_args.assign(this->values.begin() + c.value_base, this->values.end());
+            this->unwind_to(ContKind::CALL);
+            assert(this->values.size() == this->conts.back().value_base);
+            this->values.insert(this->values.end(), this->tail_args.begin(), this->tail_args.end());
+            this->enter_func(this->conts.size() - 1, *func, nargs, true);
+        } else if (JBBuiltinFunc *builtin_func = dynamic_cast<JBBuiltinFunc *>(&callee)) {
+            JBArgs args(this->values.data() + c.value_base + 1, nargs);
+            this->finish(builtin_func->call(args));
+        } else {
+            Node &lhs = *call.args[0];
+            throw JBError("Bad call: not a function", lhs.pos_start, lhs.pos_end);
+        }
+        return;
+    }
+
+    assert(c.kind == ContKind::CALL);
+    S_DeclareList *decl_list = static_cast<S_DeclareList *>(c.func->code.args.get());
+    size_t func_max_args = decl_list ? decl_list->decls.size() : 0;
+    if (c.step == 2) {
+        // eval default arguments in function block
+        if (c.index < func_max_args) {
+            c.step = 3;
+            this->push(*decl_list->decls[c.index].initial);
+        } else {
+            c.step = 4;
+            c.index = 0;
+        }
+    } else if (c.step == 3) {
+        this->cur_frame->vars[c.index] = &this->pop_value();
+        c.index++;
+        c.step = 2;
+    } else {
+        // execute function body in the function frame
+        S_Block &func_block = static_cast<S_Block &>(*c.func->code.block);
+        if (c.index < func_block.stmts.size()) {
+            this->push(*func_block.stmts[c.index++]);
+        } else {
+            // default return value of function of null
+            this->return_from_call(this->create<JBNull>());
+        }
+    }
+}
+
+
+void StackInterpreter::handle_getitem(E_Op &exp) {
+    if (this->eval_next(exp.args)) {
+        this->finish(this->builtins.builtin_getitem(this->operand(0), this->operand(1)));
+    }
+}
+
+
+void StackInterpreter::handle_explist(E_Op &exp) {
+    if (this->eval_next(exp.args)) {
+        this->finish(*this->values.back());   // last expression
+    }
+}
+
+
+void StackInterpreter::enter_loop_body(S_For &loop, JBValue &item) {
+    S_Block &block = static_cast<S_Block &>(*loop.block);
+    Frame &frame = this->next_loop_frame(this->conts.back().loop_frame, block);
+    this->conts.back().loop_frame = &frame;
+    frame.vars[0] = &item;
+
+    this->push(block);
+    // the frame is prepared already
+    this->conts.back().step = 1;
+    this->cur_frame = &frame;
+}
+
+
+// callee and arguments are the operands of conts[cont_index]
+void StackInterpreter::enter_func(size_t cont_index, JBFunc &func, size_t nargs, bool reuse_frame) {
+    Continuation &c = this->conts[cont_index];
+    this->compile_func(func.code);
+    S_Block &func_block = static_cast<S_Block &>(*func.code.block);
+
+    // the frame of the caller is current after unwinding a tail call
+    Frame *func_frame = this->cur_frame;
+    if (reuse_frame && !func_frame->captured && func_frame->block == &func_block) {
+        func_frame->parent = func.parent_frame;
+        std::fill(func_frame->vars.begin(), func_frame->vars.end(), nullptr);
+    } else {
+        func_frame = &this->create_frame(func.parent_frame, func_block);
+    }
+
+    for (size_t i = 0; i < nargs; ++i) {
+        func_frame->vars[i] = this->values[c.value_base + 1 + i];
+    }
+    this->values.resize(c.value_base);
+
+    c.kind = ContKind::CALL;
+    c.func = &func;
+    c.step = 2;
+    c.index = nargs;
+    this->cur_frame = func_frame;
+}
+
+
+void StackInterpreter::return_from_call(JBValue &value) {
+    this->unwind_to(ContKind::CALL);
+    this->finish(value);
+}
+
+
+// pop continuations above the nearest one of kind
+void StackInterpreter::unwind_to(ContKind kind) {
+    while (this->conts.back().kind != kind) {
+        this->pop();
+        assert(!this->conts.empty());
+    }
+}
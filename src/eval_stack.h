@@ -0,0 +1,117 @@
+#ifndef JIAOBENSCRIPT_EVAL_STACK_H
+#define JIAOBENSCRIPT_EVAL_STACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "eval_ast.h"
+#include "jbobject.h"
+#include "node.h"
+#include "visitor.h"
+
+
+// Evaluates the AST without recursing on the native stack. The continuation of every
+// unfinished node is kept in a growable heap stack, so the depth of recursion is bounded by
+// stack_limit only, and execution can be suspended after any number of steps.
+class StackInterpreter final : public BaseInterpreter, private NodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
+public:
+    static const size_t DEFAULT_STACK_LIMIT = 256 * 1024 * 1024;    // bytes
+
+    explicit StackInterpreter(size_t stack_limit = DEFAULT_STACK_LIMIT)
+        : stack_limit(stack_limit)
+    {}
+
+    void eval_incomplete_raw_block(S_Block &block);
+    void eval_raw_decl_list(S_DeclareList &decls);
+    JBValue &eval_raw_exp(Node &exp);
+    void eval_raw_stmt(Node &node);
+
+    // suspendable execution, start_*() then resume() until it returns true
+    void start_incomplete_raw_block(S_Block &block);
+    void start_raw_exp(Node &exp);
+    void start_raw_stmt(Node &node);
+    bool resume(size_t max_steps = SIZE_MAX);
+    bool is_finished() const;
+    JBValue &take_result();
+
+    void set_stack_limit(size_t bytes);
+    size_t stack_bytes() const;
+
+private:
+    enum class ContKind {
+        NORMAL,
+        LOOP,       // target of break and continue
+        CALL,       // executing a function body, target of return
+        TAIL_CALL,  // call expression returned by S_Return
+    };
+
+    struct Continuation {
+        Continuation(Node &node, Frame *frame, size_t value_base)
+            : node(&node), frame(frame), value_base(value_base)
+        {}
+
+        Node *node;
+        Frame *frame;           // restored when popped
+        size_t value_base;      // operands above this belong to the node
+        ContKind kind = ContKind::NORMAL;
+        int step = 0;
+        size_t index = 0;
+        JBFunc *func = nullptr; // ContKind::CALL only
+        int64_t counter = 0;            // S_For only
+        Frame *loop_frame = nullptr;    // S_For only
+    };
+
+    virtual void visit_block(S_Block &block);
+    virtual void visit_program(Program &prog);
+    virtual void visit_declare_list(S_DeclareList &decls);
+    virtual void visit_condition(S_Condition &cond);
+    virtual void visit_while(S_While &wh);
+    virtual void visit_for(S_For &loop);
+    virtual void visit_return(S_Return &ret);
+    virtual void visit_break(S_Break &brk);
+    virtual void visit_continue(S_Continue &cont);
+    virtual void visit_stmt_exp(S_Exp &stmt);
+    virtual void visit_stmt_empty(S_Empty &stmt);
+    virtual void visit_op(E_Op &op);
+    virtual void visit_var(E_Var &var);
+    virtual void visit_func(E_Func &func);
+    virtual void visit_bool(E_Bool &bool_node);
+    virtual void visit_int(E_Int &int_node);
+    virtual void visit_float(E_Float &float_node);
+    virtual void visit_string(E_String &str);
+    virtual void visit_list(E_List &list);
+    virtual void visit_null(E_Null &nil);
+
+    void push(Node &node);
+    void pop();
+    void replace(Node &node);
+    void finish(JBValue &value);
+    void push_value(JBValue &value);
+    JBValue &pop_value();
+    JBValue &operand(size_t i);
+    bool eval_next(const std::vector<Node::Ptr> &nodes);
+    void abort();
+
+    void handle_arith(E_Op &exp);
+    void handle_logic(E_Op &exp, bool stop_on);
+    void handle_assign(E_Op &exp);
+    void handle_binop_assign(E_Op &exp);
+    void handle_call(E_Op &call);
+    void handle_getitem(E_Op &exp);
+    void handle_explist(E_Op &exp);
+    void enter_loop_body(S_For &loop, JBValue &item);
+    void enter_func(size_t cont_index, JBFunc &func, size_t nargs, bool reuse_frame);
+    void return_from_call(JBValue &value);
+    void unwind_to(ContKind kind);
+
+    std::vector<Continuation> conts;
+    std::vector<JBValue *> values;
+    std::vector<JBValue *> tail_args;
+    size_t stack_limit;
+};
+
+
+#endif //JIAOBENSCRIPT_EVAL_STACK_H
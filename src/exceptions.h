@@ -14,13 +14,13 @@ class BaseException : public std::runtime_error {
 public:
     explicit BaseException(
         const std::string &msg,
-        const SourcePos &pos_start = SourcePos(), const SourcePos &pos_end = SourcePos()
+        const SourceLoc &pos_start = SourceLoc(), const SourceLoc &pos_end = SourceLoc()
     )
         : std::runtime_error(msg), pos_start(pos_start), pos_end(pos_end)
     {}
 
-    SourcePos pos_start;
-    SourcePos pos_end;
+    SourceLoc pos_start;
+    SourceLoc pos_end;
 };
 
 
@@ -0,0 +1,246 @@
+#include <cassert>
+#include <utility>
+
+#include "fuse_nodes.h"
+#include "visitor.h"
+
+
+static bool is_arith(OpCode op_code) {
+    switch (op_code) {
+    case OpCode::PLUS:
+    case OpCode::MINUS:
+    case OpCode::STAR:
+    case OpCode::SLASH:
+    case OpCode::PERCENT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+static bool is_compare(OpCode op_code) {
+    switch (op_code) {
+    case OpCode::LESS:
+    case OpCode::LESSEQ:
+    case OpCode::GREAT:
+    case OpCode::GREATEQ:
+    case OpCode::EQ:
+    case OpCode::NEQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+// x op= y -> op
+static bool get_binop_of_assign(OpCode op_code, OpCode &binop) {
+    switch (op_code) {
+    case OpCode::PLUS_ASSIGN:
+        binop = OpCode::PLUS;
+        return true;
+    case OpCode::MINUS_ASSIGN:
+        binop = OpCode::MINUS;
+        return true;
+    case OpCode::STAR_ASSIGN:
+        binop = OpCode::STAR;
+        return true;
+    case OpCode::SLASH_ASSIGN:
+        binop = OpCode::SLASH;
+        return true;
+    case OpCode::PERCENT_ASSIGN:
+        binop = OpCode::PERCENT;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+static E_Op *as_binop(Node *node) {
+    if (node->kind == NodeKind::E_OP) {
+        E_Op *op = static_cast<E_Op *>(node);
+        if (op->args.size() == 2) {
+            return op;
+        }
+    }
+    return nullptr;
+}
+
+
+static E_Var *as_var(Node *node) {
+    return node->kind == NodeKind::E_VAR ? static_cast<E_Var *>(node) : nullptr;
+}
+
+
+// both are resolved in the same block
+static bool is_same_var(const E_Var &lhs, const E_Var &rhs) {
+    return lhs.attr.is_local == rhs.attr.is_local && lhs.attr.index == rhs.attr.index;
+}
+
+
+// x op= y, x = x op y, base[index] = y
+static Node *fuse_assign(E_Op &exp) {
+    OpCode binop;
+    E_Var *var = as_var(exp.args[0].get());
+
+    if (var != nullptr && get_binop_of_assign(exp.op_code, binop)) {
+        // x op= y
+        return new E_FusedVarUpdate(Node::Ptr(&exp), *var, binop, *exp.args[1]);
+    }
+    if (exp.op_code != OpCode::ASSIGN) {
+        return nullptr;
+    }
+    if (var != nullptr) {
+        // x = x op y
+        E_Op *value = as_binop(exp.args[1].get());
+        if (value != nullptr && is_arith(value->op_code)) {
+            E_Var *operand = as_var(value->args[0].get());
+            if (operand != nullptr && is_same_var(*var, *operand)) {
+                return new E_FusedVarUpdate(
+                    Node::Ptr(&exp), *var, value->op_code, *value->args[1]
+                );
+            }
+        }
+    } else if (E_Op *subscript = as_binop(exp.args[0].get())) {
+        // base[index] = y
+        assert(subscript->op_code == OpCode::SUBSCRIPT);
+        return new E_FusedSetItem(
+            Node::Ptr(&exp), *subscript->args[0], *subscript->args[1], *exp.args[1]
+        );
+    }
+    return nullptr;
+}
+
+
+Node *fuse_node(Node &node) {
+    switch (node.kind) {
+    case NodeKind::E_OP:
+        if (E_Op *exp = as_binop(&node)) {
+            return fuse_assign(*exp);
+        }
+        return nullptr;
+    case NodeKind::S_CONDITION: {
+        S_Condition &cond = static_cast<S_Condition &>(node);
+        E_Op *test = as_binop(cond.condition.get());
+        if (test != nullptr && is_compare(test->op_code)) {
+            return new S_FusedCondition(
+                Node::Ptr(&cond), {test->op_code, *test->args[0], *test->args[1]}
+            );
+        }
+        return nullptr;
+    }
+    case NodeKind::S_WHILE: {
+        S_While &wh = static_cast<S_While &>(node);
+        E_Op *test = as_binop(wh.condition.get());
+        if (test != nullptr && is_compare(test->op_code)) {
+            return new S_FusedWhile(
+                Node::Ptr(&wh), {test->op_code, *test->args[0], *test->args[1]}
+            );
+        }
+        return nullptr;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+
+class Fuser final : private NodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
+public:
+    void fuse_children(Node &node) {
+        node_dispatch(*this, node);
+    }
+
+private:
+    virtual void visit_block(S_Block &block) {
+        for (Node::Ptr &stmt : block.stmts) {
+            this->fuse(stmt);
+        }
+    }
+
+    virtual void visit_program(Program &prog) {
+        this->visit_block(prog);
+    }
+
+    virtual void visit_declare_list(S_DeclareList &decls) {
+        for (auto &pair : decls.decls) {
+            if (pair.initial) {
+                this->fuse(pair.initial);
+            }
+        }
+    }
+
+    virtual void visit_condition(S_Condition &cond) {
+        this->fuse(cond.condition);
+        this->fuse(cond.then_block);
+        if (cond.else_block) {
+            this->fuse(cond.else_block);
+        }
+    }
+
+    virtual void visit_while(S_While &wh) {
+        this->fuse(wh.condition);
+        this->fuse(wh.block);
+    }
+
+    virtual void visit_for(S_For &loop) {
+        if (loop.is_range()) {
+            this->fuse(loop.start);
+            this->fuse(loop.stop);
+            if (loop.step) {
+                this->fuse(loop.step);
+            }
+        } else {
+            this->fuse(loop.iterable);
+        }
+        this->fuse(loop.block);
+    }
+
+    virtual void visit_return(S_Return &ret) {
+        if (ret.value) {
+            this->fuse(ret.value);
+        }
+    }
+
+    virtual void visit_stmt_exp(S_Exp &stmt) {
+        this->fuse(stmt.value);
+    }
+
+    virtual void visit_op(E_Op &exp) {
+        for (Node::Ptr &arg : exp.args) {
+            this->fuse(arg);
+        }
+    }
+
+    virtual void visit_func(E_Func &func) {
+        if (func.args) {
+            node_dispatch(*this, *func.args);
+        }
+        this->fuse(func.block);
+    }
+
+    virtual void visit_list(E_List &list) {
+        for (Node::Ptr &item : list.value) {
+            this->fuse(item);
+        }
+    }
+
+    // children first, then the node itself
+    void fuse(Node::Ptr &slot) {
+        node_dispatch(*this, *slot);
+        if (Node *fused = fuse_node(*slot)) {
+            // the fused node takes the original
+            slot.release();
+            slot.reset(fused);
+        }
+    }
+};
+
+
+void fuse_nodes(Node &node) {
+    Fuser().fuse_children(node);
+}
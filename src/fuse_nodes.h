@@ -0,0 +1,14 @@
+#ifndef JIAOBENSCRIPT_FUSE_NODES_H
+#define JIAOBENSCRIPT_FUSE_NODES_H
+
+#include "node.h"
+
+
+// replace children of node matching common shapes with superinstructions,
+// must run after name resolution
+void fuse_nodes(Node &node);
+// the superinstruction taking node if it matches, its children are fused and resolved already
+Node *fuse_node(Node &node);
+
+
+#endif //JIAOBENSCRIPT_FUSE_NODES_H
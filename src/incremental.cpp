@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <utility>
+
+#include "incremental.h"
+#include "exceptions.h"
+#include "name_resolve.h"
+#include "visitor.h"
+
+
+namespace {
+
+// moves the source positions of a statement parsed before an edit
+class Shifter final : private NodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
+public:
+    explicit Shifter(uint32_t delta) : delta(delta) {}
+
+    void node(Node &node) {
+        this->shift(node.pos_start);
+        this->shift(node.pos_end);
+        node_dispatch(*this, node);
+    }
+
+private:
+    void shift(SourceLoc &loc) {
+        if (loc.is_valid()) {
+            loc.offset += this->delta;
+        }
+    }
+
+    void optional(const Node::Ptr &node) {
+        if (node) {
+            this->node(*node);
+        }
+    }
+
+    void list(const std::vector<Node::Ptr> &nodes) {
+        for (const Node::Ptr &node : nodes) {
+            this->node(*node);
+        }
+    }
+
+    virtual void visit_block(S_Block &block) { this->list(block.stmts); }
+    virtual void visit_program(Program &prog) { this->list(prog.stmts); }
+    virtual void visit_declare_list(S_DeclareList &decls) {
+        for (const auto &pair : decls.decls) {
+            this->optional(pair.initial);
+        }
+    }
+    virtual void visit_condition(S_Condition &cond) {
+        this->node(*cond.condition);
+        this->node(*cond.then_block);
+        this->optional(cond.else_block);
+    }
+    virtual void visit_while(S_While &wh) {
+        this->node(*wh.condition);
+        this->node(*wh.block);
+    }
+    virtual void visit_for(S_For &loop) {
+        this->node(*loop.var);
+        this->optional(loop.start);
+        this->optional(loop.stop);
+        this->optional(loop.step);
+        this->optional(loop.iterable);
+        this->node(*loop.block);
+    }
+    virtual void visit_return(S_Return &ret) { this->optional(ret.value); }
+    virtual void visit_stmt_exp(S_Exp &stmt) { this->node(*stmt.value); }
+    virtual void visit_op(E_Op &op) { this->list(op.args); }
+    virtual void visit_func(E_Func &func) {
+        this->optional(func.args);
+        this->node(*func.block);
+    }
+    virtual void visit_list(E_List &list) { this->list(list.value); }
+    // the program is analyzed without fusion
+    virtual void visit_fused_var_update(E_FusedVarUpdate &) { assert(!"fused node"); }
+    virtual void visit_fused_set_item(E_FusedSetItem &) { assert(!"fused node"); }
+    virtual void visit_fused_condition(S_FusedCondition &) { assert(!"fused node"); }
+    virtual void visit_fused_while(S_FusedWhile &) { assert(!"fused node"); }
+
+    uint32_t delta;
+};
+
+
+// an if statement without a final else is continued by an else after it
+bool takes_else(const Node &stmt) {
+    const Node *node = &stmt;
+    while (node->kind == NodeKind::S_CONDITION) {
+        const S_Condition &cond = static_cast<const S_Condition &>(*node);
+        if (!cond.else_block) {
+            return true;
+        }
+        node = cond.else_block.get();
+    }
+    return false;
+}
+
+
+// the first index in [lo, hi) for which pred is false, pred holds for a prefix
+template<class Pred>
+size_t partition_index(size_t lo, size_t hi, Pred pred) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pred(mid)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+}   // namespace
+
+
+IncrementalProgram::IncrementalProgram(S_Block *scope) {
+    this->prog.attr.parent = scope;
+}
+
+
+void IncrementalProgram::edit(uint32_t begin, uint32_t end, const std::string &utf8) {
+    assert(begin <= end && end <= this->text.size());
+    ustring inserted = u8_decode(utf8);
+
+    // a failed span apart from the edit is parsed again too, in source order
+    Span span = this->span_of(begin, end);
+    std::vector<Span> spans;
+    if (this->has_broken) {
+        const Span &other = this->broken;
+        if (other.begin <= span.end && span.begin <= other.end) {
+            span = {
+                std::min(span.first, other.first), std::max(span.last, other.last),
+                std::min(span.begin, other.begin), std::max(span.end, other.end),
+            };
+        } else if (other.end < span.begin) {
+            spans.push_back(other);
+        }
+    }
+    spans.push_back(span);
+    if (this->has_broken && this->broken.begin > span.end) {
+        spans.push_back(this->broken);
+    }
+    this->has_broken = false;
+
+    uint32_t delta = static_cast<uint32_t>(inserted.size()) - (end - begin);
+    this->text.replace(begin, end - begin, inserted);
+    for (Span &s : spans) {
+        if (s.begin > end) {
+            s.begin += delta;
+        }
+        if (s.end >= end) {
+            s.end += delta;
+        }
+    }
+    for (size_t i = span.last; i < this->shifts.size(); ++i) {
+        this->shifts[i] += delta;
+    }
+
+    this->reparsed = 0;
+    for (size_t k = 0; k < spans.size(); ++k) {
+        size_t count = this->prog.stmts.size();
+        bool to_end;
+        try {
+            to_end = this->reparse(spans[k]);
+        } catch (...) {
+            // the spans left are not parsed
+            if (k + 1 < spans.size()) {
+                this->broken.last = spans.back().last;
+                this->broken.end = spans.back().end;
+            }
+            throw;
+        }
+        if (to_end) {
+            break;
+        }
+        for (size_t rest = k + 1; rest < spans.size(); ++rest) {
+            spans[rest].first += this->prog.stmts.size() - count;
+            spans[rest].last += this->prog.stmts.size() - count;
+        }
+    }
+}
+
+
+Program &IncrementalProgram::program() {
+    std::vector<Node::Ptr> &stmts = this->prog.stmts;
+    for (size_t i = 0; i < stmts.size(); ++i) {
+        if (this->shifts[i] != 0) {
+            Shifter(this->shifts[i]).node(*stmts[i]);
+            this->shifts[i] = 0;
+        }
+    }
+    if (stmts.empty()) {
+        this->prog.pos_start = this->prog.pos_end = SourceLoc();
+    } else {
+        this->prog.pos_start = stmts.front()->pos_start;
+        this->prog.pos_end = stmts.back()->pos_end;
+    }
+    return this->prog;
+}
+
+
+// the statements overlapping or next to [begin, end) of the source, with the space around them
+IncrementalProgram::Span IncrementalProgram::span_of(uint32_t begin, uint32_t end) const {
+    size_t count = this->prog.stmts.size();
+    size_t first = partition_index(0, count, [&](size_t i) {
+        return this->end_of(i) < begin;
+    });
+    size_t last = partition_index(first, count, [&](size_t i) {
+        return this->start_of(i) <= end;
+    });
+    if (first > 0 && !this->is_broken(first - 1) && takes_else(*this->prog.stmts[first - 1])) {
+        --first;
+    }
+    return {
+        first, last,
+        first > 0 ? this->end_of(first - 1) : 0,
+        last < count ? this->start_of(last) : static_cast<uint32_t>(this->text.size()),
+    };
+}
+
+
+// Parses the span again, or the rest of the source from it if the statements after the span are
+// affected, true in the latter case. The span is marked broken on error.
+bool IncrementalProgram::reparse(const Span &span) {
+    bool at_end = span.last == this->prog.stmts.size();
+    try {
+        if (!this->replace(span, at_end)) {
+            at_end = true;
+            Span rest {
+                span.first, this->prog.stmts.size(),
+                span.begin, static_cast<uint32_t>(this->text.size()),
+            };
+            bool replaced = this->replace(rest, true);
+            assert(replaced);
+            (void)replaced;
+        }
+    } catch (...) {
+        this->has_broken = true;
+        this->broken = span;
+        throw;
+    }
+    return at_end;
+}
+
+
+// Replaces the statements of the span by the ones parsed from its source, false if the
+// statements after the span have to be parsed again. Nothing is changed on error.
+bool IncrementalProgram::replace(const Span &span, bool at_end) {
+    Node::Ptr parsed = this->parse(span.begin, span.end, at_end);
+    if (!parsed) {
+        return false;
+    }
+    std::vector<Node::Ptr> &stmts = static_cast<Program &>(*parsed).stmts;
+
+    // the names declared by the span take the indexes of the ones it declared before
+    auto &locals = this->prog.attr.local_info;
+    size_t start = this->locals_before(span.first);
+    size_t nreplaced = this->locals_before(span.last) - start;
+    std::vector<S_Block::AttrType::VarInfo> after(
+        std::make_move_iterator(locals.begin() + start), std::make_move_iterator(locals.end()));
+    auto restore = [&]() {
+        locals.erase(locals.begin() + start, locals.end());
+        locals.insert(
+            locals.end(), std::make_move_iterator(after.begin()),
+            std::make_move_iterator(after.end()));
+    };
+
+    locals.erase(locals.begin() + start, locals.end());
+    try {
+        analyze_stmts_in_block(&this->prog, stmts);
+    } catch (...) {
+        restore();
+        throw;
+    }
+
+    // the statements after are kept if they see the same names at the same indexes
+    size_t ndeclared = locals.size() - start;
+    if (!at_end && !(ndeclared == nreplaced
+        && std::equal(locals.begin() + start, locals.end(), after.begin())))
+    {
+        restore();
+        return false;
+    }
+    locals.insert(
+        locals.end(), std::make_move_iterator(after.begin() + nreplaced),
+        std::make_move_iterator(after.end()));
+
+    std::vector<Node::Ptr> &dest = this->prog.stmts;
+    dest.erase(dest.begin() + span.first, dest.begin() + span.last);
+    dest.insert(
+        dest.begin() + span.first,
+        std::make_move_iterator(stmts.begin()), std::make_move_iterator(stmts.end()));
+    this->shifts.erase(this->shifts.begin() + span.first, this->shifts.begin() + span.last);
+    this->shifts.insert(this->shifts.begin() + span.first, stmts.size(), 0);
+    this->reparsed += stmts.size();
+    return true;
+}
+
+
+// the statements parsed from [begin, end) of the source, nullptr if they may be continued by the
+// source after end
+Node::Ptr IncrementalProgram::parse(uint32_t begin, uint32_t end, bool at_end) {
+    this->tokenizer.reset();
+    this->parser.reset();
+    this->tokenizer.start_at(SourceLoc(begin));
+    this->parser.start_program();
+
+    auto feed = [&](unichar ch) {
+        this->tokenizer.feed(ch);
+        this->parser.feed(this->tokenizer);
+    };
+    for (uint32_t i = begin; i < end; ++i) {
+        feed(this->text[i]);
+    }
+    if (at_end) {
+        // ends the last token
+        feed('\n');
+    } else if (!this->tokenizer.is_ready()) {
+        return Node::Ptr();
+    }
+
+    if (!this->parser.has_tokens()) {
+        // comments only
+        return Node::Ptr(new Program());
+    }
+    if (!at_end) {
+        try {
+            if (!this->parser.can_end()) {
+                return Node::Ptr();
+            }
+        } catch (ParserError &exc) {
+            // an expression statement without semicolon at the end may be continued
+            if (!exc.pos_start.is_valid()) {
+                return Node::Ptr();
+            }
+            throw;
+        }
+    }
+    return this->parser.pop_result();
+}
+
+
+// number of the top level names declared by the statements before index
+size_t IncrementalProgram::locals_before(size_t index) const {
+    for (size_t i = index; i-- > 0; ) {
+        const Node &stmt = *this->prog.stmts[i];
+        if (stmt.kind == NodeKind::S_DECLARE_LIST) {
+            const S_DeclareList &decls = static_cast<const S_DeclareList &>(stmt);
+            return decls.attr.start_index + decls.decls.size();
+        }
+    }
+    return 0;
+}
+
+
+uint32_t IncrementalProgram::start_of(size_t index) const {
+    if (this->is_broken(index)) {
+        return this->broken.begin;
+    }
+    return this->prog.stmts[index]->pos_start.offset + this->shifts[index];
+}
+
+
+uint32_t IncrementalProgram::end_of(size_t index) const {
+    if (this->is_broken(index)) {
+        return this->broken.end;
+    }
+    return this->prog.stmts[index]->pos_end.offset + 1 + this->shifts[index];
+}
@@ -0,0 +1,76 @@
+#ifndef JIAOBENSCRIPT_INCREMENTAL_H
+#define JIAOBENSCRIPT_INCREMENTAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "node.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "unicode.h"
+
+
+// A program kept parsed and analyzed while its source is edited, for an editor checking the
+// source on every change. An edit only tokenizes and parses the top level statements it touches,
+// the others are kept with their resolved names, and their positions are moved on demand. The
+// statements after an edit are parsed again only if it leaves a construct open or changes the
+// names declared at the top level.
+class IncrementalProgram {
+public:
+    // names not declared by the program are resolved in scope, which must outlive this
+    explicit IncrementalProgram(S_Block *scope = nullptr);
+    IncrementalProgram(const IncrementalProgram &) = delete;
+    IncrementalProgram &operator=(const IncrementalProgram &) = delete;
+
+    // Replaces the code points [begin, end) of the source by utf-8 text. Throws the first error
+    // of the changed statements, they are kept as last parsed and are parsed again by the next
+    // edit until the error is fixed.
+    void edit(uint32_t begin, uint32_t end, const std::string &text);
+
+    const ustring &source() const {
+        return this->text;
+    }
+    Program &program();
+    bool has_error() const {
+        return this->has_broken;
+    }
+    // top level statements parsed by the last edit
+    size_t reparsed_count() const {
+        return this->reparsed;
+    }
+
+private:
+    // the statements [first, last) and the source [begin, end) they are parsed from
+    struct Span {
+        size_t first;
+        size_t last;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    Span span_of(uint32_t begin, uint32_t end) const;
+    bool reparse(const Span &span);
+    bool replace(const Span &span, bool at_end);
+    Node::Ptr parse(uint32_t begin, uint32_t end, bool at_end);
+    size_t locals_before(size_t index) const;
+
+    bool is_broken(size_t index) const {
+        return this->has_broken && this->broken.first <= index && index < this->broken.last;
+    }
+    uint32_t start_of(size_t index) const;
+    uint32_t end_of(size_t index) const;    // exclusive
+
+    Tokenizer tokenizer;
+    Parser parser;
+    ustring text;
+    Program prog;
+    std::vector<uint32_t> shifts;   // of the statements, not yet applied to their nodes
+    bool has_broken = false;
+    Span broken {};                 // failed to parse or analyze, the statements are stale
+    size_t reparsed = 0;
+};
+
+
+#endif //JIAOBENSCRIPT_INCREMENTAL_H
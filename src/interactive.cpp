@@ -9,6 +9,7 @@
 #include "interactive.h"
 #include "exceptions.h"
 #include "line_highlight.h"
+#include "output.h"
 #include "unicode.h"
 #include "string_fmt.hpp"
 
@@ -49,6 +50,8 @@ void InteractiveRepl::feed(const std::string &line) {
 
         this->reset();
     }
+    // before the next prompt
+    this->interp.get_output().flush();
 }
 
 
@@ -57,16 +60,19 @@ void InteractiveRepl::feed(const std::string &line) {
 
 void InteractiveRepl::error(
     const std::string &type, const std::string &msg,
-    const SourcePos &pos_start, const SourcePos &pos_end)
+    const SourceLoc &pos_start, const SourceLoc &pos_end)
 {
+    this->interp.get_output().flush();
     std::cerr << type << ": " << msg << std::endl;
     if (pos_start.is_valid()) {
-        line_lighlight(this->lines, pos_start, pos_end);
+        line_lighlight(std::cerr, this->lines, pos_start, pos_end);
     }
 }
 
 
 void InteractiveRepl::feed_inner(const std::string &line) {
+    auto _arena = this->arena.enter();
+
     ustring uline = u8_decode(line);
     uline.push_back('\n');
     this->lines.push_back(uline);
@@ -77,9 +83,7 @@ void InteractiveRepl::feed_inner(const std::string &line) {
     for (unichar ch : uline) {
         this->tokenizer.feed(ch);
     }
-    while (Token::Ptr tok = this->tokenizer.pop()) {
-        this->parser.feed(*tok);
-    }
+    this->parser.feed(this->tokenizer);
 
     if (!this->tokenizer.is_ready() || !this->parser.can_end()) {
         return;
@@ -106,7 +110,11 @@ std::string InteractiveRepl::get_input_prompt() {
 
 
 void InteractiveRepl::print_result(JBValue &value) {
-    std::cout << string_fmt("Out[%d]: ", this->count - 1) << value.repr() << std::endl;
+    OutputSink &out = this->interp.get_output();
+    out.write(string_fmt("Out[%d]: ", this->count - 1));
+    value.write_repr(out);
+    out.end_line();
+    out.flush();
 }
 
 
@@ -9,6 +9,7 @@
 #include "parser.h"
 #include "eval_ast.h"
 #include "node.h"
+#include "node_arena.h"
 
 
 class InteractiveRepl {
@@ -20,7 +21,7 @@ private:
     void feed(const std::string &line);
     void feed_inner(const std::string &line);
     void error(const std::string &type, const std::string &msg,
-        const SourcePos &pos_start = SourcePos(), const SourcePos &pos_end = SourcePos()
+        const SourceLoc &pos_start = SourceLoc(), const SourceLoc &pos_end = SourceLoc()
     );
     void print_start_info();
     std::string get_input_prompt();
@@ -31,6 +32,7 @@ private:
 
     bool eof = false;
     int count = 0;
+    NodeArena arena;    // declared first, destroyed after everything holding nodes
     Tokenizer tokenizer;
     Parser parser;
     AstInterpreter interp;
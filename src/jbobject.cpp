@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 #include "jbobject.h"
 #include "eval_ast.h"
+#include "number_format.h"
+#include "output.h"
 #include "unicode.h"
 #include "string_fmt.hpp"
 
@@ -16,6 +20,13 @@ bool JBValue::is_truthy() const {
 }
 
 
+std::string JBValue::repr() const {
+    StringOutput out;
+    this->write_repr(out);
+    return out.str();
+}
+
+
 static std::pair<bool, double> to_double(const JBValue &value) {
     if (const JBInt *obj_int = dynamic_cast<const JBInt *>(&value)) {
         return {true, obj_int->value};
@@ -35,8 +46,9 @@ bool JBInt::eq(const JBValue &rhs) const {
 
 
 template<>
-std::string JBInt::repr() const {
-    return std::to_string(this->value);
+void JBInt::write_repr(OutputSink &out) const {
+    char buf[INT_FORMAT_SIZE];
+    out.write(buf, format_int(buf, this->value) - buf);
 }
 
 
@@ -48,8 +60,9 @@ bool JBFloat::eq(const JBValue &rhs) const {
 
 
 template<>
-std::string JBFloat::repr() const {
-    return std::to_string(this->value);
+void JBFloat::write_repr(OutputSink &out) const {
+    char buf[DOUBLE_FORMAT_SIZE];
+    out.write(buf, format_double(buf, this->value) - buf);
 }
 
 
@@ -70,8 +83,12 @@ bool JBBool::eq(const JBValue &rhs) const {
 
 
 template<>
-std::string JBBool::repr() const {
-    return this->value ? "true" : "false";
+void JBBool::write_repr(OutputSink &out) const {
+    if (this->value) {
+        out.write("true", 4);
+    } else {
+        out.write("false", 5);
+    }
 }
 
 
@@ -80,38 +97,44 @@ bool JBString::operator==(const JBValue &rhs) const {
 }
 
 
-static std::string quote_char(unichar ch) {
-    if (ch == '"') {
-        return "\\\"";
-    } else if (ch == '\\') {
-        return "\\\\";
-    } else if (ch == '/') {
-        return "/";     // no escape
-    } else if (ch == '\b') {
-        return "\\b";
-    } else if (ch == '\f') {
-        return "\\f";
-    } else if (ch == '\n') {
-        return "\\n";
-    } else if (ch == '\t') {
-        return "\\t";
-    } else if (ch < 0x20) {
-        return string_fmt("\\u%04x", ch);
-    } else {
-        return u8_encode({ch});
+// written as is, other chars are escaped
+static bool is_plain_char(unichar ch) {
+    return ch >= 0x20 && ch != '"' && ch != '\\';
+}
+
+
+static void write_escaped(OutputSink &out, unichar ch) {
+    out.put('\\');
+    switch (ch) {
+    case '"':   out.put('"'); break;
+    case '\\':  out.put('\\'); break;
+    case '\b':  out.put('b'); break;
+    case '\f':  out.put('f'); break;
+    case '\n':  out.put('n'); break;
+    case '\t':  out.put('t'); break;
+    default:
+        out.write(string_fmt("u%04x", ch));
     }
 }
 
 
-std::string JBString::repr() const {
-    std::string ans;
-    ans.reserve(2 + this->value.size());
-    ans += "\"";
-    for (unichar ch : this->value) {
-        ans += quote_char(ch);
+void JBString::write_repr(OutputSink &out) const {
+    // runs of plain chars are encoded at once, '/' is not escaped
+    const unichar *start = this->value.data();
+    const unichar *end = start + this->value.size();
+    out.put('"');
+    while (start < end) {
+        const unichar *stop = start;
+        while (stop < end && is_plain_char(*stop)) {
+            ++stop;
+        }
+        out.write(start, stop - start);
+        if (stop < end) {
+            write_escaped(out, *stop++);
+        }
+        start = stop;
     }
-    ans += "\"";
-    return ans;
+    out.put('"');
 }
 
 
@@ -120,8 +143,8 @@ bool JBString::is_truthy() const {
 }
 
 
-std::string JBNull::repr() const {
-    return "null";
+void JBNull::write_repr(OutputSink &out) const {
+    out.write("null", 4);
 }
 
 
@@ -132,19 +155,37 @@ void JBList::each_ref(std::function<void(JBObject &)> callback) {
 }
 
 
-std::string JBList::repr() const {
+void JBList::write_repr(OutputSink &out) const {
     // TODO: break list into multiple line
-    std::string ans;
-    ans.reserve(this->value.size() * 2 + 1);
-    ans += "[";
-    const char *comma = "";
-    for (const JBValue *item : this->value) {
-        ans += comma;
-        comma = ", ";
-        ans += item->repr();
+    struct Level {
+        const JBList *list;
+        size_t next;
+    };
+    std::vector<Level> stack {{this, 0}};
+
+    out.put('[');
+    while (!stack.empty()) {
+        Level &top = stack.back();
+        if (top.next == top.list->value.size()) {
+            out.put(']');
+            stack.pop_back();
+            continue;
+        }
+        if (top.next > 0) {
+            out.write(", ", 2);
+        }
+        const JBValue *item = top.list->value[top.next++];
+        const JBList *list = dynamic_cast<const JBList *>(item);
+        if (list == nullptr) {
+            item->write_repr(out);
+        } else if (std::any_of(stack.begin(), stack.end(),
+                               [&](const Level &l) { return l.list == list; })) {
+            out.write("[...]", 5);
+        } else {
+            out.put('[');
+            stack.push_back({list, 0});
+        }
     }
-    ans += "]";
-    return ans;
 }
 
 
@@ -177,9 +218,9 @@ void JBFunc::each_ref(std::function<void(JBObject &)> callback) {
 }
 
 
-std::string JBFunc::repr() const {
+void JBFunc::write_repr(OutputSink &out) const {
     // TODO: more info
-    return "<Func>";
+    out.write("<Func>", 6);
 }
 
 
@@ -188,12 +229,43 @@ bool JBFunc::operator==(const JBValue &rhs) const {
 }
 
 
-std::string JBBuiltinFunc::repr() const {
+void JBBuiltinFunc::write_repr(OutputSink &out) const {
     // TODO: more info
-    return "<BuiltinFunc>";
+    out.write("<BuiltinFunc>", 13);
 }
 
 
 bool JBBuiltinFunc::operator==(const JBValue &rhs) const {
     return this == &rhs;
 }
+
+
+JBValue &JBBuiltinFunc::call(JBArgs args) {
+    if (args.size() == 1 && this->func1 != nullptr) {
+        return this->func1(this->self, *args[0]);
+    } else if (args.size() == 2 && this->func2 != nullptr) {
+        return this->func2(this->self, *args[0], *args[1]);
+    } else {
+        return this->func(this->self, args);
+    }
+}
+
+
+JBValue &JBBuiltinFunc::call1(JBValue &arg) {
+    if (this->func1 != nullptr) {
+        return this->func1(this->self, arg);
+    } else {
+        JBValue *slots[] = {&arg};
+        return this->func(this->self, JBArgs(slots, 1));
+    }
+}
+
+
+JBValue &JBBuiltinFunc::call2(JBValue &arg1, JBValue &arg2) {
+    if (this->func2 != nullptr) {
+        return this->func2(this->self, arg1, arg2);
+    } else {
+        JBValue *slots[] = {&arg1, &arg2};
+        return this->func(this->self, JBArgs(slots, 2));
+    }
+}
@@ -11,6 +11,9 @@
 #include "unicode.h"
 
 
+class OutputSink;
+
+
 class JBObject {
 public:
     virtual ~JBObject() {}
@@ -22,7 +25,9 @@ class JBValue : public JBObject {
 public:
     virtual bool eq(const JBValue &rhs) const;
     virtual bool is_truthy() const;
-    virtual std::string repr() const = 0;
+    // writes the repr incrementally, see JBList::write_repr() for nested lists
+    virtual void write_repr(OutputSink &out) const = 0;
+    std::string repr() const;
 
     virtual bool operator==(const JBValue &rhs) const = 0;
     bool operator!=(const JBValue &rhs) const {
@@ -39,14 +44,14 @@ public:
     virtual bool is_truthy() const override {
         return this->value != 0;
     }
-    virtual std::string repr() const override;
+    virtual void write_repr(OutputSink &out) const override;
 
     virtual bool operator==(const JBValue &rhs) const override {
         const _JBSimpeValue<T> *other = dynamic_cast<const _JBSimpeValue<T> *>(&rhs);
         return other != nullptr && this->value == other->value;
     }
 
-    const T value;
+    T value;    // not modified after creation, except for loop counters of S_For
 };
 
 
@@ -60,7 +65,7 @@ public:
     explicit JBString(const ustring &value) : value(value) {}
 
     virtual bool is_truthy() const override;
-    virtual std::string repr() const override;
+    virtual void write_repr(OutputSink &out) const override;
     virtual bool operator==(const JBValue &rhs) const override;
 
     const ustring value;
@@ -72,7 +77,7 @@ public:
     virtual bool is_truthy() const override {
         return false;
     }
-    virtual std::string repr() const override;
+    virtual void write_repr(OutputSink &out) const override;
     virtual bool operator==(const JBValue &rhs) const override {
         return dynamic_cast<const JBNull *>(&rhs) != nullptr;
     }
@@ -84,7 +89,9 @@ public:
     virtual void each_ref(std::function<void (JBObject &)> callback) override;
 
     virtual bool is_truthy() const override;
-    virtual std::string repr() const override;
+    // Nested lists are written without recursion, a list inside itself is written as [...], like
+    // python.
+    virtual void write_repr(OutputSink &out) const override;
     virtual bool operator==(const JBValue &rhs) const override;
 
     std::vector<JBValue *> value;
@@ -100,7 +107,7 @@ public:
         : parent_frame(frame), code(code)
     {}
     virtual void each_ref(std::function<void (JBObject &)> callback) override;
-    virtual std::string repr() const override;
+    virtual void write_repr(OutputSink &out) const override;
     virtual bool operator==(const JBValue &rhs) const override;
 
     Frame *parent_frame;    // optional if function do not have closure
@@ -110,16 +117,68 @@ public:
 };
 
 
+// a view of the argument slots of a native call, no ownership
+class JBArgs {
+public:
+    JBArgs(JBValue *const *data, size_t size) : data(data), count(size) {}
+    JBArgs(const std::vector<JBValue *> &args) : data(args.data()), count(args.size()) {}
+
+    size_t size() const {
+        return this->count;
+    }
+    JBValue *operator[](size_t i) const {
+        return this->data[i];
+    }
+    JBValue *const *begin() const {
+        return this->data;
+    }
+    JBValue *const *end() const {
+        return this->data + this->count;
+    }
+
+private:
+    JBValue *const *data;
+    size_t count;
+};
+
+
 class JBBuiltinFunc : public JBValue {
 public:
-    typedef std::function<JBValue &(const std::vector<JBValue *> &)> Func;
+    typedef JBValue &(*Func)(void *, JBArgs);
+    typedef JBValue &(*Func1)(void *, JBValue &);
+    typedef JBValue &(*Func2)(void *, JBValue &, JBValue &);
 
-    explicit JBBuiltinFunc(const Func &func) : func(func) {}
+    JBBuiltinFunc(void *self, Func func, Func1 func1 = nullptr, Func2 func2 = nullptr)
+        : self(self), func(func), func1(func1), func2(func2)
+    {}
 
-    virtual std::string repr() const override;
+    virtual void write_repr(OutputSink &out) const override;
     virtual bool operator==(const JBValue &rhs) const override;
 
+    JBValue &call(JBArgs args);
+    JBValue &call1(JBValue &arg);
+    JBValue &call2(JBValue &arg1, JBValue &arg2);
+
+    // adapt member functions of T to the native ABI
+    template<class T, JBValue &(T::*method)(JBArgs)>
+    static JBValue &thunk(void *self, JBArgs args) {
+        return (static_cast<T *>(self)->*method)(args);
+    }
+
+    template<class T, JBValue &(T::*method)(JBValue &)>
+    static JBValue &thunk1(void *self, JBValue &arg) {
+        return (static_cast<T *>(self)->*method)(arg);
+    }
+
+    template<class T, JBValue &(T::*method)(JBValue &, JBValue &)>
+    static JBValue &thunk2(void *self, JBValue &arg1, JBValue &arg2) {
+        return (static_cast<T *>(self)->*method)(arg1, arg2);
+    }
+
+    void *self;
     Func func;
+    Func1 func1;    // optional fast path for exactly 1 argument
+    Func2 func2;    // optional fast path for exactly 2 arguments
 };
 
 
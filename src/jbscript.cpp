@@ -1,6 +1,6 @@
 #include <cstdio>
 #include <iosfwd>
-#include <fstream>
+#include <sys/stat.h>
 #include "unistd.h"
 
 #include "script.h"
@@ -10,14 +10,20 @@
 
 int main(int argc, char *argv[]) {
     JBScriptOption option = JBScriptOption::parse_argv(argc, argv);
-    if (option.file == "-" && isatty(fileno(stdin))) {
+    std::string file = option.files.empty() ? "-" : option.files.front();
+    struct stat st;
+    bool is_dir = ::stat(file.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    if (option.files.size() > 1 || is_dir || option.check || option.jobs > 0) {
+        // loaded concurrently
+        unsigned jobs = option.jobs > 0 ? static_cast<unsigned>(option.jobs) : 0;
+        return run_script_files_main(option.files, jobs, option.check);
+    } else if (file == "-" && isatty(fileno(stdin))) {
         InteractiveRepl repl;
         repl.start();
         return 0;
-    } else if (option.file == "-") {
+    } else if (file == "-") {
         return run_script_main(std::cin);
     } else {
-        std::ifstream fs(option.file);
-        return run_script_main(fs);
+        return run_script_file_main(file);
     }
 }
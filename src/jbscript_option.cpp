@@ -7,8 +7,8 @@
 
 
 bool JBScriptOption::operator==(const JBScriptOption &rhs) const {
-    return std::tie(this->file) \
-        == std::tie(rhs.file);
+    return std::tie(this->files, this->check, this->jobs) \
+        == std::tie(rhs.files, rhs.check, rhs.jobs);
 }
 bool JBScriptOption::operator!=(const JBScriptOption &rhs) const {
     return !(*this == rhs);
@@ -17,8 +17,19 @@ bool JBScriptOption::operator!=(const JBScriptOption &rhs) const {
 
 std::string JBScriptOption::to_string() const {
     std::string ans = "<JBScriptOption";
-    ans += " file=";
-    ans += '"' + this->file + '"';
+    ans += " files=";
+    ans += "[";
+    for (size_t i = 0; i < this->files.size(); i++) {
+        if (i != 0) {
+            ans += ", ";
+        }
+        ans += '"' + this->files[i] + '"';
+    }
+    ans += "]";
+    ans += " check=";
+    ans += this->check ? "true" : "false";
+    ans += " jobs=";
+    ans += std::to_string(this->jobs);
     return ans + ">";
 }
 
@@ -31,19 +42,37 @@ JBScriptOption JBScriptOption::parse_args(const std::vector<std::string> &args)
         const std::string &piece = args[i];
         if (piece.size() > 2 && piece[0] == '-' && piece[1] == '-') {
             // long options
-            throw ArgError("Unknown option: " + piece);
+            if (piece == "--check") {
+                ans.check = true;
+            } else if (piece == "--jobs") {
+                if (i + 1 >= args.size()) {
+                    throw ArgError("expect value for option: " + piece);
+                }
+                ans.jobs = std::atol(args[++i].data());
+            } else {
+                throw ArgError("Unknown option: " + piece);
+            }
         } else if (piece.size() >= 2 && piece[0] == '-') {
             // short options
             for (auto it = piece.begin() + 1; it != piece.end(); ++it) {
-                throw ArgError("Unknown flag: " + std::string(1, *it));
+                if (*it == 'c') {
+                    ans.check = true;
+                } else if (*it == 'j') {
+                    if (it + 1 != piece.end()) {
+                        ans.jobs = std::atol(&*(it + 1));
+                    } else if (i + 1 < args.size()) {
+                        ans.jobs = std::atol(args[++i].data());
+                    } else {
+                        throw ArgError("expect value for flag: " + std::string(1, *it));
+                    }
+                    break;
+                } else {
+                    throw ArgError("Unknown flag: " + std::string(1, *it));
+                }
             }
         } else {
             // positional args
-            if (position_count == 0) {
-                ans.file = piece.data();
-            } else {
-                throw ArgError("too many args: " + piece);
-            }
+            ans.files.emplace_back(piece.data());
             position_count++;
         }
     }
@@ -16,8 +16,12 @@ public:
 
 
 struct JBScriptOption {
-    // options: ('file',), arg_type: ArgType.ONE
-    std::string file = "-";
+    // options: ('files',), arg_type: ArgType.REST
+    std::vector<std::string> files;
+    // options: ('-c', '--check'), arg_type: ArgType.BOOL
+    bool check = false;
+    // options: ('-j', '--jobs'), arg_type: ArgType.INT
+    long jobs = 0;
 
     std::string to_string() const;
     bool operator==(const JBScriptOption &rhs) const;
@@ -1,13 +1,15 @@
 #ifndef JIAOBENSCRIPT_LINE_HIGHLIGHT_H
 #define JIAOBENSCRIPT_LINE_HIGHLIGHT_H
 
+#include <iosfwd>
 #include <vector>
 
 #include "sourcepos.h"
 #include "unicode.h"
 
 
-void line_lighlight(const std::vector<ustring> &lines, const SourcePos &start, const SourcePos &end);
+void line_lighlight(
+    std::ostream &os, const std::vector<ustring> &lines, SourceLoc start, SourceLoc end);
 
 
 #endif //JIAOBENSCRIPT_LINE_HIGHLIGHT_H
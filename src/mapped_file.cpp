@@ -0,0 +1,69 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+
+MappedFile::MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        this->error_msg = path + ": " + std::strerror(errno);
+        return;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            this->mapping = addr;
+            this->length = static_cast<size_t>(st.st_size);
+        }
+    }
+
+    if (this->mapping == nullptr) {
+        char chunk[64 * 1024];
+        ssize_t got;
+        while ((got = ::read(fd, chunk, sizeof(chunk))) > 0) {
+            this->buffer.append(chunk, static_cast<size_t>(got));
+        }
+        if (got < 0) {
+            this->error_msg = path + ": " + std::strerror(errno);
+            ::close(fd);
+            return;
+        }
+    }
+
+    ::close(fd);
+    this->opened = true;
+}
+
+
+MappedFile::~MappedFile() {
+    if (this->mapping != nullptr) {
+        ::munmap(this->mapping, this->length);
+    }
+}
+
+
+bool MappedFile::is_open() const {
+    return this->opened;
+}
+
+
+const std::string &MappedFile::error() const {
+    return this->error_msg;
+}
+
+
+const char *MappedFile::data() const {
+    return this->mapping != nullptr ? static_cast<const char *>(this->mapping) : this->buffer.data();
+}
+
+
+size_t MappedFile::size() const {
+    return this->mapping != nullptr ? this->length : this->buffer.size();
+}
@@ -0,0 +1,31 @@
+#ifndef JIAOBENSCRIPT_MAPPED_FILE_H
+#define JIAOBENSCRIPT_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+
+// Read-only view of a whole file. Regular files are memory-mapped, other files (pipes,
+// terminals) are read into a buffer.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    bool is_open() const;
+    const std::string &error() const;   // set if not opened
+    const char *data() const;
+    size_t size() const;
+
+private:
+    void *mapping = nullptr;
+    size_t length = 0;
+    std::string buffer;     // content if not mapped
+    bool opened = false;
+    std::string error_msg;
+};
+
+
+#endif //JIAOBENSCRIPT_MAPPED_FILE_H
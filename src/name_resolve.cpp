@@ -1,124 +1,506 @@
+#include <algorithm>
+#include <cassert>
 #include <functional>
 #include <vector>
 
 #include "name_resolve.h"
+#include "check_control_flow.h"
+#include "fuse_nodes.h"
 #include "visitor.h"
 #include "replace_restore.hpp"
 
 
-static void add_name_to_block_attr(S_Block::AttrType &attr, const ustring &name) {
-    auto it = attr.name_to_local_index.find(name);
-    if (it != attr.name_to_local_index.end()) {
-        // FIXME: set lineno
-        throw DuplicatedLocalName("Duplicated local name: " + u8_encode(name));
+namespace {
+
+// interns names to dense ids, open addressing over a power of two table
+class SymbolTable {
+public:
+    int intern(const ustring &name) {
+        if ((this->names.size() + 1) * 2 > this->slots.size()) {
+            this->grow();
+        }
+        size_t hash = std::hash<ustring>()(name);
+        size_t mask = this->slots.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            Slot &slot = this->slots[i];
+            if (slot.symbol < 0) {
+                slot = {hash, static_cast<int>(this->names.size())};
+                this->names.push_back(name);
+                return slot.symbol;
+            }
+            // names are only compared on a full hash match
+            if (slot.hash == hash && this->names[slot.symbol] == name) {
+                return slot.symbol;
+            }
+        }
     }
 
-    attr.name_to_local_index.emplace(name, attr.local_info.size());
-    attr.local_info.emplace_back(name);
-}
+    size_t size() const {
+        return this->names.size();
+    }
+
+    void reserve(size_t count) {
+        this->names.reserve(count);
+        while ((count + 1) * 2 > this->slots.size()) {
+            this->grow();
+        }
+    }
 
+private:
+    struct Slot {
+        size_t hash;
+        int symbol;     // or -1
+    };
 
-static void add_declarations_to_block_attr(S_Block::AttrType &attr, const S_DeclareList &decls) {
-    decls.attr.start_index = static_cast<int>(attr.local_info.size());
-    for (const auto &pair : decls.decls) {
-        add_name_to_block_attr(attr, pair.name);
+    void grow() {
+        size_t capacity = std::max<size_t>(64, this->slots.size() * 2);
+        std::vector<Slot> old(capacity, Slot {0, -1});
+        old.swap(this->slots);
+        for (const Slot &slot : old) {
+            if (slot.symbol < 0) {
+                continue;
+            }
+            size_t i = slot.hash & (capacity - 1);
+            while (this->slots[i].symbol >= 0) {
+                i = (i + 1) & (capacity - 1);
+            }
+            this->slots[i] = slot;
+        }
+    }
+
+    std::vector<ustring> names;     // by symbol
+    std::vector<Slot> slots;
+};
+
+
+// Names visible from the block being resolved. The bindings of a symbol form a stack, innermost
+// block first, linked through one array and popped when the block is left. Only lives during a
+// resolution, nothing is kept on the blocks but the resulting indexes.
+class ScopeStack {
+public:
+    struct Binding {
+        S_Block *block;
+        int index;      // of local_info if is_local, otherwise of nonlocal_indexes
+        bool is_local;
+    };
+
+    int intern(const ustring &name) {
+        int symbol = this->symbols.intern(name);
+        if (this->symbols.size() > this->top.size()) {
+            this->top.push_back(-1);
+        }
+        return symbol;
+    }
+
+    // for the bindings restored from resolved blocks
+    void reserve(size_t count) {
+        this->symbols.reserve(count);
+        this->top.reserve(count);
+        this->records.reserve(count);
     }
-}
 
+    void push_block() {
+        this->block_marks.push_back(this->records.size());
+    }
 
-S_Block::AttrType::NonLocalInfo resolve_from_block(S_Block *block, const ustring &name) {
-    for (; block != nullptr; block = block->attr.parent) {
-        auto it = block->attr.name_to_local_index.find(name);
-        if (it != block->attr.name_to_local_index.end()) {
-            return {block, it->second};
+    void pop_block() {
+        assert(!this->block_marks.empty());
+        while (this->records.size() > this->block_marks.back()) {
+            const Record &rec = this->records.back();
+            this->top[rec.symbol] = rec.prev;
+            this->records.pop_back();
         }
+        this->block_marks.pop_back();
     }
 
-    // FIXME: set lineno
-    throw NoSuchName("No such name: " + u8_encode(name));
-}
+    void bind(int symbol, const Binding &binding) {
+        this->records.push_back({binding, symbol, this->top[symbol]});
+        this->top[symbol] = static_cast<int>(this->records.size() - 1);
+    }
 
+    // the binding added by block, a local one is preferred
+    const Binding *find_in_block(int symbol, const S_Block *block) const {
+        int i = this->top[symbol];
+        if (i >= 0 && this->records[i].binding.block == block) {
+            return &this->records[i].binding;
+        }
+        return nullptr;
+    }
 
-static int add_nonlocal_to_block_attr(S_Block::AttrType &attr, const ustring &name, S_Block *start)
-{
-    auto it = attr.name_to_nonlocal_index.find(name);
-    if (it == attr.name_to_nonlocal_index.end()) {
-        int index = static_cast<int>(attr.nonlocal_indexes.size());
-        // if resolve_from_block() fails, attr is not updated
-        attr.nonlocal_indexes.emplace_back(resolve_from_block(start, name));
-        attr.name_to_nonlocal_index.emplace(name, index);
-        return index;
-    } else {
-        return it->second;
+    const Binding *find_local(int symbol) const {
+        for (int i = this->top[symbol]; i >= 0; i = this->records[i].prev) {
+            if (this->records[i].binding.is_local) {
+                return &this->records[i].binding;
+            }
+        }
+        return nullptr;
     }
-}
+
+private:
+    struct Record {
+        Binding binding;
+        int symbol;
+        int prev;       // shadowed record of the same symbol
+    };
+
+    SymbolTable symbols;
+    std::vector<int> top;               // innermost record by symbol
+    std::vector<Record> records;
+    std::vector<size_t> block_marks;    // size of records when a block is entered
+};
+
+}   // namespace
 
 
-class Resolver : private TraversalNodeVisitor {
+// the counter of a range loop can be updated in place if no reference to it outlives the
+// iteration, that is, it is only read as an operand of arithmetic, comparison or subscript
+class CounterUseChecker final : private TraversalNodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
 public:
-    explicit Resolver(S_Block *cur_block) : cur_block(cur_block) {}
+    explicit CounterUseChecker(const ustring &name) : name(name) {}
+
+    bool is_reusable(Node &block) {
+        node_dispatch(*this, block);
+        return this->reusable;
+    }
+
+private:
+    virtual void visit_op(E_Op &exp) {
+        switch (exp.op_code) {
+        case OpCode::PLUS:
+            // unary + returns its operand
+            if (exp.args.size() == 1) {
+                return TraversalNodeVisitor::visit_op(exp);
+            }
+            // fall through
+        case OpCode::MINUS:
+        case OpCode::STAR:
+        case OpCode::SLASH:
+        case OpCode::PERCENT:
+        case OpCode::LESS:
+        case OpCode::LESSEQ:
+        case OpCode::GREAT:
+        case OpCode::GREATEQ:
+        case OpCode::EQ:
+        case OpCode::NEQ:
+        case OpCode::NOT:
+            for (Node::Ptr &arg : exp.args) {
+                this->visit_operand(*arg);
+            }
+            return;
+        case OpCode::SUBSCRIPT:
+            node_dispatch(*this, *exp.args[0]);
+            return this->visit_operand(*exp.args[1]);
+        case OpCode::ASSIGN:
+            // L[i] = x
+            if (E_Op *subscript = dynamic_cast<E_Op *>(exp.args[0].get())) {
+                this->visit_op(*subscript);
+                return node_dispatch(*this, *exp.args[1]);
+            }
+            // fall through
+        default:
+            return TraversalNodeVisitor::visit_op(exp);
+        }
+    }
+
+    virtual void visit_var(E_Var &var) {
+        if (var.name == this->name) {
+            this->reusable = false;
+        }
+    }
+
+    virtual void visit_func(E_Func &func) {
+        if (func.attr.lazy_source != nullptr) {
+            // the body is not parsed yet
+            this->reusable = false;
+            return;
+        }
+        // closures read the counter after it is modified
+        ReplaceRestore<bool> _(&this->inside_func, true);
+        TraversalNodeVisitor::visit_func(func);
+    }
+
+    void visit_operand(Node &node) {
+        if (this->inside_func || dynamic_cast<E_Var *>(&node) == nullptr) {
+            node_dispatch(*this, node);
+        }
+    }
+
+    const ustring &name;
+    bool reusable = true;
+    bool inside_func = false;
+};
+
+
+// With check_flow and fuse, jump statements are checked as check_control_flow() does and children
+// are fused as fuse_nodes() does, right after they are resolved, so the analysis of a program
+// takes a single traversal.
+class Resolver final : private TraversalNodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
+public:
+    // bindings of the already resolved blocks enclosing cur_block are restored
+    explicit Resolver(S_Block *cur_block, bool check_flow = false, bool fuse = false)
+        : check_flow(check_flow), fuse(fuse)
+    {
+        std::vector<S_Block *> chain;
+        size_t count = 0;
+        for (S_Block *block = cur_block; block != nullptr; block = block->attr.parent) {
+            chain.push_back(block);
+            count += block->attr.local_info.size() + block->attr.nonlocal_indexes.size();
+        }
+        this->scopes.reserve(count);
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            this->restore(**it, (*it)->attr.local_info.size());
+        }
+    }
+
+    // bindings visible to the body of a lazy function where it is defined are restored
+    explicit Resolver(const E_Func &func, bool check_flow = false, bool fuse = false)
+        : check_flow(check_flow), fuse(fuse), flow(true)
+    {
+        S_Block &func_block = static_cast<S_Block &>(*func.block);
+        std::vector<S_Block *> chain;
+        for (S_Block *block = func_block.attr.parent; block; block = block->attr.parent) {
+            chain.push_back(block);
+        }
+        assert(chain.size() == func.attr.lazy_scope.size());
+        for (size_t i = chain.size(); i-- > 0; ) {
+            this->restore(*chain[i], func.attr.lazy_scope[i]);
+        }
+        this->restore(func_block, func_block.attr.local_info.size());
+    }
 
     void resolve(Node &node) {
-        node.accept(*this);
+        node_dispatch(*this, node);
+    }
+
+    void resolve_body(S_Block &block) {
+        assert(this->cur_block == &block);
+        this->visit_stmts(block);
     }
 
 private:
     virtual void visit_block(S_Block &block) {
-        auto _ = this->enter(block);
-        TraversalNodeVisitor::visit_block(block);
+        this->enter(block);
+        this->visit_stmts(block);
+        this->leave();
     }
 
     virtual void visit_declare_list(S_DeclareList &decls) {
-        S_Block::AttrType &attr = this->cur_block->attr;
-        decls.attr.start_index = static_cast<int>(attr.local_info.size());
-
-        for (const auto &pair : decls.decls) {
-            add_name_to_block_attr(attr, pair.name);
+        decls.attr.start_index = static_cast<int>(this->cur_block->attr.local_info.size());
+        for (auto &pair : decls.decls) {
+            this->declare(pair.name);
             if (pair.initial) {
-                pair.initial->accept(*this);
+                this->visit_child(pair.initial);
             }
         }
     }
 
+    virtual void visit_condition(S_Condition &cond) {
+        this->visit_child(cond.condition);
+        this->visit_child(cond.then_block);
+        if (cond.else_block) {
+            this->visit_child(cond.else_block);
+        }
+    }
+
+    virtual void visit_return(S_Return &ret) {
+        if (this->check_flow) {
+            this->flow.check_return(ret);
+        }
+        if (ret.value) {
+            this->visit_child(ret.value);
+        }
+    }
+
+    virtual void visit_break(S_Break &brk) {
+        if (this->check_flow) {
+            this->flow.check_break(brk);
+        }
+    }
+
+    virtual void visit_continue(S_Continue &cont) {
+        if (this->check_flow) {
+            this->flow.check_continue(cont);
+        }
+    }
+
+    virtual void visit_stmt_exp(S_Exp &stmt) {
+        this->visit_child(stmt.value);
+    }
+
+    virtual void visit_op(E_Op &exp) {
+        for (Node::Ptr &arg : exp.args) {
+            this->visit_child(arg);
+        }
+    }
+
+    virtual void visit_list(E_List &list) {
+        for (Node::Ptr &item : list.value) {
+            this->visit_child(item);
+        }
+    }
+
     virtual void visit_var(E_Var &var) {
         assert(this->cur_block);
         S_Block::AttrType &attr = this->cur_block->attr;
-        auto it = attr.name_to_local_index.find(var.name);
-        if (it != attr.name_to_local_index.end()) {
-            var.attr.is_local = true;
-            var.attr.index = it->second;
-        } else {
-            var.attr.is_local = false;
-            var.attr.index = add_nonlocal_to_block_attr(attr, var.name, attr.parent);
+        int symbol = this->scopes.intern(var.name);
+
+        if (const ScopeStack::Binding *binding = this->scopes.find_in_block(symbol, this->cur_block)) {
+            var.attr.is_local = binding->is_local;
+            var.attr.index = binding->index;
+            return;
+        }
+
+        const ScopeStack::Binding *origin = this->scopes.find_local(symbol);
+        if (origin == nullptr) {
+            throw NoSuchName("No such name: " + u8_encode(var.name), var.pos_start, var.pos_end);
         }
+        int index = static_cast<int>(attr.nonlocal_indexes.size());
+        attr.nonlocal_indexes.emplace_back(origin->block, origin->index);
+        this->scopes.bind(symbol, {this->cur_block, index, false});
+
+        var.attr.is_local = false;
+        var.attr.index = index;
     }
 
     virtual void visit_func(E_Func &func) {
         S_Block &func_block = static_cast<S_Block &>(*func.block);
+        this->enter(func_block);
 
         if (func.args) {
+            S_DeclareList &args = static_cast<S_DeclareList &>(*func.args);
             // resovle default arguments in outter scope as non-locals
-            auto _ = this->enter(func_block);
-            for (const auto &pair : static_cast<S_DeclareList &>(*func.args).decls) {
+            for (auto &pair : args.decls) {
                 if (pair.initial) {
-                    pair.initial->accept(*this);
+                    this->visit_child(pair.initial);
                 }
             }
             // add arguments as locals of function block
-            add_declarations_to_block_attr(
-                func_block.attr, static_cast<S_DeclareList &>(*func.args)
-            );
+            this->declare_all(args);
+        }
+
+        if (func.attr.lazy_source != nullptr) {
+            // the body is resolved by resolve_names_in_func() later, with the names declared so far
+            std::vector<uint32_t> &scope = func.attr.lazy_scope;
+            scope.clear();
+            for (S_Block *block = func_block.attr.parent; block; block = block->attr.parent) {
+                scope.push_back(static_cast<uint32_t>(block->attr.local_info.size()));
+            }
+        } else {
+            auto _ = this->flow.enter_func();
+            this->visit_stmts(func_block);
+        }
+        this->leave();
+    }
+
+    virtual void visit_while(S_While &wh) {
+        auto _ = this->flow.enter_loop();
+        this->visit_child(wh.condition);
+        this->visit_child(wh.block);
+    }
+
+    virtual void visit_for(S_For &loop) {
+        S_Block &block = static_cast<S_Block &>(*loop.block);
+        S_DeclareList &var = static_cast<S_DeclareList &>(*loop.var);
+
+        // resolve range or iterable in outter scope
+        if (loop.is_range()) {
+            this->visit_child(loop.start);
+            this->visit_child(loop.stop);
+            if (loop.step) {
+                this->visit_child(loop.step);
+            }
+        } else {
+            this->visit_child(loop.iterable);
+        }
+        // the loop variable is the first local of block
+        this->enter(block);
+        this->declare_all(var);
+        {
+            auto _ = this->flow.enter_loop();
+            this->visit_stmts(block);
+        }
+        this->leave();
+
+        if (loop.is_range()) {
+            loop.attr.reuse_counter = CounterUseChecker(var.decls.front().name).is_reusable(block);
+        }
+    }
+
+    void visit_stmts(S_Block &block) {
+        for (Node::Ptr &stmt : block.stmts) {
+            this->visit_child(stmt);
         }
+    }
 
-        func_block.accept(*this);
+    // children first, then the node itself is fused
+    void visit_child(Node::Ptr &slot) {
+        node_dispatch(*this, *slot);
+        if (this->fuse) {
+            if (Node *fused = fuse_node(*slot)) {
+                // the fused node takes the original
+                slot.release();
+                slot.reset(fused);
+            }
+        }
     }
 
-    ReplaceRestore<S_Block *> enter(S_Block &block) {
+    void enter(S_Block &block) {
         block.attr.parent = this->cur_block;
-        return ReplaceRestore<S_Block *>(&this->cur_block, &block);
+        this->cur_block = &block;
+        this->scopes.push_block();
+    }
+
+    void leave() {
+        this->scopes.pop_block();
+        this->cur_block = this->cur_block->attr.parent;
+    }
+
+    // enter a block resolved by a previous resolution, with its first nlocals locals
+    void restore(S_Block &block, size_t nlocals) {
+        this->cur_block = &block;
+        this->scopes.push_block();
+
+        const S_Block::AttrType &attr = block.attr;
+        for (size_t i = 0; i < attr.nonlocal_indexes.size(); ++i) {
+            const auto &info = attr.nonlocal_indexes[i];
+            const ustring &name = info.parent->attr.local_info[info.index].name;
+            this->scopes.bind(this->scopes.intern(name), {&block, static_cast<int>(i), false});
+        }
+        for (size_t i = 0; i < nlocals; ++i) {
+            int symbol = this->scopes.intern(attr.local_info[i].name);
+            this->scopes.bind(symbol, {&block, static_cast<int>(i), true});
+        }
+    }
+
+    void declare(const ustring &name) {
+        S_Block::AttrType &attr = this->cur_block->attr;
+        int symbol = this->scopes.intern(name);
+        const ScopeStack::Binding *binding = this->scopes.find_in_block(symbol, this->cur_block);
+        if (binding != nullptr && binding->is_local) {
+            // FIXME: set lineno
+            throw DuplicatedLocalName("Duplicated local name: " + u8_encode(name));
+        }
+
+        this->scopes.bind(symbol, {this->cur_block, static_cast<int>(attr.local_info.size()), true});
+        attr.local_info.emplace_back(name);
+    }
+
+    void declare_all(const S_DeclareList &decls) {
+        decls.attr.start_index = static_cast<int>(this->cur_block->attr.local_info.size());
+        for (const auto &pair : decls.decls) {
+            this->declare(pair.name);
+        }
     }
 
     S_Block *cur_block = nullptr;
+    ScopeStack scopes;
+    bool check_flow;
+    bool fuse;
+    ControlFlowContext flow;
 };
 
 
@@ -127,6 +509,32 @@ void resolve_names_in_block(S_Block *block, Node &node) {
 }
 
 
+void resolve_names_in_func(const E_Func &func) {
+    Resolver resolver(func);
+    resolver.resolve_body(static_cast<S_Block &>(*func.block));
+}
+
+
+void analyze_in_block(S_Block *block, Node &node, bool fuse) {
+    Resolver(block, true, fuse).resolve(node);
+}
+
+
+void analyze_stmts_in_block(S_Block *block, std::vector<Node::Ptr> &stmts) {
+    // the bindings of block are restored once
+    Resolver resolver(block, true);
+    for (Node::Ptr &stmt : stmts) {
+        resolver.resolve(*stmt);
+    }
+}
+
+
+void analyze_func_body(const E_Func &func, bool fuse) {
+    Resolver resolver(func, true, fuse);
+    resolver.resolve_body(static_cast<S_Block &>(*func.block));
+}
+
+
 void resolve_names(S_Block &block) {
     Resolver(nullptr).resolve(block);
 }
@@ -1,6 +1,8 @@
 #ifndef JIAOBENSCRIPT_NAME_RESOLVE_H
 #define JIAOBENSCRIPT_NAME_RESOLVE_H
 
+#include <vector>
+
 #include "exceptions.h"
 #include "node.h"
 
@@ -16,7 +18,16 @@ class NoSuchName : public CompileError {
 
 
 void resolve_names_in_block(S_Block *block, Node &node);
+// the body of a lazy function after parse_lazy_body(), the function itself is resolved already
+void resolve_names_in_func(const E_Func &func);
 void resolve_names(S_Block &block);
 
+// resolve_names_in_block(), check_control_flow() and fuse_nodes() if fuse, in a single traversal
+void analyze_in_block(S_Block *block, Node &node, bool fuse = false);
+// analyze_in_block() on each statement in order, as if they are appended to block
+void analyze_stmts_in_block(S_Block *block, std::vector<Node::Ptr> &stmts);
+// the same for the body of a lazy function, see resolve_names_in_func()
+void analyze_func_body(const E_Func &func, bool fuse = false);
+
 
 #endif //JIAOBENSCRIPT_NAME_RESOLVE_H
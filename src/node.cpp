@@ -1,7 +1,45 @@
+#include <cstddef>
+#include <new>
+
 #include "node.h"
 #include "visitor.h"
 
 
+namespace {
+
+// precedes every node, 8 bytes, nodes need no more than pointer alignment
+struct NodeHeader {
+    NodeArena *arena;   // nullptr if allocated on heap
+};
+
+static_assert(sizeof(NodeHeader) % NodeArena::ALIGN == 0, "node after header is misaligned");
+static_assert(alignof(Node) <= NodeArena::ALIGN, "node alignment");
+
+}   // namespace
+
+
+void *Node::operator new(size_t size) {
+    NodeArena *arena = NodeArena::current();
+    size_t total = sizeof(NodeHeader) + size;
+    void *mem = arena != nullptr ? arena->allocate(total) : ::operator new(total);
+
+    NodeHeader *header = static_cast<NodeHeader *>(mem);
+    header->arena = arena;
+    return header + 1;
+}
+
+
+void Node::operator delete(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    NodeHeader *header = static_cast<NodeHeader *>(ptr) - 1;
+    if (header->arena == nullptr) {
+        ::operator delete(header);
+    }
+}
+
+
 bool Node::operator==(const Node &rhs) const {
     return typeid(*this) == typeid(rhs);
 }
@@ -74,6 +112,13 @@ bool S_While::operator==(const Node &rhs) const {
 }
 
 
+bool S_For::operator==(const Node &rhs) const {
+    _TO_OTHER(S_For);
+    return _ATTR_EQ(var) && _ATTR_EQ_OPT(start) && _ATTR_EQ_OPT(stop) && _ATTR_EQ_OPT(step)
+        && _ATTR_EQ_OPT(iterable) && _ATTR_EQ(block);
+}
+
+
 bool S_Return::operator==(const Node &rhs) const {
     _TO_OTHER(S_Return);
     return _ATTR_EQ_OPT(value);
@@ -110,105 +155,25 @@ bool E_List::operator==(const Node &rhs) const {
 }
 
 
-#undef _TO_OTHER
-#undef _ATTR_EQ
-#undef _ATTR_EQ_OPT
-
-
-void S_Block::accept(NodeVisitor &vis) {
-    vis.visit_block(*this);
-}
-
-
-void S_DeclareList::accept(NodeVisitor &vis) {
-    vis.visit_declare_list(*this);
-}
-
-
-void S_Condition::accept(NodeVisitor &vis) {
-    vis.visit_condition(*this);
-}
-
-
-void S_While::accept(NodeVisitor &vis) {
-    vis.visit_while(*this);
-}
-
-
-void S_Return::accept(NodeVisitor &vis) {
-    vis.visit_return(*this);
-}
-
-
-void S_Exp::accept(NodeVisitor &vis) {
-    vis.visit_stmt_exp(*this);
-}
-
-
-void E_Op::accept(NodeVisitor &vis) {
-    vis.visit_op(*this);
-}
-
-
-void E_Var::accept(NodeVisitor &vis) {
-    vis.visit_var(*this);
-}
-
-
-void E_Func::accept(NodeVisitor &vis) {
-    vis.visit_func(*this);
-}
-
-
-void E_List::accept(NodeVisitor &vis) {
-    vis.visit_list(*this);
-}
-
-
-void Program::accept(NodeVisitor &vis) {
-    vis.visit_program(*this);
-}
-
-
-void S_Break::accept(NodeVisitor &vis) {
-    vis.visit_break(*this);
-}
-
-
-void S_Continue::accept(NodeVisitor &vis) {
-    vis.visit_continue(*this);
-}
-
-
-void S_Empty::accept(NodeVisitor &vis) {
-    vis.visit_stmt_empty(*this);
-}
-
-
-template<>
-void E_Bool::accept(NodeVisitor &vis) {
-    vis.visit_bool(*this);
-}
-
-
-template<>
-void E_Int::accept(NodeVisitor &vis) {
-    vis.visit_int(*this);
+FusedNode::FusedNode(NodeKind kind, Node::Ptr original)
+    : Node(kind), original(std::move(original))
+{
+    this->pos_start = this->original->pos_start;
+    this->pos_end = this->original->pos_end;
 }
 
 
-template<>
-void E_Float::accept(NodeVisitor &vis) {
-    vis.visit_float(*this);
+bool FusedNode::operator==(const Node &rhs) const {
+    const FusedNode *other = dynamic_cast<const FusedNode *>(&rhs);
+    return *this->original == (other ? *other->original : rhs);
 }
 
 
-template<>
-void E_String::accept(NodeVisitor &vis) {
-    vis.visit_string(*this);
-}
+#undef _TO_OTHER
+#undef _ATTR_EQ
+#undef _ATTR_EQ_OPT
 
 
-void E_Null::accept(NodeVisitor &vis) {
-    vis.visit_null(*this);
+void Node::accept(NodeVisitor &vis) {
+    node_dispatch(vis, *this);
 }
@@ -2,11 +2,12 @@
 #define JIAOBENSCRIPT_NODE_H
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
-#include <map>
 #include <memory>
 #include <vector>
 
+#include "node_arena.h"
 #include "sourcepos.h"
 #include "unicode.h"
 #include "string_fmt.hpp"
@@ -16,19 +17,57 @@
 class NodeVisitor;
 
 
+// the concrete type of a node, dispatched by node_dispatch() without virtual calls
+enum class NodeKind : uint8_t {
+    S_BLOCK,
+    PROGRAM,
+    S_DECLARE_LIST,
+    S_CONDITION,
+    S_WHILE,
+    S_FOR,
+    S_RETURN,
+    S_BREAK,
+    S_CONTINUE,
+    S_EXP,
+    S_EMPTY,
+    E_OP,
+    E_VAR,
+    E_FUNC,
+    E_BOOL,
+    E_INT,
+    E_FLOAT,
+    E_STRING,
+    E_LIST,
+    E_NULL,
+    E_FUSED_VAR_UPDATE,
+    E_FUSED_SET_ITEM,
+    S_FUSED_CONDITION,
+    S_FUSED_WHILE,
+};
+
+
 struct Node {
     typedef std::unique_ptr<Node> Ptr;
 
+    // from NodeArena::current() if entered
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+
     virtual ~Node() {}
     virtual bool operator==(const Node &rhs) const;
     bool operator!=(const Node &rhs) const;
     virtual std::string repr(uint32_t = 0) const {
         return "<Node>";
     }
-    virtual void accept(NodeVisitor &vis) = 0;
+    // prefer node_dispatch() with the concrete visitor type
+    void accept(NodeVisitor &vis);
 
-    SourcePos pos_start;
-    SourcePos pos_end;
+    const NodeKind kind;
+    SourceLoc pos_start;
+    SourceLoc pos_end;
+
+protected:
+    explicit Node(NodeKind kind) : kind(kind) {}
 };
 
 
@@ -62,23 +101,23 @@ struct S_Block : Node {
         S_Block *parent = nullptr;
         std::vector<VarInfo> local_info;
         std::vector<NonLocalInfo> nonlocal_indexes;
-
-        // tmp
-        std::map<ustring, int> name_to_local_index;
-        std::map<ustring, int> name_to_nonlocal_index;
     };
 
+    S_Block() : Node(NodeKind::S_BLOCK) {}
+
     std::vector<Node::Ptr> stmts;
     AttrType attr {};
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
+
+protected:
+    explicit S_Block(NodeKind kind) : Node(kind) {}
 };
 
 
 struct Program : S_Block {
-    virtual void accept(NodeVisitor &vis) override;
+    Program() : S_Block(NodeKind::PROGRAM) {}
 };
 
 
@@ -88,6 +127,7 @@ struct A_DeclareList {
 
 
 struct S_DeclareList : Node {
+    S_DeclareList() : Node(NodeKind::S_DECLARE_LIST) {}
     struct PairType {
         PairType(const ustring &name, Node::Ptr initial)
             : name(name), initial(std::move(initial))
@@ -101,67 +141,95 @@ struct S_DeclareList : Node {
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct S_Condition : Node {
+    S_Condition() : Node(NodeKind::S_CONDITION) {}
     Node::Ptr condition;
     Node::Ptr then_block;
     Node::Ptr else_block;   // optional, S_Block or S_Condition
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct S_While : Node {
+    S_While() : Node(NodeKind::S_WHILE) {}
     Node::Ptr condition;
     Node::Ptr block;
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
-// TODO: S_For, S_DoWhile
+// for (let i = start, stop[, step]) {} or for (let item in list) {}
+struct S_For : Node {
+    S_For() : Node(NodeKind::S_FOR) {}
+    struct AttrType {
+        bool reuse_counter = false; // counter of range is only read by arithmetic, can be mutated
+    };
+
+    Node::Ptr var;      // S_DeclareList with one name, local to block
+    Node::Ptr start;    // optional, integer range [start, stop)
+    Node::Ptr stop;
+    Node::Ptr step;     // optional
+    Node::Ptr iterable; // optional, list items
+    Node::Ptr block;
+    AttrType attr {};
+
+    bool is_range() const {
+        return !this->iterable;
+    }
+
+    virtual bool operator==(const Node &rhs) const override;
+    virtual std::string repr(uint32_t indent = 0) const override;
+};
+
+
+// TODO: S_DoWhile
 
 
 struct S_Return : Node {
+    S_Return() : Node(NodeKind::S_RETURN) {}
+    struct AttrType {
+        bool is_tail_call = false;  // returning a call inside a function
+    };
+
     Node::Ptr value;    // optional
+    AttrType attr {};
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct S_Break : Node {
+    S_Break() : Node(NodeKind::S_BREAK) {}
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct S_Continue : Node {
+    S_Continue() : Node(NodeKind::S_CONTINUE) {}
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct S_Exp : Node {
+    S_Exp() : Node(NodeKind::S_EXP) {}
     Node::Ptr value;
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct S_Empty : Node {
+    S_Empty() : Node(NodeKind::S_EMPTY) {}
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
@@ -195,14 +263,13 @@ enum class OpCode : uint32_t {
 
 
 struct E_Op : Node {
-    explicit E_Op(OpCode op_code) : op_code(op_code) {}
+    explicit E_Op(OpCode op_code) : Node(NodeKind::E_OP), op_code(op_code) {}
 
     OpCode op_code;
     std::vector<Node::Ptr> args;
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
@@ -212,31 +279,48 @@ struct E_Var : Node {
         int index = -1;
     };
 
-    explicit E_Var(const ustring &name) : name(name) {}
+    explicit E_Var(const ustring &name) : Node(NodeKind::E_VAR), name(name) {}
 
     ustring name;
     AttrType attr {};
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct E_Func : Node {
+    struct AttrType {
+        // the block is empty until the first call if set, see parse_lazy_body()
+        const SourceText *lazy_source = nullptr;
+        // number of locals of the enclosing blocks visible to the lazy body, innermost first
+        std::vector<uint32_t> lazy_scope;
+    };
+
+    E_Func() : Node(NodeKind::E_FUNC) {}
     Node::Ptr args;     // S_DeclareList, optional
     Node::Ptr block;
+    mutable AttrType attr;
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
+template<class ValueType>
+struct ValueNodeKind;
+template<> struct ValueNodeKind<bool> { static const NodeKind value = NodeKind::E_BOOL; };
+template<> struct ValueNodeKind<int64_t> { static const NodeKind value = NodeKind::E_INT; };
+template<> struct ValueNodeKind<double> { static const NodeKind value = NodeKind::E_FLOAT; };
+template<> struct ValueNodeKind<ustring> { static const NodeKind value = NodeKind::E_STRING; };
+
+
 template<class ValueType>
 struct _E_Value : Node {
     typedef _E_Value<ValueType> _SelfType;
-    explicit _E_Value<ValueType>(const ValueType &value) : value(value) {}
+    explicit _E_Value<ValueType>(const ValueType &value)
+        : Node(ValueNodeKind<ValueType>::value), value(value)
+    {}
 
     ValueType value;
 
@@ -245,7 +329,6 @@ struct _E_Value : Node {
         return other != nullptr && this->value == other->value;
     }
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
@@ -256,17 +339,90 @@ typedef _E_Value<ustring> E_String;
 
 
 struct E_List : Node {
+    E_List() : Node(NodeKind::E_LIST) {}
     std::vector<Node::Ptr> value;
 
     virtual bool operator==(const Node &rhs) const override;
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
 };
 
 
 struct E_Null : Node {
+    E_Null() : Node(NodeKind::E_NULL) {}
     virtual std::string repr(uint32_t indent = 0) const override;
-    virtual void accept(NodeVisitor &vis) override;
+};
+
+
+// superinstructions, replace common shapes after analysis, see fuse_nodes()
+struct FusedNode : Node {
+    FusedNode(NodeKind kind, Node::Ptr original);
+
+    Node::Ptr original;     // owns the children, and is used for repr and comparison
+
+    virtual bool operator==(const Node &rhs) const override;
+    virtual std::string repr(uint32_t indent = 0) const override;
+};
+
+
+// x op= value, x = x op value, where op is arithmetic
+struct E_FusedVarUpdate : FusedNode {
+    E_FusedVarUpdate(Node::Ptr original, E_Var &var, OpCode op_code, Node &value)
+        : FusedNode(NodeKind::E_FUSED_VAR_UPDATE, std::move(original)),
+          var(var), op_code(op_code), value(value)
+    {}
+
+    E_Var &var;
+    OpCode op_code;
+    Node &value;
+};
+
+
+// base[index] = value
+struct E_FusedSetItem : FusedNode {
+    E_FusedSetItem(Node::Ptr original, Node &base, Node &index, Node &value)
+        : FusedNode(NodeKind::E_FUSED_SET_ITEM, std::move(original)),
+          base(base), index(index), value(value)
+    {}
+
+    Node &base;
+    Node &index;
+    Node &value;
+};
+
+
+// comparison tested without creating a bool
+struct FusedCompare {
+    OpCode op_code;
+    Node &lhs;
+    Node &rhs;
+};
+
+
+// if (lhs cmp rhs)
+struct S_FusedCondition : FusedNode {
+    S_FusedCondition(Node::Ptr original, const FusedCompare &test)
+        : FusedNode(NodeKind::S_FUSED_CONDITION, std::move(original)), test(test)
+    {}
+
+    FusedCompare test;
+
+    S_Condition &cond() {
+        return static_cast<S_Condition &>(*this->original);
+    }
+};
+
+
+// while (lhs cmp rhs)
+struct S_FusedWhile : FusedNode {
+    S_FusedWhile(Node::Ptr original, const FusedCompare &test)
+        : FusedNode(NodeKind::S_FUSED_WHILE, std::move(original)), test(test)
+    {}
+
+    FusedCompare test;
+
+    S_While &wh() {
+        return static_cast<S_While &>(*this->original);
+    }
 };
 
 
@@ -0,0 +1,49 @@
+#include <new>
+
+#include "node_arena.h"
+
+
+static thread_local NodeArena *current_arena = nullptr;
+
+
+NodeArena::~NodeArena() {
+    for (void *chunk : this->chunks) {
+        ::operator delete(chunk);
+    }
+}
+
+
+ReplaceRestore<NodeArena *> NodeArena::enter() {
+    return ReplaceRestore<NodeArena *>(&current_arena, this);
+}
+
+
+NodeArena *NodeArena::current() {
+    return current_arena;
+}
+
+
+void *NodeArena::allocate(size_t size) {
+    size = (size + ALIGN - 1) / ALIGN * ALIGN;
+    this->allocated += size;
+
+    if (size > CHUNK_SIZE / 4) {
+        // large ones get their own chunk, the current chunk is kept
+        void *mem = ::operator new(size);
+        this->chunks.push_back(mem);
+        return mem;
+    }
+    if (static_cast<size_t>(this->end - this->cur) < size) {
+        this->cur = static_cast<char *>(::operator new(CHUNK_SIZE));
+        this->end = this->cur + CHUNK_SIZE;
+        this->chunks.push_back(this->cur);
+    }
+    void *mem = this->cur;
+    this->cur += size;
+    return mem;
+}
+
+
+size_t NodeArena::bytes_allocated() const {
+    return this->allocated;
+}
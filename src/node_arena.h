@@ -0,0 +1,38 @@
+#ifndef JIAOBENSCRIPT_NODE_ARENA_H
+#define JIAOBENSCRIPT_NODE_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#include "replace_restore.hpp"
+
+
+// Bump allocator for AST nodes. Nodes created while the arena is entered on the thread are
+// placed contiguously in creation order, which is close to evaluation order. Deleting such a
+// node runs its destructor only, the memory is freed with the arena, so the arena must outlive
+// its nodes.
+class NodeArena {
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    static const size_t ALIGN = alignof(void *);    // of the allocations
+
+    NodeArena() {}
+    NodeArena(const NodeArena &) = delete;
+    NodeArena &operator=(const NodeArena &) = delete;
+    ~NodeArena();
+
+    ReplaceRestore<NodeArena *> enter();
+    static NodeArena *current();
+
+    void *allocate(size_t size);
+    size_t bytes_allocated() const;
+
+private:
+    std::vector<void *> chunks;
+    char *cur = nullptr;
+    char *end = nullptr;
+    size_t allocated = 0;
+};
+
+
+#endif //JIAOBENSCRIPT_NODE_ARENA_H
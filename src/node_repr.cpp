@@ -56,6 +56,24 @@ std::string S_While::repr(uint32_t indent) const {
 }
 
 
+std::string S_For::repr(uint32_t indent) const {
+    const S_DeclareList &decls = static_cast<const S_DeclareList &>(*this->var);
+    std::string ans;
+    ans += _make_indent(indent) + "for (let " + u8_encode(decls.decls.front().name);
+    if (this->is_range()) {
+        ans += " = " + this->start->repr(indent + 1) + ", " + this->stop->repr(indent + 1);
+        if (this->step) {
+            ans += ", " + this->step->repr(indent + 1);
+        }
+    } else {
+        ans += " in " + this->iterable->repr(indent + 1);
+    }
+    ans += ")\n";
+    ans += this->block->repr(indent);
+    return ans;
+}
+
+
 std::string S_Return::repr(uint32_t indent) const {
     if (!this->value) {
         return _make_indent(indent) + "return;";
@@ -227,3 +245,8 @@ template
 std::string E_Float::repr(uint32_t) const;
 template
 std::string E_String::repr(uint32_t) const;
+
+
+std::string FusedNode::repr(uint32_t indent) const {
+    return this->original->repr(indent);
+}
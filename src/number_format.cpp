@@ -0,0 +1,395 @@
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "number_format.h"
+
+
+namespace {
+
+const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+// two digits per division
+char *write_uint(char *out, uint64_t value) {
+    char tmp[INT_FORMAT_SIZE];
+    char *p = tmp + sizeof(tmp);
+    while (value >= 100) {
+        size_t pair = static_cast<size_t>(value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        std::memcpy(p, DIGIT_PAIRS + pair, 2);
+    }
+    if (value >= 10) {
+        p -= 2;
+        std::memcpy(p, DIGIT_PAIRS + value * 2, 2);
+    } else {
+        *--p = static_cast<char>('0' + value);
+    }
+    size_t size = static_cast<size_t>(tmp + sizeof(tmp) - p);
+    std::memcpy(out, p, size);
+    return out + size;
+}
+
+
+// The shortest decimal is found by the Schubfach algorithm of Raffaello Giulietti, "The Schubfach
+// way to render doubles", 2020. The names follow the paper.
+
+const int P = 53;                   // significand bits
+const int Q_MIN = -1074;            // exponent of the subnormals
+const uint64_t C_MIN = 1ull << (P - 1);
+const uint64_t C_TINY = 3;          // subnormals below are scaled by 10 for precision
+const int K_MIN = -324;
+const int K_MAX = 292;
+const uint64_t MASK_63 = (1ull << 63) - 1;
+
+
+// floor(e * log10(2))
+int flog10pow2(int e) {
+    return static_cast<int>((e * 661971961083ll) >> 41);
+}
+
+
+// floor(log10(3/4 * 2^e))
+int flog10threequarterspow2(int e) {
+    return static_cast<int>((e * 661971961083ll - 274743187321ll) >> 41);
+}
+
+
+// floor(e * log2(10))
+int flog2pow10(int e) {
+    return static_cast<int>((e * 913124641741ll) >> 38);
+}
+
+
+uint64_t multiply_high(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+#else
+    uint64_t a0 = a & 0xffffffff, a1 = a >> 32;
+    uint64_t b0 = b & 0xffffffff, b1 = b >> 32;
+    uint64_t mid = (a0 * b0 >> 32) + (a1 * b0 & 0xffffffff) + a0 * b1;
+    return a1 * b1 + (a1 * b0 >> 32) + (mid >> 32);
+#endif
+}
+
+
+// Little endian unsigned integer, only for building the table of powers of ten.
+class BigUint {
+public:
+    explicit BigUint(uint32_t value) : words {value} {}
+
+    void mul_small(uint32_t factor) {
+        uint64_t carry = 0;
+        for (uint32_t &word : this->words) {
+            carry += static_cast<uint64_t>(word) * factor;
+            word = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            this->words.push_back(static_cast<uint32_t>(carry));
+        }
+    }
+
+    int bit_length() const {
+        int bits = 32 * static_cast<int>(this->words.size() - 1);
+        for (uint32_t top = this->words.back(); top != 0; top >>= 1) {
+            ++bits;
+        }
+        return bits;
+    }
+
+    // zero below the lowest bit
+    bool bit(int index) const {
+        if (index < 0 || index / 32 >= static_cast<int>(this->words.size())) {
+            return false;
+        }
+        return (this->words[index / 32] >> (index % 32) & 1) != 0;
+    }
+
+    void shift_left_1() {
+        uint32_t carry = 0;
+        for (uint32_t &word : this->words) {
+            uint32_t next = word >> 31;
+            word = word << 1 | carry;
+            carry = next;
+        }
+        if (carry != 0) {
+            this->words.push_back(carry);
+        }
+    }
+
+    bool operator>=(const BigUint &rhs) const {
+        if (this->words.size() != rhs.words.size()) {
+            return this->words.size() > rhs.words.size();
+        }
+        for (size_t i = this->words.size(); i-- > 0; ) {
+            if (this->words[i] != rhs.words[i]) {
+                return this->words[i] > rhs.words[i];
+            }
+        }
+        return true;
+    }
+
+    void operator-=(const BigUint &rhs) {
+        int64_t borrow = 0;
+        for (size_t i = 0; i < this->words.size(); ++i) {
+            int64_t diff = static_cast<int64_t>(this->words[i]) - borrow
+                - (i < rhs.words.size() ? rhs.words[i] : 0);
+            borrow = diff < 0;
+            this->words[i] = static_cast<uint32_t>(diff);
+        }
+        while (this->words.size() > 1 && this->words.back() == 0) {
+            this->words.pop_back();
+        }
+    }
+
+private:
+    std::vector<uint32_t> words;
+};
+
+
+// g = g1 * 2^63 + g0 is floor(beta) + 1, where 10^-k = beta * 2^r and 2^125 <= beta < 2^126
+struct PowerTable {
+    uint64_t g1[K_MAX - K_MIN + 1];
+    uint64_t g0[K_MAX - K_MIN + 1];
+
+    PowerTable() {
+        // 10^m for m >= 0, the top 126 bits
+        BigUint power(1);
+        for (int k = 0; k >= K_MIN; --k) {
+            int shift = power.bit_length() - 126;
+            uint64_t hi = 0, lo = 0;
+            for (int i = 125; i >= 0; --i) {
+                bool bit = power.bit(i + shift);
+                (i >= 64 ? hi : lo) |= static_cast<uint64_t>(bit) << (i % 64);
+            }
+            this->set(k, hi, lo);
+            power.mul_small(10);
+        }
+
+        // 2^(125 + bit_length(10^k)) / 10^k for k > 0, by long division
+        power = BigUint(10);
+        for (int k = 1; k <= K_MAX; ++k) {
+            BigUint rem(1);
+            for (int i = 1; i < power.bit_length(); ++i) {
+                rem.shift_left_1();
+            }
+            uint64_t hi = 0, lo = 0;
+            for (int i = 125; i >= 0; --i) {
+                rem.shift_left_1();
+                if (rem >= power) {
+                    rem -= power;
+                    (i >= 64 ? hi : lo) |= 1ull << (i % 64);
+                }
+            }
+            this->set(k, hi, lo);
+            power.mul_small(10);
+        }
+    }
+
+    void set(int k, uint64_t hi, uint64_t lo) {
+        // plus one, never carries to 2^126
+        ++lo;
+        hi += lo == 0;
+        assert(hi < 1ull << 62);
+        this->g1[k - K_MIN] = hi << 1 | lo >> 63;
+        this->g0[k - K_MIN] = lo & MASK_63;
+    }
+};
+
+
+const PowerTable &power_table() {
+    static const PowerTable table;
+    return table;
+}
+
+
+// floor(g * cp / 2^127), with the lowest bit set if inexact
+uint64_t rop(uint64_t g1, uint64_t g0, uint64_t cp) {
+    uint64_t x1 = multiply_high(g0, cp);
+    uint64_t y0 = g1 * cp;
+    uint64_t y1 = multiply_high(g1, cp);
+    uint64_t z = (y0 >> 1) + x1;
+    uint64_t vbp = y1 + (z >> 63);
+    return vbp | (((z & MASK_63) + MASK_63) >> 63);
+}
+
+
+// the shortest decimal f * 10^e in the rounding interval of c * 2^q
+void to_decimal(int q, uint64_t c, int dk, uint64_t &f, int &e) {
+    uint64_t out = c & 1;       // the bounds are included if c is even
+    uint64_t cb = c << 2;
+    uint64_t cbr = cb + 2;
+    uint64_t cbl;
+    int k;
+    if (c != C_MIN || q == Q_MIN) {
+        cbl = cb - 2;
+        k = flog10pow2(q);
+    } else {
+        // the lower neighbor is closer
+        cbl = cb - 1;
+        k = flog10threequarterspow2(q);
+    }
+    int h = q + flog2pow10(-k) + 2;
+    const PowerTable &table = power_table();
+    uint64_t g1 = table.g1[k - K_MIN];
+    uint64_t g0 = table.g0[k - K_MIN];
+
+    uint64_t vb = rop(g1, g0, cb << h);
+    uint64_t vbl = rop(g1, g0, cbl << h);
+    uint64_t vbr = rop(g1, g0, cbr << h);
+
+    uint64_t s = vb >> 2;
+    if (s >= 10) {
+        // one digit less, both may be in the interval of the smallest subnormals scaled by 10
+        uint64_t sp10 = s / 10 * 10;
+        uint64_t tp10 = sp10 + 10;
+        bool upin = vbl + out <= sp10 << 2;
+        bool wpin = (tp10 << 2) + out <= vbr;
+        if (upin || wpin) {
+            uint64_t mid = (sp10 + tp10) << 1;
+            bool lower = upin && (!wpin || vb < mid || (vb == mid && (sp10 / 10 & 1) == 0));
+            f = lower ? sp10 : tp10;
+            e = k + dk;
+            return;
+        }
+    }
+    uint64_t t = s + 1;
+    bool uin = vbl + out <= s << 2;
+    bool win = (t << 2) + out <= vbr;
+    e = k + dk;
+    if (uin != win) {
+        f = uin ? s : t;
+        return;
+    }
+    // both in the interval, the closer one, or the even one on ties
+    uint64_t mid = (s + t) << 1;
+    f = vb < mid || (vb == mid && (s & 1) == 0) ? s : t;
+}
+
+
+// the digits f * 10^e of a positive finite value
+void shortest_decimal(double value, uint64_t &f, int &e) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    int bq = static_cast<int>(bits >> (P - 1)) & 0x7ff;
+    uint64_t t = bits & (C_MIN - 1);
+    if (bq != 0) {
+        int mq = -Q_MIN + 1 - bq;
+        uint64_t c = C_MIN | t;
+        if (0 < mq && mq < P) {
+            // small integers
+            uint64_t integral = c >> mq;
+            if (integral << mq == c) {
+                f = integral;
+                e = 0;
+                return;
+            }
+        }
+        to_decimal(-mq, c, 0, f, e);
+    } else if (t < C_TINY) {
+        to_decimal(Q_MIN, 10 * t, -1, f, e);
+    } else {
+        to_decimal(Q_MIN, t, 0, f, e);
+    }
+}
+
+}   // namespace
+
+
+char *format_int(char *buf, int64_t value) {
+    uint64_t magnitude = static_cast<uint64_t>(value);
+    if (value < 0) {
+        *buf++ = '-';
+        magnitude = 0 - magnitude;
+    }
+    return write_uint(buf, magnitude);
+}
+
+
+char *format_double(char *buf, double value) {
+    if (std::isnan(value)) {
+        std::memcpy(buf, "nan", 3);
+        return buf + 3;
+    }
+    if (std::signbit(value)) {
+        *buf++ = '-';
+        value = -value;
+    }
+    if (std::isinf(value)) {
+        std::memcpy(buf, "inf", 3);
+        return buf + 3;
+    }
+    if (value == 0) {
+        std::memcpy(buf, "0.0", 3);
+        return buf + 3;
+    }
+
+    uint64_t f;
+    int e;
+    shortest_decimal(value, f, e);
+    while (f % 10 == 0) {
+        f /= 10;
+        ++e;
+    }
+    char digits[INT_FORMAT_SIZE];
+    int ndigits = static_cast<int>(write_uint(digits, f) - digits);
+    int exp = e + ndigits - 1;      // of the first digit
+
+    char *out = buf;
+    if (exp < -4 || exp >= 16) {
+        *out++ = digits[0];
+        *out++ = '.';
+        if (ndigits > 1) {
+            std::memcpy(out, digits + 1, ndigits - 1);
+            out += ndigits - 1;
+        } else {
+            *out++ = '0';
+        }
+        *out++ = 'e';
+        *out++ = exp < 0 ? '-' : '+';
+        if (exp < 0) {
+            exp = -exp;
+        }
+        if (exp < 10) {
+            *out++ = '0';
+        }
+        out = write_uint(out, static_cast<uint64_t>(exp));
+    } else if (exp < 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = -1; i > exp; --i) {
+            *out++ = '0';
+        }
+        std::memcpy(out, digits, ndigits);
+        out += ndigits;
+    } else if (exp + 1 >= ndigits) {
+        std::memcpy(out, digits, ndigits);
+        out += ndigits;
+        for (int i = ndigits; i <= exp; ++i) {
+            *out++ = '0';
+        }
+        *out++ = '.';
+        *out++ = '0';
+    } else {
+        std::memcpy(out, digits, exp + 1);
+        out += exp + 1;
+        *out++ = '.';
+        std::memcpy(out, digits + exp + 1, ndigits - exp - 1);
+        out += ndigits - exp - 1;
+    }
+    assert(out - buf <= static_cast<ptrdiff_t>(DOUBLE_FORMAT_SIZE) - 1);
+    return out;
+}
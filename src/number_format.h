@@ -0,0 +1,22 @@
+#ifndef JIAOBENSCRIPT_NUMBER_FORMAT_H
+#define JIAOBENSCRIPT_NUMBER_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+// the buffer sizes for the functions below, no terminator is written
+constexpr size_t INT_FORMAT_SIZE = 20;
+constexpr size_t DOUBLE_FORMAT_SIZE = 32;
+
+// writes the decimal digits of value to buf, returns the end
+char *format_int(char *buf, int64_t value);
+
+// Writes the shortest decimal that reads back as value, the closest one if there are several.
+// Exponents from -4 to 15 are written in fixed notation, with a ".0" if integral, others in
+// scientific notation like "1.5e+20", so the result is read as a float by the tokenizer. Special
+// values are written as "inf", "-inf" and "nan". Returns the end.
+char *format_double(char *buf, double value);
+
+
+#endif //JIAOBENSCRIPT_NUMBER_FORMAT_H
@@ -0,0 +1,86 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "output.h"
+
+
+OutputSink::OutputSink(bool line_buffered, size_t capacity)
+    : buffer(capacity), line_buffered(line_buffered)
+{}
+
+
+void OutputSink::write(const unichar *data, size_t size) {
+    const unichar *start = data;
+    const unichar *end = start + size;
+    while (start < end) {
+        // a code point takes 6 bytes at most, see u8_char_len()
+        if (this->buffer.size() - this->used < 6) {
+            this->flush();
+        }
+        char *out = &this->buffer[this->used];
+        char *stop = out + (this->buffer.size() - this->used) - 5;
+        while (start < end && out < stop) {
+            unichar ch = *start++;
+            if (ch < 0x80) {
+                *out++ = static_cast<char>(ch);
+            } else {
+                out = u8_write_char(out, ch);
+            }
+        }
+        this->used = out - &this->buffer[0];
+    }
+}
+
+
+void OutputSink::flush() {
+    if (this->used > 0) {
+        size_t size = this->used;
+        this->used = 0;
+        this->drain(this->buffer.data(), size);
+    }
+}
+
+
+void OutputSink::write_slow(const char *data, size_t size) {
+    this->flush();
+    if (size >= this->buffer.size()) {
+        // not copied
+        this->drain(data, size);
+    } else {
+        std::memcpy(&this->buffer[0], data, size);
+        this->used = size;
+    }
+}
+
+
+FdOutput::FdOutput(int fd) : FdOutput(fd, ::isatty(fd) != 0) {}
+
+
+FdOutput::FdOutput(int fd, bool line_buffered) : OutputSink(line_buffered), fd(fd) {}
+
+
+FdOutput::~FdOutput() {
+    this->flush();
+}
+
+
+void FdOutput::drain(const char *data, size_t size) {
+    while (size > 0 && this->error_msg.empty()) {
+        ssize_t written = ::write(this->fd, data, size);
+        if (written < 0) {
+            if (errno != EINTR) {
+                this->error_msg = std::string("write to output: ") + std::strerror(errno);
+            }
+            continue;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+
+FdOutput &standard_output() {
+    static FdOutput output(STDOUT_FILENO);
+    return output;
+}
@@ -0,0 +1,114 @@
+#ifndef JIAOBENSCRIPT_OUTPUT_H
+#define JIAOBENSCRIPT_OUTPUT_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "unicode.h"
+
+
+// Buffered destination of the text printed by scripts. The buffer is passed to drain() when full
+// or flushed, and after each line if line buffered.
+class OutputSink {
+public:
+    explicit OutputSink(bool line_buffered = false, size_t capacity = 64 * 1024);
+    OutputSink(const OutputSink &) = delete;
+    OutputSink &operator=(const OutputSink &) = delete;
+    // subclasses flush in their destructors, drain() is not available here
+    virtual ~OutputSink() {}
+
+    void write(const char *data, size_t size) {
+        if (size <= this->buffer.size() - this->used) {
+            std::memcpy(&this->buffer[this->used], data, size);
+            this->used += size;
+        } else {
+            this->write_slow(data, size);
+        }
+    }
+    void write(const std::string &str) {
+        this->write(str.data(), str.size());
+    }
+    // utf-8 encoded in the buffer
+    void write(const unichar *data, size_t size);
+    void write(const ustring &us) {
+        this->write(us.data(), us.size());
+    }
+    void put(char ch) {
+        if (this->used == this->buffer.size()) {
+            this->flush();
+        }
+        this->buffer[this->used++] = ch;
+    }
+    void end_line() {
+        this->put('\n');
+        if (this->line_buffered) {
+            this->flush();
+        }
+    }
+    void flush();
+
+protected:
+    virtual void drain(const char *data, size_t size) = 0;
+
+private:
+    void write_slow(const char *data, size_t size);
+
+    std::vector<char> buffer;
+    size_t used = 0;
+    bool line_buffered;
+};
+
+
+// Writes to a file descriptor, which is not closed. Line buffered by default if it is a terminal.
+// Write errors are kept instead of thrown, the output after an error is discarded.
+class FdOutput final : public OutputSink {
+public:
+    explicit FdOutput(int fd);
+    FdOutput(int fd, bool line_buffered);
+    virtual ~FdOutput();
+
+    const std::string &error() const {   // empty if no error
+        return this->error_msg;
+    }
+
+protected:
+    virtual void drain(const char *data, size_t size) override;
+
+private:
+    int fd;
+    std::string error_msg;
+};
+
+
+// Keeps the output in memory, for embedding the interpreter.
+class StringOutput final : public OutputSink {
+public:
+    StringOutput() : OutputSink(false, 4 * 1024) {}
+    virtual ~StringOutput() {}
+
+    const std::string &str() {
+        this->flush();
+        return this->value;
+    }
+    void clear() {
+        this->flush();
+        this->value.clear();
+    }
+
+protected:
+    virtual void drain(const char *data, size_t size) override {
+        this->value.append(data, size);
+    }
+
+private:
+    std::string value;
+};
+
+
+// the stdout of the process, flushed at exit
+FdOutput &standard_output();
+
+
+#endif //JIAOBENSCRIPT_OUTPUT_H
@@ -1,1081 +1,849 @@
-#include <algorithm>
 #include <cassert>
-#include <cstring>
 #include <utility>
 
 #include "parser.h"
 
 
 void Parser::start_program() {
-    this->enter_program();
+    this->restart(Mode::PROGRAM);
 }
 
 
 void Parser::start_repl() {
-    this->enter_program_or_exp();
+    this->restart(Mode::REPL);
 }
 
 
 bool Parser::is_empty() const {
-    return this->states.empty();
+    return this->mode == Mode::NONE;
 }
 
 
-bool Parser::can_end() const {
-    assert(!this->states.empty());
-    assert(
-        this->states.front() == &Parser::state_PROGRAM_OR_EXP
-        || this->states.front() == &Parser::state_PROGRAM
-    );
-
-    auto stop = --this->states.rend();
-    for (auto it = this->states.rbegin(); it != stop; ++it) {
-        if (Parser::terminating_states.contains(*it)) {
-            continue;
-        } else {
-            return false;
-        }
-    }
-    return true;
+bool Parser::has_tokens() const {
+    return !this->tokens.empty();
 }
 
 
-void Parser::reset() {
-    *this = Parser();
-}
-
-
-Parser::SortedState::SortedState(std::initializer_list<Parser::StateHandler> states)
-    : states(states)
-{
-    std::sort(this->states.begin(), this->states.end(), &SortedState::cmp);
-}
-
-
-bool Parser::SortedState::contains(const Parser::StateHandler &state) const {
-    return std::binary_search(
-        this->states.begin(), this->states.end(), state, &SortedState::cmp
-    );
-}
-
-
-bool Parser::SortedState::cmp(const Parser::StateHandler &lhs, const Parser::StateHandler &rhs) {
-    return memcmp(&lhs, &rhs, sizeof(StateHandler)) < 0;
-}
-
-
-Parser::SortedState Parser::terminating_states {
-    // can terminate a statement
-    &Parser::state_COND_ELSE,
-    &Parser::state_COND_END,
-    &Parser::state_WHILE_END,
-
-    // can transit to expression mode and terminate
-    &Parser::state_STMT_EXP,
-
-    // can terminate an expression
-    &Parser::state_EXP_LIST,
-    &Parser::state_EXP_LIST_ABS,
-    &Parser::state_EXP_ASSIGN,
-    &Parser::state_EXP_ASSIGN_END,
-
-    &Parser::state_EXP_OR,
-    &Parser::state_EXP_OR_END,
-    &Parser::state_EXP_AND,
-    &Parser::state_EXP_AND_END,
-    &Parser::state_EXP_EQ,
-    &Parser::state_EXP_EQ_END,
-    &Parser::state_EXP_CMP,
-    &Parser::state_EXP_CMP_END,
-    &Parser::state_EXP_A,
-    &Parser::state_EXP_A_END,
-    &Parser::state_EXP_X,
-    &Parser::state_EXP_X_END,
-
-    &Parser::state_EXP_X_HEAD_END,
-    &Parser::state_EXP_NOT_END,
-    &Parser::state_EXP_CALL_OR_SUBS,
-    &Parser::state_FUNC_END,
-};
-
-
-void Parser::leave() {
-    this->states.pop_back();
-}
-
-
-void Parser::pass_up(const Token &tok) {
-    this->leave();
-    this->feed(tok);
-}
-
-
-void Parser::shift(Parser::StateHandler state) {
-    this->states.back() = state;
-}
-
-
-Node::Ptr Parser::pop_result() {
-    if (!this->can_end()) {
-        throw ParserError("Not finished");
+bool Parser::can_end() {
+    assert(this->mode != Mode::NONE);
+    if (!this->ended && !this->unbalanced && !this->open_brackets.empty()) {
+        // a construct is open whatever the tokens are, reparsing on each line is quadratic
+        return false;
     }
-    this->feed(Token(TokenCode::END));
-    assert(this->nodes.size() == 1);
-    assert(this->states.size() == 1);
-
-    Node::Ptr ret = std::move(this->nodes.back());
-    this->nodes.pop_back();
-    this->states.pop_back();
-    return ret;     // Program or expression
+    return this->result || this->parse();
 }
 
 
-void Parser::unpected_token(const Token &tok, const std::string &addtional) {
-    std::string msg = "Unexpected token " + tok.repr_short();
-    if (!addtional.empty()) {
-        msg += " " + addtional;
-    }
-    throw ParserError(msg, tok.pos_start, tok.pos_end);
+// the token buffers are kept for the next input
+void Parser::reset() {
+    this->restart(Mode::NONE);
+    this->cur = 0;
+    this->depth = 0;
 }
 
 
-bool Parser::match_id(const Token &tok, const ustring &id) {
-    const TokenId *idtok = dynamic_cast<const TokenId *>(&tok);
-    return idtok != nullptr && idtok->value == id;
+void Parser::set_lazy_source(const SourceText *source) {
+    this->lazy_source = source;
 }
 
 
 void Parser::feed(const Token &tok) {
-    if (this->states.empty()) {
+    if (this->mode == Mode::NONE) {
         return this->unpected_token(tok, "parser not started");
     }
     if (tok.tokencode == TokenCode::COMMENT) {
         return;
     }
+    if (this->ended) {
+        return this->unpected_token(tok, "parser ended");
+    }
 
-    (this->*this->states.back())(tok);
-}
-
-
-void Parser::state_END(const Token & tok) {
-    this->unpected_token(tok, "parser ended");
-}
-
-
-void Parser::state_PROGRAM_OR_EXP(const Token & tok) {
-    Program *p = this->get_top2<Program>();
-    p->stmts.emplace_back(this->pop_top());
-    this->set_pos_start(*p->stmts.front());
+    this->result.reset();
+    this->tokens.push_back(tok);
+    this->track_bracket(tok.tokencode);
     if (tok.tokencode == TokenCode::END) {
-        this->set_pos_end(*p->stmts.back());
-        this->shift(&Parser::state_END);
-    } else {
-        this->enter_stmt();
-        this->feed(tok);
+        this->ended = true;
+    } else if (tok.has_text()) {
+        // the text may be overwritten by the next token of its owner
+        this->texts.push_back(*tok.text);
+        this->tokens.back().text = &this->texts.back();
     }
 }
 
 
-void Parser::state_PROGRAM(const Token & tok) {
-    return this->state_PROGRAM_OR_EXP(tok);
-}
-
-
-void Parser::state_STMT(const Token & tok) {
-    if (tok.tokencode == TokenCode::SEMICOLON) {
-        // empty stmt
-        this->nodes.emplace_back(new S_Empty());
-        this->set_pos_start_end(tok);
-        this->leave();
-    } else if (tok.tokencode == TokenCode::LBRACE) {
-        this->leave();
-        this->enter_block(tok);
-    } else if (match_id(tok, USTRING("return"))) {
-        this->leave();
-        this->enter_return(tok);
-    } else if (match_id(tok, USTRING("continue"))) {
-        this->leave();
-        this->enter_continue(tok);
-    } else if (match_id(tok, USTRING("break"))) {
-        this->leave();
-        this->enter_break(tok);
-    } else if (match_id(tok, USTRING("let"))) {
-        this->leave();
-        this->enter_var_decl(tok);
-    } else if (match_id(tok, USTRING("if"))) {
-        this->leave();
-        this->enter_condition(tok);
-    } else if (match_id(tok, USTRING("while"))) {
-        this->leave();
-        this->enter_while(tok);
+void Parser::feed(Tokenizer &tokenizer) {
+    if (this->mode == Mode::NONE || this->ended) {
+        // the error is reported by feed(tok)
+        while (const Token *tok = tokenizer.pop()) {
+            this->feed(*tok);
+        }
+        return;
     }
-        // TODO: do-while, for
-    else {
-        this->shift(&Parser::state_STMT_EXP);
-        this->enter_exp();
-        this->feed(tok);
+    while (const Token *tok = this->take(tokenizer)) {
+        this->result.reset();
+        this->track_bracket(tok->tokencode);
     }
 }
 
 
-void Parser::state_STMT_EXP(const Token & tok) {
-    if (tok.tokencode == TokenCode::SEMICOLON) {
-        // replace expression with S_Exp
-        S_Exp *stmt = new S_Exp();
-        stmt->value.reset(this->pop_top());
-        stmt->pos_start = stmt->value->pos_start;
-        this->nodes.emplace_back(stmt);
-        this->set_pos_end(tok);
-        this->leave();
-    } else if (this->states.front() == &Parser::state_PROGRAM_OR_EXP) {
-        if (tok.tokencode == TokenCode::END) {
-            assert(this->nodes.size() == 2);
-            // replace Program with expression
-            this->nodes.front().reset(this->nodes.back().release());
-            this->nodes.pop_back();
-
-            assert(this->states.size() == 2);
-            this->leave();
-            this->shift(&Parser::state_END);
-        } else {
-            this->unpected_token(tok, "expect semicolon or END");
-        }
-    } else {
-        this->unpected_token(tok, "expect semicolon");
+Node::Ptr Parser::pop_result() {
+    if (!this->can_end()) {
+        throw ParserError("Not finished");
     }
+    Node::Ptr ret = std::move(this->result);
+    this->restart(Mode::NONE);
+    return ret;     // Program or expression
 }
 
 
-void Parser::state_BLOCK(const Token & tok) {
-    if (tok.tokencode == TokenCode::RBRACE) {
-        this->set_pos_end(tok);
-        // empty block
-        this->leave();
-    } else {
-        this->shift(&Parser::state_BLOCK_END);
-        this->enter_stmt();
-        this->feed(tok);
-    }
-}
-
+Node::Ptr Parser::parse_program(Tokenizer &tokenizer, const std::function<bool ()> &refill) {
+    this->restart(Mode::PROGRAM);
+    ReplaceRestore<Tokenizer *> _source(&this->source, &tokenizer);
+    ReplaceRestore<const std::function<bool ()> *> _refill(&this->refill, &refill);
+    this->cur = 0;
+    this->depth = 0;
 
-void Parser::state_BLOCK_END(const Token & tok) {
-    S_Block *block = this->get_top2<S_Block>();
-    block->stmts.emplace_back(this->pop_top());
-    if (tok.tokencode == TokenCode::RBRACE) {
-        this->set_pos_end(tok);
-        this->leave();
-    } else {
-        this->enter_stmt();
-        this->feed(tok);
-    }
+    Node::Ptr ret = this->parse_top();
+    this->restart(Mode::NONE);
+    return ret;
 }
 
 
-void Parser::state_BLOCK_PRE(const Token & tok) {
-    if (tok.tokencode == TokenCode::LBRACE) {
-        this->leave();
-        this->enter_block(tok);
-    } else {
-        this->unpected_token(tok, "expect {");
+void Parser::track_bracket(TokenCode tc) {
+    TokenCode open;
+    switch (tc) {
+    case TokenCode::LPAR:
+    case TokenCode::LSQUARE:
+    case TokenCode::LBRACE:
+        this->open_brackets.push_back(tc);
+        return;
+    case TokenCode::RPAR:
+        open = TokenCode::LPAR;
+        break;
+    case TokenCode::RSQUARE:
+        open = TokenCode::LSQUARE;
+        break;
+    case TokenCode::RBRACE:
+        open = TokenCode::LBRACE;
+        break;
+    default:
+        return;
     }
-}
-
-
-void Parser::state_RETURN(const Token & tok) {
-    if (tok.tokencode == TokenCode::SEMICOLON) {
-        this->set_pos_end(tok);
-        this->leave();
+    if (this->open_brackets.empty() || this->open_brackets.back() != open) {
+        this->unbalanced = true;
     } else {
-        this->shift(&Parser::state_RETURN_EXP);
-        this->enter_exp();
-        this->feed(tok);
+        this->open_brackets.pop_back();
     }
 }
 
 
-void Parser::state_RETURN_EXP(const Token & tok) {
-    if (tok.tokencode == TokenCode::SEMICOLON) {
-        S_Return *ret = this->get_top2<S_Return>();
-        ret->value.reset(this->pop_top());
-        this->set_pos_end(tok);
-        this->leave();
-    } else {
-        this->unpected_token(tok, "expect semicolon");
+// Moves the next token of tokenizer to the buffer, comments are dropped. A spare string is
+// swapped with the text of the token, so the tokenizer keeps a capacity and allocates nothing.
+// Returns nullptr if the tokenizer has no token ready.
+const Token *Parser::take(Tokenizer &tokenizer) {
+    ustring text;
+    if (!this->spare_texts.empty()) {
+        text.swap(this->spare_texts.back());
+        this->spare_texts.pop_back();
     }
-}
-
+    const Token *tok;
+    do {
+        tok = tokenizer.pop(text);
+    } while (tok != nullptr && tok->tokencode == TokenCode::COMMENT);
 
-void Parser::state_COND_LPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::LPAR) {
-        this->shift(&Parser::state_COND_RPAR);
-        this->enter_exp();
-    } else {
-        this->unpected_token(tok, "expect (");
+    if (tok == nullptr) {
+        this->recycle(text);
+        return nullptr;
     }
-}
-
-
-void Parser::state_COND_RPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::RPAR) {
-        S_Condition *cond = this->get_top2<S_Condition>();
-        cond->condition.reset(this->pop_top());
-        this->shift(&Parser::state_COND_ELSE);
-        this->enter_block_pre();
+    this->tokens.push_back(*tok);
+    if (tok->has_text()) {
+        this->texts.emplace_back();
+        this->texts.back().swap(text);
+        this->tokens.back().text = &this->texts.back();
     } else {
-        this->unpected_token(tok, "expect )");
+        this->recycle(text);
     }
+    return &this->tokens.back();
 }
 
 
-void Parser::state_COND_ELSE(const Token & tok) {
-    S_Condition *cond = this->get_top2<S_Condition>();
-    cond->then_block.reset(this->pop_top());
-    if (match_id(tok, USTRING("else"))) {
-        this->shift(&Parser::state_COND_END);
-        this->enter_else();
-    } else {
-        this->set_pos_end(*cond->then_block);
-        this->pass_up(tok);
+// the next token for parse_program(), END once refill() has no more input
+void Parser::pull() {
+    assert(this->source != nullptr && !this->ended);
+    while (this->take(*this->source) == nullptr) {
+        if (!(*this->refill)()) {
+            this->tokens.emplace_back(TokenCode::END);
+            this->ended = true;
+            return;
+        }
     }
 }
 
 
-void Parser::state_COND_END(const Token & tok) {
-    S_Condition *cond = this->get_top2<S_Condition>();
-    cond->else_block.reset(this->pop_top());
-    this->set_pos_end(*cond->else_block);
-    this->pass_up(tok);
-}
-
-
-void Parser::state_ELSE(const Token & tok) {
-    if (match_id(tok, USTRING("if"))) {
-        this->leave();
-        this->enter_condition(tok);
-    } else if (tok.tokencode == TokenCode::LBRACE) {
-        this->leave();
-        this->enter_block(tok);
-    } else {
-        this->unpected_token(tok, "expect 'if' or block");
+// the first count tokens, which are not referred anymore
+void Parser::drop_front(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (this->tokens.front().has_text()) {
+            this->recycle(this->texts.front());
+            this->texts.pop_front();
+        }
+        this->tokens.pop_front();
     }
+    this->cur -= count;
 }
 
 
-void Parser::state_CONTINUE(const Token & tok) {
-    this->do_stmt_comma(tok);
-}
-
-
-void Parser::state_BREAK(const Token & tok) {
-    this->do_stmt_comma(tok);
-}
-
-
-void Parser::state_VAR_DECL(const Token & tok) {
-    this->do_stmt_comma(tok);
-}
-
-
-void Parser::do_stmt_comma(const Token &tok) {
-    if (tok.tokencode == TokenCode::SEMICOLON) {
-        this->set_pos_end(tok);
-        this->leave();
-    } else {
-        this->unpected_token(tok, "expect semicolon");
+// the token just returned by next(), which is not referred anymore
+void Parser::drop_back() {
+    assert(this->cur == this->tokens.size());
+    if (this->tokens.back().has_text()) {
+        this->recycle(this->texts.back());
+        this->texts.pop_back();
     }
+    this->tokens.pop_back();
+    this->cur--;
 }
 
 
-void Parser::state_VAR_DECL_LIST(const Token & tok) {
-    if (tok.tokencode == TokenCode::COMMA) {
-        this->enter_var_decl_item();    // item collected in VAR_DECL_ITEM state
-    } else {
-        this->pass_up(tok);
-    }
+void Parser::recycle(ustring &text) {
+    text.clear();
+    this->spare_texts.emplace_back();
+    this->spare_texts.back().swap(text);
 }
 
 
-void Parser::state_VAR_DECL_ITEM(const Token & tok) {
-    S_DeclareList *decls = this->get_top1<S_DeclareList>();
-    if (tok.tokencode == TokenCode::ID) {
-        decls->decls.emplace_back(static_cast<const TokenId &>(tok).value, Node::Ptr());
-        decls->pos_end = tok.pos_end;
-        this->shift(&Parser::state_VAR_DECL_ITEM_END);
-    } else {
-        this->unpected_token(tok, "expect identifier");
+void Parser::restart(Parser::Mode mode) {
+    this->mode = mode;
+    this->tokens.clear();
+    for (ustring &text : this->texts) {
+        this->recycle(text);
     }
+    this->texts.clear();
+    this->open_brackets.clear();
+    this->unbalanced = false;
+    this->ended = false;
+    this->result.reset();
 }
 
 
-void Parser::state_VAR_DECL_ITEM_END(const Token & tok) {
-    if (tok.tokencode == TokenCode::ASSIGN) {
-        this->shift(&Parser::state_VAR_DECL_ITEM_INIT);
-        this->enter_exp_assign();
-    } else {
-        this->pass_up(tok);
+// Parses all tokens fed so far, false if they end in the middle of a construct. The tokens are
+// kept, so parsing is started over if more tokens are fed.
+bool Parser::parse() {
+    if (!this->ended) {
+        this->tokens.emplace_back(TokenCode::END);
     }
-}
-
-
-void Parser::state_VAR_DECL_ITEM_INIT(const Token & tok) {
-    S_DeclareList *decls = this->get_top2<S_DeclareList>();
-    decls->decls.back().initial.reset(this->pop_top());
-    this->set_pos_end(*decls->decls.back().initial);
-    this->pass_up(tok);
-}
-
+    this->cur = 0;
+    this->depth = 0;
 
-void Parser::state_WHILE_LPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::LPAR) {
-        this->shift(&Parser::state_WHILE_RPAR);
-        this->enter_exp();
-    } else {
-        this->unpected_token(tok, "expect (");
+    try {
+        this->result = this->parse_top();
+    } catch (Incomplete &) {
+        assert(!this->result);
+    } catch (...) {
+        if (!this->ended) {
+            this->tokens.pop_back();
+        }
+        throw;
     }
-}
 
-
-void Parser::state_WHILE_RPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::RPAR) {
-        S_While *wh = this->get_top2<S_While>();
-        wh->condition.reset(this->pop_top());
-        this->shift(&Parser::state_WHILE_END);
-        this->enter_block_pre();
-    } else {
-        this->unpected_token(tok, "expect )");
+    if (!this->ended) {
+        this->tokens.pop_back();
     }
+    return this->result != nullptr;
 }
 
 
-void Parser::state_WHILE_END(const Token & tok) {
-    S_While *wh = this->get_top2<S_While>();
-    wh->block.reset(this->pop_top());
-    this->set_pos_end(*wh->block);
-    this->pass_up(tok);
-}
-
-
-void Parser::state_EXP_LIST(const Token & tok) {
-    E_Op *list = this->get_top2<E_Op>();
-    list->args.emplace_back(this->pop_top());
-    this->set_pos_start(*list->args.front());
-    this->set_pos_end(*list->args.back());
+Node::Ptr Parser::parse_top() {
+    Program *prog = new Program();
+    Node::Ptr ret(prog);
+    Node::Ptr bare_exp;
 
-    if (tok.tokencode == TokenCode::COMMA) {
-        this->enter_exp_assign();
-    } else {
-        if (this->states.back() == &Parser::state_EXP_LIST && list->args.size() == 1) {
-            // unwrap comma operator
-            Node *value = list->args.front().release();
-            this->nodes.back().reset(value);
+    do {
+        if (this->source != nullptr) {
+            // the tokens of the parsed statements
+            this->drop_front(this->cur);
         }
-        this->pass_up(tok);
-    }
-}
-
+        Node *stmt = this->parse_stmt(this->mode == Mode::REPL ? &bare_exp : nullptr);
+        if (bare_exp) {
+            // replace Program with expression
+            return bare_exp;
+        }
+        prog->stmts.emplace_back(stmt);
+    } while (this->peek().tokencode != TokenCode::END);
 
-void Parser::state_EXP_LIST_ABS(const Token & tok) {
-    return this->state_EXP_LIST(tok);
+    prog->pos_start = prog->stmts.front()->pos_start;
+    prog->pos_end = prog->stmts.back()->pos_end;
+    return ret;
 }
 
 
-void Parser::state_EXP_ASSIGN(const Token & tok) {
-    uint32_t tc = static_cast<uint32_t>(tok.tokencode);
-    if (tc == '=' || tc == '+=' || tc == '-=' || tc == '/=' || tc == '%=') {
-        E_Op *item;
-        if (dynamic_cast<E_Var *>(this->nodes.back().get())
-            || ((item = dynamic_cast<E_Op *>(this->nodes.back().get()))
-            && item->op_code == OpCode::SUBSCRIPT))
-        {
-            this->grow_head(static_cast<OpCode>(tc));
-            this->shift(&Parser::state_EXP_ASSIGN_END);
-            this->enter_exp_assign();
+// an expression statement without semicolon at the end of input is moved to bare_exp if given
+Node *Parser::parse_stmt(Node::Ptr *bare_exp) {
+    const Token &tok = this->peek();
+    switch (tok.tokencode) {
+    case TokenCode::SEMICOLON: {
+        // empty stmt
+        Node *stmt = new S_Empty();
+        stmt->pos_start = stmt->pos_end = this->next().pos_start;
+        return stmt;
+    }
+    case TokenCode::LBRACE:
+        return this->parse_block();
+    case TokenCode::KW_RETURN:
+        return this->parse_return(this->next());
+    case TokenCode::KW_CONTINUE:
+    case TokenCode::KW_BREAK: {
+        Node::Ptr stmt;
+        if (tok.tokencode == TokenCode::KW_CONTINUE) {
+            stmt.reset(new S_Continue());
         } else {
-            this->unpected_token(tok, "can not assign to expression");
+            stmt.reset(new S_Break());
+        }
+        stmt->pos_start = this->next().pos_start;
+        stmt->pos_end = this->expect(TokenCode::SEMICOLON, "expect semicolon").pos_end;
+        return stmt.release();
+    }
+    case TokenCode::KW_LET: {
+        Node::Ptr decls(this->parse_decl_list(this->next()));
+        decls->pos_end = this->expect(TokenCode::SEMICOLON, "expect semicolon").pos_end;
+        return decls.release();
+    }
+    case TokenCode::KW_IF:
+        return this->parse_condition(this->next());
+    case TokenCode::KW_WHILE:
+        return this->parse_while(this->next());
+    case TokenCode::KW_FOR:
+        return this->parse_for(this->next());
+    // TODO: do-while
+    default:
+        break;
+    }
+
+    Node::Ptr value(this->parse_exp());
+    const Token &end = this->peek();
+    if (end.tokencode == TokenCode::SEMICOLON) {
+        // replace expression with S_Exp
+        S_Exp *stmt = new S_Exp();
+        stmt->pos_start = value->pos_start;
+        stmt->pos_end = this->next().pos_end;
+        stmt->value = std::move(value);
+        return stmt;
+    } else if (bare_exp != nullptr) {
+        if (end.tokencode != TokenCode::END) {
+            this->unpected_token(end, "expect semicolon or END");
         }
+        *bare_exp = std::move(value);
+        return nullptr;
+    } else if (end.tokencode == TokenCode::END && this->depth == 0) {
+        // a top level statement can not be continued
+        throw ParserError("Unexpected token " + end.repr_short() + " expect semicolon");
     } else {
-        this->pass_up(tok);
+        this->unpected_token(end, "expect semicolon");
     }
 }
 
 
-void Parser::state_EXP_ASSIGN_END(const Token & tok) {
-    E_Op *assign = this->get_top2<E_Op>();
-    assign->args.emplace_back(this->pop_top());
-    this->set_pos_end(*assign->args.back());
-    this->pass_up(tok);
-}
-
-
-void Parser::state_EXP_OR(const Token & tok) {
-    this->do_exp_op(tok, {'||'}, &Parser::state_EXP_OR_END, &Parser::enter_exp_and);
-}
-
-
-void Parser::state_EXP_OR_END(const Token & tok) {
-    this->do_exp_op_end(tok, {'||'}, &Parser::enter_exp_and);
-}
-
-
-void Parser::state_EXP_AND(const Token & tok) {
-    this->do_exp_op(tok, {'&&'}, &Parser::state_EXP_AND_END, &Parser::enter_exp_eq);
-}
-
-
-void Parser::state_EXP_AND_END(const Token & tok) {
-    this->do_exp_op_end(tok, {'&&'}, &Parser::enter_exp_eq);
-}
-
-
-void Parser::state_EXP_EQ(const Token & tok) {
-    this->do_exp_op(tok, {'==', '!='}, &Parser::state_EXP_EQ_END, &Parser::enter_exp_cmp);
-}
-
-
-void Parser::state_EXP_EQ_END(const Token & tok) {
-    this->do_exp_op_end(tok, {'==', '!='}, &Parser::enter_exp_cmp);
-}
-
-
-void Parser::state_EXP_CMP(const Token & tok) {
-    this->do_exp_op(tok, {'<', '<=', '>', '>='}, &Parser::state_EXP_CMP_END, &Parser::enter_exp_a);
+S_Block *Parser::parse_block() {
+    auto _ = this->nest(this->peek());
+    S_Block *block = new S_Block();
+    Node::Ptr guard(block);
+    block->pos_start = this->next().pos_start;
+    while (this->peek().tokencode != TokenCode::RBRACE) {
+        block->stmts.emplace_back(this->parse_stmt());
+    }
+    block->pos_end = this->next().pos_end;
+    guard.release();
+    return block;
 }
 
 
-void Parser::state_EXP_CMP_END(const Token & tok) {
-    this->do_exp_op_end(tok, {'<', '<=', '>', '>='}, &Parser::enter_exp_a);
+S_Block *Parser::parse_block_pre() {
+    if (this->peek().tokencode != TokenCode::LBRACE) {
+        this->unpected_token(this->peek(), "expect {");
+    }
+    return this->parse_block();
 }
 
 
-void Parser::state_EXP_A(const Token & tok) {
-    this->do_exp_op(tok, {'+', '-'}, &Parser::state_EXP_A_END, &Parser::enter_exp_x);
+// an empty block with the positions of the braces, tokens between are dropped
+S_Block *Parser::parse_lazy_body() {
+    S_Block *block = new S_Block();
+    Node::Ptr guard(block);
+    block->pos_start = this->expect(TokenCode::LBRACE, "expect {").pos_start;
+    for (size_t depth = 1; depth > 0; ) {
+        const Token &tok = this->next();
+        if (tok.tokencode == TokenCode::LBRACE) {
+            depth++;
+        } else if (tok.tokencode == TokenCode::RBRACE) {
+            depth--;
+            block->pos_end = tok.pos_end;
+        } else if (tok.tokencode == TokenCode::END) {
+            this->unpected_token(tok, "expect }");
+        }
+        if (this->source != nullptr) {
+            // not kept while the whole body is skipped
+            this->drop_back();
+        }
+    }
+    guard.release();
+    return block;
 }
 
 
-void Parser::state_EXP_A_END(const Token & tok) {
-    this->do_exp_op_end(tok, {'+', '-'}, &Parser::enter_exp_x);
+Node *Parser::parse_return(const Token &start) {
+    S_Return *ret = new S_Return();
+    Node::Ptr guard(ret);
+    ret->pos_start = start.pos_start;
+    if (this->peek().tokencode != TokenCode::SEMICOLON) {
+        ret->value.reset(this->parse_exp());
+    }
+    ret->pos_end = this->expect(TokenCode::SEMICOLON, "expect semicolon").pos_end;
+    return guard.release();
 }
 
 
-void Parser::state_EXP_X(const Token & tok) {
-    this->do_exp_op(tok, {'*', '/', '%'}, &Parser::state_EXP_X_END, &Parser::enter_exp_not);
-}
+Node *Parser::parse_condition(const Token &start) {
+    auto _ = this->nest(start);
+    S_Condition *cond = new S_Condition();
+    Node::Ptr guard(cond);
+    cond->pos_start = start.pos_start;
 
+    this->expect(TokenCode::LPAR, "expect (");
+    cond->condition.reset(this->parse_exp());
+    this->expect(TokenCode::RPAR, "expect )");
+    cond->then_block.reset(this->parse_block_pre());
 
-void Parser::state_EXP_X_END(const Token & tok) {
-    this->do_exp_op_end(tok, {'*', '/', '%'}, &Parser::enter_exp_not);
+    if (this->accept(TokenCode::KW_ELSE)) {
+        const Token &tok = this->peek();
+        if (tok.tokencode == TokenCode::KW_IF) {
+            cond->else_block.reset(this->parse_condition(this->next()));
+        } else if (tok.tokencode == TokenCode::LBRACE) {
+            cond->else_block.reset(this->parse_block());
+        } else {
+            this->unpected_token(tok, "expect 'if' or block");
+        }
+        cond->pos_end = cond->else_block->pos_end;
+    } else {
+        cond->pos_end = cond->then_block->pos_end;
+    }
+    return guard.release();
 }
 
 
-void Parser::state_EXP_X_HEAD(const Token & tok) {
-    uint32_t tc = static_cast<uint32_t>(tok.tokencode);
-    if (tc == '+' || tc == '-') {
-        OpCode opcode = static_cast<OpCode>(tok.tokencode);
-        E_Op *exp = new E_Op(opcode);
-        this->nodes.emplace_back(exp);
-        this->set_pos_start(tok);
-        this->shift(&Parser::state_EXP_X_HEAD_END);
-        this->enter_exp_not();
+S_DeclareList *Parser::parse_decl_list(const Token &start) {
+    S_DeclareList *decls = new S_DeclareList();
+    Node::Ptr guard(decls);
+    decls->pos_start = start.pos_start;
+    do {
+        const Token &name = this->expect(TokenCode::ID, "expect identifier");
+        decls->decls.emplace_back(*name.text, Node::Ptr());
+        decls->pos_end = name.pos_end;
+        if (this->accept(TokenCode::ASSIGN)) {
+            Node::Ptr &initial = decls->decls.back().initial;
+            initial.reset(this->parse_exp_assign());
+            decls->pos_end = initial->pos_end;
+        }
+    } while (this->accept(TokenCode::COMMA));
+    guard.release();
+    return decls;
+}
+
+
+Node *Parser::parse_while(const Token &start) {
+    S_While *wh = new S_While();
+    Node::Ptr guard(wh);
+    wh->pos_start = start.pos_start;
+
+    this->expect(TokenCode::LPAR, "expect (");
+    wh->condition.reset(this->parse_exp());
+    this->expect(TokenCode::RPAR, "expect )");
+    wh->block.reset(this->parse_block_pre());
+    wh->pos_end = wh->block->pos_end;
+    return guard.release();
+}
+
+
+Node *Parser::parse_for(const Token &start) {
+    S_For *loop = new S_For();
+    Node::Ptr guard(loop);
+    loop->pos_start = start.pos_start;
+
+    this->expect(TokenCode::LPAR, "expect (");
+    this->expect(TokenCode::KW_LET, "expect 'let'");
+    const Token &name = this->expect(TokenCode::ID, "expect identifier");
+    S_DeclareList *var = new S_DeclareList();
+    loop->var.reset(var);
+    var->decls.emplace_back(*name.text, Node::Ptr());
+    var->pos_start = name.pos_start;
+    var->pos_end = name.pos_end;
+
+    if (this->accept(TokenCode::KW_IN)) {
+        loop->iterable.reset(this->parse_exp());
+        this->expect(TokenCode::RPAR, "expect )");
+    } else if (this->accept(TokenCode::ASSIGN)) {
+        // start, stop[, step]
+        loop->start.reset(this->parse_exp_assign());
+        while (true) {
+            const Token &tok = this->peek();
+            if (tok.tokencode == TokenCode::COMMA && !loop->step) {
+                this->next();
+                Node::Ptr &slot = loop->stop ? loop->step : loop->stop;
+                slot.reset(this->parse_exp_assign());
+            } else if (tok.tokencode == TokenCode::RPAR && loop->stop) {
+                this->next();
+                break;
+            } else if (!loop->stop) {
+                this->unpected_token(tok, "expect comma");
+            } else if (!loop->step) {
+                this->unpected_token(tok, "expect comma or )");
+            } else {
+                this->unpected_token(tok, "expect )");
+            }
+        }
     } else {
-        this->leave();
-        this->enter_exp_not();
-        this->feed(tok);
+        this->unpected_token(this->peek(), "expect 'in' or =");
     }
-}
-
 
-void Parser::state_EXP_X_HEAD_END(const Token & tok) {
-    this->grow_body();
-    this->pass_up(tok);
+    loop->block.reset(this->parse_block_pre());
+    loop->pos_end = loop->block->pos_end;
+    return guard.release();
 }
 
 
-void Parser::state_EXP_NOT(const Token & tok) {
-    if (tok.tokencode == TokenCode::NOT) {
-        this->nodes.emplace_back(new E_Op(OpCode::NOT));
-        this->set_pos_start(tok);
-        this->shift(&Parser::state_EXP_NOT_END);
-        this->enter_exp_call_or_subs();
-    } else {
-        this->leave();
-        this->enter_exp_call_or_subs();
-        this->feed(tok);
+// comma operator, unwrapped if there is only one operand
+Node *Parser::parse_exp() {
+    Node::Ptr list(this->parse_exp_list_abs());
+    std::vector<Node::Ptr> &args = static_cast<E_Op &>(*list).args;
+    if (args.size() == 1) {
+        return args.front().release();
     }
+    return list.release();
 }
 
 
-void Parser::state_EXP_NOT_END(const Token & tok) {
-    this->grow_body();
-    this->pass_up(tok);
+// always a comma operator, for arguments and list items
+E_Op *Parser::parse_exp_list_abs() {
+    E_Op *list = new E_Op(OpCode::EXPLIST);
+    Node::Ptr guard(list);
+    do {
+        list->args.emplace_back(this->parse_exp_assign());
+    } while (this->accept(TokenCode::COMMA));
+    list->pos_start = list->args.front()->pos_start;
+    list->pos_end = list->args.back()->pos_end;
+    guard.release();
+    return list;
 }
 
 
-void Parser::state_EXP_CALL_OR_SUBS(const Token & tok) {
-    if (tok.tokencode == TokenCode::LSQUARE) {
-        this->grow_head(OpCode::SUBSCRIPT);
-        this->shift(&Parser::state_EXP_SUBS_RSQ);
-        this->enter_exp();
-    } else if (tok.tokencode == TokenCode::LPAR) {
-        this->grow_head(OpCode::CALL);
-        this->shift(&Parser::state_EXP_CALL_AFTER_LPAR);
-    } else {
-        this->pass_up(tok);
+static bool is_assign_op(TokenCode tc) {
+    switch (tc) {
+    case TokenCode::ASSIGN:
+    case TokenCode::PLUS_ASSIGN:
+    case TokenCode::MINUS_ASSIGN:
+    case TokenCode::SLASH_ASSIGN:
+    case TokenCode::PERCENT_ASSIGN:
+        return true;
+    default:
+        return false;
     }
 }
 
 
-void Parser::state_EXP_SUBS_RSQ(const Token & tok) {
-    if (tok.tokencode == TokenCode::RSQUARE) {
-        this->grow_body();
-        this->set_pos_end(tok);
-        this->shift(&Parser::state_EXP_CALL_OR_SUBS);
-    } else {
-        this->unpected_token(tok, "expect ]");
+// right associative
+Node *Parser::parse_exp_assign() {
+    auto _ = this->nest(this->peek());
+    Node::Ptr lhs(this->parse_binary(0));
+    const Token &tok = this->peek();
+    if (!is_assign_op(tok.tokencode)) {
+        return lhs.release();
     }
-}
 
+    bool assignable = lhs->kind == NodeKind::E_VAR || (
+        lhs->kind == NodeKind::E_OP
+        && static_cast<E_Op &>(*lhs).op_code == OpCode::SUBSCRIPT
+    );
+    if (!assignable) {
+        this->unpected_token(tok, "can not assign to expression");
+    }
+    this->next();
+
+    E_Op *exp = new E_Op(static_cast<OpCode>(tok.tokencode));
+    Node::Ptr guard(exp);
+    exp->pos_start = lhs->pos_start;
+    exp->args.push_back(std::move(lhs));
+    exp->args.emplace_back(this->parse_exp_assign());
+    exp->pos_end = exp->args.back()->pos_end;
+    return guard.release();
+}
+
+
+// binding power of binary operators, from the loosest
+enum BinaryLevel {
+    LEVEL_OR,
+    LEVEL_AND,
+    LEVEL_EQ,
+    LEVEL_CMP,
+    LEVEL_A,
+    LEVEL_X,
+    LEVEL_NONE,
+};
 
-void Parser::state_EXP_CALL_AFTER_LPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::RPAR) {
-        // add an empty argument list
-        E_Op *call = this->get_top1<E_Op>();
-        assert(call->op_code == OpCode::CALL);
-        assert(call->args.size() == 1);
-        call->args.emplace_back(new E_Op(OpCode::EXPLIST));
 
-        this->set_pos_end(tok);
-        this->shift(&Parser::state_EXP_CALL_OR_SUBS);
-    } else {
-        this->shift(&Parser::state_EXP_CALL_RPAR);
-        this->enter_exp_list_abs();
-        this->feed(tok);
+static int binary_level(TokenCode tc) {
+    switch (tc) {
+    case TokenCode::OR:
+        return LEVEL_OR;
+    case TokenCode::AND:
+        return LEVEL_AND;
+    case TokenCode::EQ:
+    case TokenCode::NEQ:
+        return LEVEL_EQ;
+    case TokenCode::LESS:
+    case TokenCode::LESSEQ:
+    case TokenCode::GREAT:
+    case TokenCode::GREATEQ:
+        return LEVEL_CMP;
+    case TokenCode::PLUS:
+    case TokenCode::MINUS:
+        return LEVEL_A;
+    case TokenCode::STAR:
+    case TokenCode::SLASH:
+    case TokenCode::PERCENT:
+        return LEVEL_X;
+    default:
+        return LEVEL_NONE;
+    }
+}
+
+
+// Left associative binary operators binding at least min_level. A unary sign only heads the first
+// operand of a * / % chain, as in -a * -b being an error.
+Node *Parser::parse_binary(int min_level) {
+    if (min_level > LEVEL_X) {
+        return this->parse_exp_not();
+    }
+
+    Node::Ptr lhs(this->parse_exp_x_head());
+    while (true) {
+        int level = binary_level(this->peek().tokencode);
+        if (level == LEVEL_NONE || level < min_level) {
+            return lhs.release();
+        }
+        E_Op *exp = new E_Op(static_cast<OpCode>(this->next().tokencode));
+        exp->pos_start = lhs->pos_start;
+        exp->args.push_back(std::move(lhs));
+        lhs.reset(exp);
+        exp->args.emplace_back(this->parse_binary(level + 1));
+        exp->pos_end = exp->args.back()->pos_end;
     }
 }
 
 
-void Parser::state_EXP_CALL_RPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::RPAR) {
-        this->grow_body();
-        this->set_pos_end(tok);
-        this->shift(&Parser::state_EXP_CALL_OR_SUBS);
-    } else {
-        this->unpected_token(tok, "expect )");
+Node *Parser::parse_exp_x_head() {
+    const Token &tok = this->peek();
+    if (tok.tokencode != TokenCode::PLUS && tok.tokencode != TokenCode::MINUS) {
+        return this->parse_exp_not();
     }
-}
 
-
-void Parser::state_EXP_T(const Token & tok) {
-    if (tok.tokencode == TokenCode::LPAR) {
-        this->shift(&Parser::state_EXP_T_RPAR);
-        this->enter_exp();
-    } else if (tok.tokencode == TokenCode::INT) {
-        this->do_const<TokenInt, E_Int>(tok);
-    } else if (tok.tokencode == TokenCode::FLOAT) {
-        this->do_const<TokenFloat, E_Float>(tok);
-    } else if (tok.tokencode == TokenCode::STRING) {
-        this->do_const<TokenString, E_String>(tok);
-    } else if (tok.tokencode == TokenCode::LSQUARE) {
-        this->leave();
-        this->enter_list(tok);
-    } else if (match_id(tok, USTRING("function"))) {
-        this->leave();
-        this->enter_function(tok);
-    } else if (match_id(tok, USTRING("null"))) {
-        this->nodes.emplace_back(new E_Null());
-        this->set_pos_start_end(tok);
-        this->leave();
-    } else if (match_id(tok, USTRING("true"))) {
-        this->nodes.emplace_back(new E_Bool(true));
-        this->set_pos_start_end(tok);
-        this->leave();
-    } else if (match_id(tok, USTRING("false"))) {
-        this->nodes.emplace_back(new E_Bool(false));
-        this->set_pos_start_end(tok);
-        this->leave();
-    } else if (tok.tokencode == TokenCode::ID) {
-        // FIXME: check reserved word
-        this->do_const<TokenId, E_Var>(tok);
-    } else {
-        this->unpected_token(tok, "expect terminal");
-    }
+    E_Op *exp = new E_Op(static_cast<OpCode>(tok.tokencode));
+    Node::Ptr guard(exp);
+    exp->pos_start = this->next().pos_start;
+    exp->args.emplace_back(this->parse_exp_not());
+    exp->pos_end = exp->args.back()->pos_end;
+    return guard.release();
 }
 
 
-void Parser::state_EXP_T_RPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::RPAR) {
-        this->leave();
-    } else {
-        this->unpected_token(tok, "expect )");
+Node *Parser::parse_exp_not() {
+    if (this->peek().tokencode != TokenCode::NOT) {
+        return this->parse_exp_call_or_subs();
     }
-}
-
 
-void Parser::state_LIST(const Token & tok) {
-    if (tok.tokencode == TokenCode::RSQUARE) {
-        this->set_pos_end(tok);
-        this->leave();
-    } else {
-        this->shift(&Parser::state_LIST_END);
-        this->enter_exp_list_abs();
-        this->feed(tok);
-    }
+    E_Op *exp = new E_Op(OpCode::NOT);
+    Node::Ptr guard(exp);
+    exp->pos_start = this->next().pos_start;
+    exp->args.emplace_back(this->parse_exp_call_or_subs());
+    exp->pos_end = exp->args.back()->pos_end;
+    return guard.release();
 }
 
 
-void Parser::state_LIST_END(const Token & tok) {
-    if (tok.tokencode == TokenCode::RSQUARE) {
-        E_List *list = this->get_top2<E_List>();
-        E_Op *args = this->get_top1<E_Op>();
-        assert(args->op_code == OpCode::EXPLIST);
-        for (Node::Ptr &item : args->args) {
-            list->value.emplace_back(item.release());
+Node *Parser::parse_exp_call_or_subs() {
+    Node::Ptr value(this->parse_exp_t());
+    while (true) {
+        TokenCode tc = this->peek().tokencode;
+        if (tc != TokenCode::LSQUARE && tc != TokenCode::LPAR) {
+            return value.release();
+        }
+        this->next();
+
+        E_Op *exp = new E_Op(tc == TokenCode::LSQUARE ? OpCode::SUBSCRIPT : OpCode::CALL);
+        exp->pos_start = value->pos_start;
+        exp->args.push_back(std::move(value));
+        value.reset(exp);
+
+        if (tc == TokenCode::LSQUARE) {
+            exp->args.emplace_back(this->parse_exp());
+            exp->pos_end = this->expect(TokenCode::RSQUARE, "expect ]").pos_end;
+        } else if (this->peek().tokencode == TokenCode::RPAR) {
+            // add an empty argument list
+            exp->args.emplace_back(new E_Op(OpCode::EXPLIST));
+            exp->pos_end = this->next().pos_end;
+        } else {
+            exp->args.emplace_back(this->parse_exp_list_abs());
+            exp->pos_end = this->expect(TokenCode::RPAR, "expect )").pos_end;
         }
-        this->nodes.pop_back();
-        this->set_pos_end(tok);
-        this->leave();
-    } else {
-        this->unpected_token(tok, "expect ]");
     }
 }
 
 
-void Parser::state_FUNC(const Token & tok) {
-    if (tok.tokencode == TokenCode::LPAR) {
-        this->shift(&Parser::state_FUNC_AFTER_LPAR);
-    } else {
-        this->unpected_token(tok, "expect (");
+Node *Parser::parse_exp_t() {
+    const Token &tok = this->next();
+    Node *value;
+    switch (tok.tokencode) {
+    case TokenCode::LPAR: {
+        Node::Ptr exp(this->parse_exp());
+        this->expect(TokenCode::RPAR, "expect )");
+        return exp.release();
+    }
+    case TokenCode::INT:
+        value = new E_Int(tok.int_value);
+        break;
+    case TokenCode::FLOAT:
+        value = new E_Float(tok.float_value);
+        break;
+    case TokenCode::STRING:
+        value = new E_String(*tok.text);
+        break;
+    case TokenCode::LSQUARE:
+        return this->parse_list(tok);
+    case TokenCode::KW_FUNCTION:
+        return this->parse_function(tok);
+    case TokenCode::KW_NULL:
+        value = new E_Null();
+        break;
+    case TokenCode::KW_TRUE:
+    case TokenCode::KW_FALSE:
+        value = new E_Bool(tok.tokencode == TokenCode::KW_TRUE);
+        break;
+    case TokenCode::ID:
+        // keywords are not ID
+        value = new E_Var(*tok.text);
+        break;
+    default:
+        this->unpected_token(tok, "expect terminal");
     }
+    value->pos_start = tok.pos_start;
+    value->pos_end = tok.pos_end;
+    return value;
 }
 
 
-void Parser::state_FUNC_AFTER_LPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::RPAR) {
-        this->shift(&Parser::state_FUNC_END);
-        this->enter_block_pre();
-    } else {
-        this->shift(&Parser::state_FUNC_RPAR);
-        this->enter_arg_decl_list(tok);
-        this->feed(tok);
+Node *Parser::parse_list(const Token &start) {
+    E_List *list = new E_List();
+    Node::Ptr guard(list);
+    list->pos_start = start.pos_start;
+    if (this->peek().tokencode != TokenCode::RSQUARE) {
+        Node::Ptr items(this->parse_exp_list_abs());
+        for (Node::Ptr &item : static_cast<E_Op &>(*items).args) {
+            list->value.push_back(std::move(item));
+        }
     }
+    list->pos_end = this->expect(TokenCode::RSQUARE, "expect ]").pos_end;
+    return guard.release();
 }
 
 
-void Parser::state_FUNC_RPAR(const Token & tok) {
-    if (tok.tokencode == TokenCode::RPAR) {
+Node *Parser::parse_function(const Token &start) {
+    E_Func *func = new E_Func();
+    Node::Ptr guard(func);
+    func->pos_start = start.pos_start;
+
+    this->expect(TokenCode::LPAR, "expect (");
+    if (!this->accept(TokenCode::RPAR)) {
         // FIXME: check the position of default values
-        E_Func *func = this->get_top2<E_Func>();
-        func->args.reset(this->pop_top());
-        this->shift(&Parser::state_FUNC_END);
-        this->enter_block_pre();
-    } else {
-        this->unpected_token(tok, "expect )");
+        func->args.reset(this->parse_decl_list(this->peek()));
+        this->expect(TokenCode::RPAR, "expect )");
     }
-}
-
-
-void Parser::state_FUNC_END(const Token & tok) {
-    E_Func *func = this->get_top2<E_Func>();
-    func->block.reset(this->pop_top());
-    this->set_pos_end(*func->block);
-    this->pass_up(tok);
-}
-
-
-void Parser::grow_head(OpCode opcode) {
-    E_Op *head = new E_Op(opcode);
-    head->args.emplace_back(this->pop_top());
-    this->nodes.emplace_back(head);
-    this->set_pos_start(*head->args.front());
-}
 
-
-void Parser::grow_body() {
-    E_Op *exp = this->get_top2<E_Op>();
-    exp->args.emplace_back(this->pop_top());
-    this->set_pos_end(*exp->args.back());
-}
-
-
-void Parser::do_exp_op(
-    const Token &tok, const std::vector<uint32_t> &accepts,
-    Parser::StateHandler next, Parser::MemFunc next_enter)
-{
-    uint32_t code = static_cast<uint32_t>(tok.tokencode);
-    if (std::find(accepts.begin(), accepts.end(), code) != accepts.end()) {
-        OpCode opcode = static_cast<OpCode>(tok.tokencode);
-        this->grow_head(opcode);
-        this->shift(next);
-        (this->*next_enter)();
+    if (this->lazy_source != nullptr) {
+        func->block.reset(this->parse_lazy_body());
     } else {
-        this->pass_up(tok);
+        func->block.reset(this->parse_block_pre());
     }
+    func->attr.lazy_source = this->lazy_source;
+    func->pos_end = func->block->pos_end;
+    return guard.release();
 }
 
 
-void Parser::do_exp_op_end(
-    const Token &tok, const std::vector<uint32_t> &accepts, Parser::MemFunc next_enter)
-{
-    E_Op *exp_op = this->get_top2<E_Op>();
-    exp_op->args.emplace_back(this->pop_top());
-
-    uint32_t code = static_cast<uint32_t>(tok.tokencode);
-    if (std::find(accepts.begin(), accepts.end(), code) != accepts.end()) {
-        OpCode opcode = static_cast<OpCode>(tok.tokencode);
-        this->grow_head(opcode);
-        (this->*next_enter)();
-    } else {
-        this->set_pos_end(*exp_op->args.back());
-        this->pass_up(tok);
+bool Parser::accept(TokenCode tc) {
+    if (this->peek().tokencode == tc) {
+        this->cur++;
+        return true;
     }
+    return false;
 }
 
 
-template<class TokenType, class NodeType>
-void Parser::do_const(const Token &tok) {
-    const TokenType &tokcast = static_cast<const TokenType &>(tok);
-    this->nodes.emplace_back(new NodeType(tokcast.value));
-    this->set_pos_start_end(tok);
-    this->leave();
-}
-
-
-void Parser::enter_program_or_exp() {
-    this->nodes.emplace_back(new Program());
-    this->states.push_back(&Parser::state_PROGRAM_OR_EXP);
-    this->enter_stmt();
-}
-
-
-void Parser::enter_program() {
-    this->nodes.emplace_back(new Program());
-    this->states.push_back(&Parser::state_PROGRAM);
-    this->enter_stmt();
-}
-
-
-void Parser::enter_stmt() {
-    this->states.push_back(&Parser::state_STMT);
-}
-
-
-void Parser::enter_block(const Token &tok) {
-    this->nodes.emplace_back(new S_Block());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_BLOCK);
-}
-
-
-void Parser::enter_block_pre() {
-    this->states.push_back(&Parser::state_BLOCK_PRE);
-}
-
-
-void Parser::enter_return(const Token &tok) {
-    this->nodes.emplace_back(new S_Return());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_RETURN);
-}
-
-
-void Parser::enter_condition(const Token &tok) {
-    this->nodes.emplace_back(new S_Condition());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_COND_LPAR);
-}
-
-
-void Parser::enter_else() {
-    this->states.push_back(&Parser::state_ELSE);
-}
-
-
-void Parser::enter_continue(const Token &tok) {
-    this->nodes.emplace_back(new S_Continue());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_CONTINUE);
-}
-
-
-void Parser::enter_break(const Token &tok) {
-    this->nodes.emplace_back(new S_Break());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_BREAK);
-}
-
-
-void Parser::enter_var_decl(const Token &tok) {
-    this->states.push_back(&Parser::state_VAR_DECL);
-    this->enter_var_decl_list(tok);
-}
-
-
-void Parser::enter_var_decl_list(const Token &tok) {
-    this->nodes.emplace_back(new S_DeclareList());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_VAR_DECL_LIST);
-    this->enter_var_decl_item();
-}
-
-
-void Parser::enter_var_decl_item() {
-    this->states.push_back(&Parser::state_VAR_DECL_ITEM);
-}
-
-
-void Parser::enter_while(const Token &tok) {
-    this->nodes.emplace_back(new S_While());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_WHILE_LPAR);
-}
-
-
-void Parser::enter_exp() {
-    this->enter_exp_list();
-}
-
-
-void Parser::enter_exp_list() {
-    this->nodes.emplace_back(new E_Op(OpCode::EXPLIST));
-    this->states.push_back(&Parser::state_EXP_LIST);
-    this->enter_exp_assign();
-}
-
-
-void Parser::enter_exp_list_abs() {
-    this->nodes.emplace_back(new E_Op(OpCode::EXPLIST));
-    this->states.push_back(&Parser::state_EXP_LIST_ABS);
-    this->enter_exp_assign();
-}
-
-
-void Parser::enter_exp_assign() {
-    this->states.push_back(&Parser::state_EXP_ASSIGN);
-    this->enter_exp_or();
-}
-
-
-void Parser::enter_exp_or() {
-    this->states.push_back(&Parser::state_EXP_OR);
-    this->enter_exp_and();
-}
-
-
-void Parser::enter_exp_and() {
-    this->states.push_back(&Parser::state_EXP_AND);
-    this->enter_exp_eq();
-}
-
-
-void Parser::enter_exp_eq() {
-    this->states.push_back(&Parser::state_EXP_EQ);
-    this->enter_exp_cmp();
-}
-
-
-void Parser::enter_exp_cmp() {
-    this->states.push_back(&Parser::state_EXP_CMP);
-    this->enter_exp_a();
-}
-
-
-void Parser::enter_exp_a() {
-    this->states.push_back(&Parser::state_EXP_A);
-    this->enter_exp_x();
-}
-
-
-void Parser::enter_exp_x() {
-    this->states.push_back(&Parser::state_EXP_X);
-    this->enter_exp_x_head();
-}
-
-
-void Parser::enter_exp_x_head() {
-    this->states.push_back(&Parser::state_EXP_X_HEAD);
-}
-
-
-void Parser::enter_exp_not() {
-    this->states.push_back(&Parser::state_EXP_NOT);
-}
-
-
-void Parser::enter_exp_call_or_subs() {
-    this->states.push_back(&Parser::state_EXP_CALL_OR_SUBS);
-    this->enter_exp_t();
-}
-
-
-void Parser::enter_exp_t() {
-    this->states.push_back(&Parser::state_EXP_T);
-}
-
-
-void Parser::enter_list(const Token &tok) {
-    this->nodes.emplace_back(new E_List());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_LIST);
-}
-
-
-void Parser::enter_function(const Token &tok) {
-    this->nodes.emplace_back(new E_Func());
-    this->set_pos_start(tok);
-    this->states.push_back(&Parser::state_FUNC);
-}
-
-
-void Parser::enter_arg_decl_list(const Token &tok) {
-    this->enter_var_decl_list(tok);
-}
-
-
-void Parser::set_pos_start(const Token &tok) {
-    assert(!this->nodes.empty());
-    this->nodes.back()->pos_start = tok.pos_start;
-}
-
-
-void Parser::set_pos_start(const Node &node) {
-    assert(!this->nodes.empty());
-    this->nodes.back()->pos_start = node.pos_start;
-}
-
-
-void Parser::set_pos_end(const Token &tok) {
-    assert(!this->nodes.empty());
-    this->nodes.back()->pos_end = tok.pos_end;
+const Token &Parser::expect(TokenCode tc, const char *addtional) {
+    const Token &tok = this->peek();
+    if (tok.tokencode != tc) {
+        this->unpected_token(tok, addtional);
+    }
+    this->cur++;
+    return tok;
 }
 
 
-void Parser::set_pos_end(const Node &node) {
-    assert(!this->nodes.empty());
-    this->nodes.back()->pos_end = node.pos_end;
+// bounds the recursion on nested blocks and expressions
+ReplaceRestore<size_t> Parser::nest(const Token &tok) {
+    if (this->depth >= MAX_NESTING) {
+        throw ParserError("Too deeply nested", tok.pos_start, tok.pos_end);
+    }
+    return ReplaceRestore<size_t>(&this->depth, this->depth + 1);
 }
 
 
-void Parser::set_pos_start_end(const Token &tok) {
-    this->set_pos_start(tok);
-    this->set_pos_end(tok);
+void Parser::unpected_token(const Token &tok, const std::string &addtional) {
+    if (tok.tokencode == TokenCode::END && this->mode != Mode::NONE && !this->ended) {
+        // may be continued by more tokens
+        throw Incomplete();
+    }
+    std::string msg = "Unexpected token " + tok.repr_short();
+    if (!addtional.empty()) {
+        msg += " " + addtional;
+    }
+    throw ParserError(msg, tok.pos_start, tok.pos_end);
 }
 
 
-template<class NodeType>
-NodeType *Parser::get_top1() {
-    assert(!this->nodes.empty());
-    return static_cast<NodeType *>(this->nodes.back().get());
-}
+void parse_lazy_body(const E_Func &func) {
+    const SourceText &source = *func.attr.lazy_source;
+    S_Block &body = static_cast<S_Block &>(*func.block);
+    assert(body.stmts.empty());
+    size_t begin = source.byte_offset(body.pos_start);
+    size_t end = source.byte_offset(body.pos_end) + 1;     // the closing brace
 
-template<class NodeType>
-NodeType *Parser::get_top2() {
-    assert(this->nodes.size() >= 2);
-    return static_cast<NodeType *>((++this->nodes.rbegin())->get());
-}
+    Parser parser;
+    parser.set_lazy_source(&source);
 
-template<class NodeType>
-NodeType *Parser::pop_top() {
-    NodeType *top = this->nodes.back().release();
-    this->nodes.pop_back();
-    return top;
+    Tokenizer tokenizer;
+    tokenizer.start_at(body.pos_start);
+    bool fed = false;
+    auto refill = [&]() {
+        if (fed) {
+            return false;
+        }
+        tokenizer.feed(source.data() + begin, end - begin);
+        tokenizer.feed("\n", 1);
+        fed = true;
+        return true;
+    };
+
+    // the braces are parsed as the only statement of a program
+    Node::Ptr prog = parser.parse_program(tokenizer, refill);
+    S_Block &parsed = static_cast<S_Block &>(*static_cast<Program &>(*prog).stmts.at(0));
+    body.stmts = std::move(parsed.stmts);
+    func.attr.lazy_source = nullptr;
 }
@@ -1,165 +1,122 @@
 #ifndef JIAOBENSCRIPT_PARSER_H
 #define JIAOBENSCRIPT_PARSER_H
 
-#include <initializer_list>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
 #include <vector>
 
 #include "exceptions.h"
 #include "tokenizer.h"
 #include "node.h"
+#include "replace_restore.hpp"
 
 
+// Recursive descent parser, expressions by precedence climbing. Tokens are buffered by feed(),
+// can_end() tries to parse them, so an incomplete input can be continued by the repl. Open
+// brackets are tracked by feed(), can_end() does not parse until they are closed. A whole
+// program is parsed by parse_program() instead, which pulls the tokens as they are needed.
 class Parser {
 public:
     void start_program();
     void start_repl();
     bool is_empty() const;
-    bool can_end() const;
+    // comments are not kept
+    bool has_tokens() const;
+    // false if more tokens are needed, throws ParserError if the tokens can not be completed
+    bool can_end();
     void feed(const Token &tok);
+    // the tokens ready in tokenizer, their texts are swapped out instead of copied
+    void feed(Tokenizer &tokenizer);
     Node::Ptr pop_result();
+    // Parses the tokens of tokenizer, which is fed by refill() until it returns false. The tokens
+    // are dropped after each top level statement, so the program is never buffered whole.
+    Node::Ptr parse_program(Tokenizer &tokenizer, const std::function<bool ()> &refill);
+    // the lazy source is kept
     void reset();
+    // function bodies are only matched by braces, and parsed from source by parse_lazy_body()
+    void set_lazy_source(const SourceText *source);
 
 private:
-    typedef void (Parser::* StateHandler)(const Token &);
-    void state_END(const Token &tok);
-    void state_PROGRAM_OR_EXP(const Token &tok);
-    void state_PROGRAM(const Token &tok);
-    void state_STMT(const Token &tok);
-    void state_STMT_EXP(const Token &tok);
-    void state_BLOCK_PRE(const Token &tok);
-    void state_BLOCK(const Token &tok);
-    void state_BLOCK_END(const Token &tok);
-    void state_RETURN(const Token &tok);
-    void state_RETURN_EXP(const Token &tok);
-    void state_COND_LPAR(const Token &tok);
-    void state_COND_RPAR(const Token &tok);
-    void state_COND_ELSE(const Token &tok);
-    void state_COND_END(const Token &tok);
-    void state_ELSE(const Token &tok);
-    void state_CONTINUE(const Token &tok);
-    void state_BREAK(const Token &tok);
-    void state_VAR_DECL(const Token &tok);
-    void state_VAR_DECL_LIST(const Token &tok);
-    void state_VAR_DECL_ITEM(const Token &tok);
-    void state_VAR_DECL_ITEM_END(const Token &tok);
-    void state_VAR_DECL_ITEM_INIT(const Token &tok);
-    void state_WHILE_LPAR(const Token &tok);
-    void state_WHILE_RPAR(const Token &tok);
-    void state_WHILE_END(const Token &tok);
-    void state_EXP_LIST(const Token &tok);
-    void state_EXP_LIST_ABS(const Token &tok);
-    void state_EXP_ASSIGN(const Token &tok);
-    void state_EXP_ASSIGN_END(const Token &tok);
-    void state_EXP_OR(const Token &tok);
-    void state_EXP_OR_END(const Token &tok);
-    void state_EXP_AND(const Token &tok);
-    void state_EXP_AND_END(const Token &tok);
-    void state_EXP_EQ(const Token &tok);
-    void state_EXP_EQ_END(const Token &tok);
-    void state_EXP_CMP(const Token &tok);
-    void state_EXP_CMP_END(const Token &tok);
-    void state_EXP_A(const Token &tok);
-    void state_EXP_A_END(const Token &tok);
-    void state_EXP_X(const Token &tok);
-    void state_EXP_X_END(const Token &tok);
-    void state_EXP_X_HEAD(const Token &tok);
-    void state_EXP_X_HEAD_END(const Token &tok);
-    void state_EXP_NOT(const Token &tok);
-    void state_EXP_NOT_END(const Token &tok);
-    void state_EXP_CALL_OR_SUBS(const Token &tok);
-    void state_EXP_SUBS_RSQ(const Token &tok);
-    void state_EXP_CALL_AFTER_LPAR(const Token &tok);
-    void state_EXP_CALL_RPAR(const Token &tok);
-    void state_EXP_T(const Token &tok);
-    void state_EXP_T_RPAR(const Token &tok);
-    void state_LIST(const Token &tok);
-    void state_LIST_END(const Token &tok);
-    void state_FUNC(const Token &tok);
-    void state_FUNC_AFTER_LPAR(const Token &tok);
-    void state_FUNC_RPAR(const Token &tok);
-    void state_FUNC_END(const Token &tok);
-
-    void enter_program_or_exp();
-    void enter_program();
-    void enter_stmt();
-    void enter_block(const Token &tok);
-    void enter_block_pre();
-    void enter_return(const Token &tok);
-    void enter_condition(const Token &tok);
-    void enter_else();
-    void enter_continue(const Token &tok);
-    void enter_break(const Token &tok);
-    void enter_var_decl(const Token &tok);
-    void enter_var_decl_list(const Token &tok);
-    void enter_var_decl_item();
-    void enter_while(const Token &tok);
-    void enter_exp();
-    void enter_exp_list();
-    void enter_exp_list_abs();
-    void enter_exp_assign();
-    void enter_exp_or();
-    void enter_exp_and();
-    void enter_exp_eq();
-    void enter_exp_cmp();
-    void enter_exp_a();
-    void enter_exp_x();
-    void enter_exp_x_head();
-    void enter_exp_not();
-    void enter_exp_call_or_subs();
-    void enter_exp_t();
-    void enter_list(const Token &tok);
-    void enter_function(const Token &tok);
-    void enter_arg_decl_list(const Token &tok);
-
-    void leave();
-    void pass_up(const Token &tok);
-    void shift(StateHandler state);
-    void grow_head(OpCode opcode);
-    void grow_body();
-
-    typedef void (Parser::* MemFunc)();
-    void do_exp_op(
-        const Token &tok, const std::vector<uint32_t> &accepts,
-        Parser::StateHandler next, MemFunc next_enter);
-    void do_exp_op_end(
-        const Token &tok, const std::vector<uint32_t> &accepts,
-        MemFunc next_enter);
-    void do_stmt_comma(const Token &tok);
-
-    template<class TokenType, class NodeType>
-    void do_const(const Token &tok);
-
-    template<class NodeType>
-    NodeType *get_top1();
-
-    template<class NodeType>
-    NodeType *get_top2();
-
-    template<class NodeType = Node>
-    NodeType *pop_top();
-
-    void unpected_token(const Token &tok, const std::string &addtional = "");
-
-    void set_pos_start(const Token &tok);
-    void set_pos_start(const Node &node);
-    void set_pos_end(const Token &tok);
-    void set_pos_end(const Node &node);
-    void set_pos_start_end(const Token &tok);
-
-    static bool match_id(const Token &tok, const ustring &id);
-
-    struct SortedState {
-        SortedState(std::initializer_list<StateHandler> states);
-        bool contains(const StateHandler &state) const;
-        static bool cmp(const StateHandler &lhs, const StateHandler &rhs);
-
-        std::vector<StateHandler> states;
+    enum class Mode {
+        NONE,
+        PROGRAM,
+        REPL,       // a single expression without semicolon is the result
     };
 
-    static SortedState terminating_states;
-    std::vector<StateHandler> states;
-    std::vector<Node::Ptr> nodes;
+    // the tokens end in the middle of a construct
+    struct Incomplete {};
+
+    void restart(Mode mode);
+    void track_bracket(TokenCode tc);
+    const Token *take(Tokenizer &tokenizer);
+    void pull();
+    void drop_front(size_t count);
+    void drop_back();
+    void recycle(ustring &text);
+    bool parse();
+    Node::Ptr parse_top();
+
+    Node *parse_stmt(Node::Ptr *bare_exp = nullptr);
+    S_Block *parse_block();
+    S_Block *parse_block_pre();
+    S_Block *parse_lazy_body();
+    Node *parse_return(const Token &start);
+    Node *parse_condition(const Token &start);
+    S_DeclareList *parse_decl_list(const Token &start);
+    Node *parse_while(const Token &start);
+    Node *parse_for(const Token &start);
+
+    Node *parse_exp();
+    E_Op *parse_exp_list_abs();
+    Node *parse_exp_assign();
+    Node *parse_binary(int min_level);
+    Node *parse_exp_x_head();
+    Node *parse_exp_not();
+    Node *parse_exp_call_or_subs();
+    Node *parse_exp_t();
+    Node *parse_list(const Token &start);
+    Node *parse_function(const Token &start);
+
+    const Token &peek() {
+        if (this->cur == this->tokens.size()) {
+            this->pull();
+        }
+        return this->tokens[this->cur];
+    }
+    const Token &next() {
+        const Token &tok = this->peek();
+        this->cur++;
+        return tok;
+    }
+    bool accept(TokenCode tc);
+    const Token &expect(TokenCode tc, const char *addtional);
+    ReplaceRestore<size_t> nest(const Token &tok);
+
+    [[noreturn]] void unpected_token(const Token &tok, const std::string &addtional = "");
+
+    static const size_t MAX_NESTING = 1000;
+
+    Mode mode = Mode::NONE;
+    // fed or pulled so far, END is appended while parsing, references are kept by push_back()
+    std::deque<Token> tokens;
+    std::deque<ustring> texts;      // referred by text tokens
+    std::vector<ustring> spare_texts;   // cleared, swapped into the tokenizer for their capacity
+    Tokenizer *source = nullptr;    // by parse_program()
+    const std::function<bool ()> *refill = nullptr;
+    std::vector<TokenCode> open_brackets;
+    bool unbalanced = false;        // a closing bracket does not match, left to parse()
+    bool ended = false;             // END is fed, a construct left open is an error
+    size_t cur = 0;
+    size_t depth = 0;
+    Node::Ptr result;               // by can_end(), until more tokens are fed
+    const SourceText *lazy_source = nullptr;
 };
 
 
+// parses the body of a function skipped by a lazy parser, nested functions are skipped too
+void parse_lazy_body(const E_Func &func);
+
+
 #endif //JIAOBENSCRIPT_PARSER_H
@@ -0,0 +1,85 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+
+#include "phase_timer.h"
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// of the threads that have exited, in clock ticks
+std::atomic<Clock::rep> exited_totals[static_cast<int>(Phase::COUNT)];
+
+struct ThreadTimes {
+    // merged when the thread exits, so the totals of joined threads are reported
+    ~ThreadTimes() {
+        for (int i = 0; i < static_cast<int>(Phase::COUNT); ++i) {
+            exited_totals[i] += this->totals[i].count();
+        }
+    }
+
+    Clock::duration totals[static_cast<int>(Phase::COUNT)] {};
+    Clock::time_point since;
+    Phase current = Phase::COUNT;   // none
+};
+
+thread_local ThreadTimes thread_times;
+
+const char *const phase_names[] = {"load", "analyze", "eval"};
+
+}   // namespace
+
+
+PhaseTimer::PhaseTimer(Phase phase) : enabled(PhaseTimer::is_enabled()) {
+    if (this->enabled) {
+        this->outer = thread_times.current;
+        this->switch_to(phase);
+    }
+}
+
+
+PhaseTimer::~PhaseTimer() {
+    if (this->enabled) {
+        this->switch_to(this->outer);
+    }
+}
+
+
+bool PhaseTimer::is_enabled() {
+    static const bool enabled = std::getenv("JBSCRIPT_TIMING") != nullptr;
+    return enabled;
+}
+
+
+double PhaseTimer::total(Phase phase) {
+    auto elapsed = thread_times.totals[static_cast<int>(phase)];
+    return std::chrono::duration<double>(elapsed).count();
+}
+
+
+void PhaseTimer::report(std::ostream &os) {
+    if (!PhaseTimer::is_enabled()) {
+        return;
+    }
+    for (int i = 0; i < static_cast<int>(Phase::COUNT); ++i) {
+        Clock::duration elapsed = thread_times.totals[i] + Clock::duration(exited_totals[i]);
+        char line[64];
+        std::snprintf(line, sizeof(line), "%-8s %10.3f ms\n",
+            phase_names[i], std::chrono::duration<double>(elapsed).count() * 1e3);
+        os << line;
+    }
+}
+
+
+void PhaseTimer::switch_to(Phase phase) {
+    Clock::time_point now = Clock::now();
+    if (thread_times.current != Phase::COUNT) {
+        thread_times.totals[static_cast<int>(thread_times.current)] += now - thread_times.since;
+    }
+    thread_times.current = phase;
+    thread_times.since = now;
+}
@@ -0,0 +1,39 @@
+#ifndef JIAOBENSCRIPT_PHASE_TIMER_H
+#define JIAOBENSCRIPT_PHASE_TIMER_H
+
+#include <iosfwd>
+
+
+enum class Phase {
+    LOAD,       // tokenizing and parsing, or loading the ast cache
+    ANALYZE,    // see analyze_in_block()
+    EVAL,
+    COUNT,
+};
+
+
+// Accumulates the time spent in each phase on the thread when $JBSCRIPT_TIMING is set. Phases
+// nest, the time of an inner phase is not counted for the outer one, so a lazy function body
+// parsed during evaluation is counted as LOAD.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase);
+    ~PhaseTimer();
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+    static bool is_enabled();
+    // total seconds of phase on the thread
+    static double total(Phase phase);
+    // one line per phase if enabled, the totals of the thread and of the threads that have exited
+    static void report(std::ostream &os);
+
+private:
+    void switch_to(Phase phase);
+
+    bool enabled;
+    Phase outer;
+};
+
+
+#endif //JIAOBENSCRIPT_PHASE_TIMER_H
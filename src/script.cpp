@@ -1,104 +1,174 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iterator>
 #include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <string>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "script.h"
+#include "ast_cache.h"
 #include "tokenizer.h"
 #include "parser.h"
 #include "eval_ast.h"
+#include "node_arena.h"
 #include "line_highlight.h"
+#include "mapped_file.h"
+#include "output.h"
+#include "phase_timer.h"
 #include "sourcepos.h"
 #include "unicode.h"
 
 
 static void print_error(
-    const std::string &type, const std::string &msg, const std::vector<ustring> &lines = {},
-    const SourcePos &pos_start = SourcePos(), const SourcePos &pos_end = SourcePos())
+    std::ostream &os, const std::string &type, const std::string &msg,
+    const std::vector<ustring> &lines = {},
+    const SourceLoc &pos_start = SourceLoc(), const SourceLoc &pos_end = SourceLoc())
 {
-    std::cerr << type << ": " << msg << std::endl;
+    os << type << ": " << msg << std::endl;
     if (pos_start.is_valid()) {
-        line_lighlight(lines, pos_start, pos_end);
+        line_lighlight(os, lines, pos_start, pos_end);
     }
 }
 
 
-static std::vector<ustring> split_lines(std::istream &input) {
-    std::string line;
+// only for highlighting errors, undecodable lines are left empty
+static std::vector<ustring> split_lines(const char *source, size_t size) {
     std::vector<ustring> lines;
-    while (std::getline(input, line)) {
-        ustring uline = u8_decode(line);
+    size_t start = 0;
+    while (start < size) {
+        const char *newline = static_cast<const char *>(
+            std::memchr(source + start, '\n', size - start));
+        size_t stop = newline ? newline - source : size;
+
+        ustring uline;
+        try {
+            uline = u8_decode(std::string(source + start, stop - start));
+        } catch (DecodeError &) {
+            // pass
+        }
         uline.push_back('\n');
         lines.push_back(uline);
+        start = stop + 1;
     }
     return lines;
 }
 
 
-static Node::Ptr parse(const std::vector<ustring> &lines) {
+// function bodies are parsed on their first call if lazy
+static Node::Ptr parse(const SourceText &text, bool lazy) {
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    const char *source = text.data();
+    size_t size = text.size();
+
     Parser parser;
-    parser.start_program();
+    if (lazy) {
+        parser.set_lazy_source(&text);
+    }
 
+    // the parser pulls the tokens of a chunk at a time
     Tokenizer tokenizer;
-    for (const ustring &uline : lines) {
-        for (unichar ch : uline) {
-            tokenizer.feed(ch);
+    size_t start = 0;
+    bool ended = false;
+    auto refill = [&]() {
+        if (start < size) {
+            tokenizer.feed(source + start, std::min(CHUNK_SIZE, size - start));
+            start += CHUNK_SIZE;
+            return true;
         }
-        while (Token::Ptr tok = tokenizer.pop()) {
-            parser.feed(*tok);
+        if (ended) {
+            return false;
         }
-    }
-
-    return parser.pop_result();
+        if (size == 0 || source[size - 1] != '\n') {
+            tokenizer.feed("\n", 1);
+        }
+        ended = true;
+        return true;
+    };
+    return parser.parse_program(tokenizer, refill);
 }
 
 
-static void _run_script_inner(const std::vector<ustring> &lines, bool main) {
-    Node::Ptr node = parse(lines);
-    assert(dynamic_cast<Program *>(node.get()));
+// foo.jb -> foo.jbc, or named by the source hash in $JBSCRIPT_CACHE_DIR
+static std::string get_cache_path(const std::string &path, const char *source, size_t size) {
+    if (const char *dir = std::getenv("JBSCRIPT_CACHE_DIR")) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.jbc",
+            static_cast<unsigned long long>(ast_cache_source_hash(source, size)));
+        return std::string(dir) + "/" + name;
+    }
+    if (path.size() > 3 && path.compare(path.size() - 3, 3, ".jb") == 0) {
+        return path + "c";
+    }
+    return path + ".jbc";
+}
+
 
-    AstInterpreter interp;
-    interp.set_default_builtin_table();
+static Node::Ptr load_cache(const std::string &cache_path, const SourceText &text) {
+    MappedFile file(cache_path);
+    if (!file.is_open()) {
+        return Node::Ptr();
+    }
+    return load_ast_cache(file.data(), file.size(), text);
+}
 
-    Program &prog = static_cast<Program &>(*node);
-    interp.eval_incomplete_raw_block(prog);
 
-    if (main) {
-        E_Op *call = new E_Op(OpCode::CALL);
-        Node::Ptr _(call);
-        call->args.emplace_back(new E_Var(USTRING("main")));
-        call->args.emplace_back(new E_Op(OpCode::EXPLIST));
-        interp.eval_raw_exp(*call);
+// the cache is optional, failures are ignored
+static void save_cache(const std::string &cache_path, Node &prog, const SourceText &text) {
+    std::string image = dump_ast_cache(prog, text);
+    // replaced atomically, a concurrent run or thread never sees a partial file
+    static std::atomic<unsigned> tmp_count(0);
+    std::string tmp_path = cache_path + "." + std::to_string(::getpid()) + "."
+        + std::to_string(tmp_count++) + ".tmp";
+    {
+        std::ofstream fs(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!fs.write(image.data(), image.size())) {
+            std::remove(tmp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
     }
 }
 
+
 #define CATCH_AND_RETURN(Type, ret) \
     catch (Type &exc) { \
-        print_error(#Type, exc.what(), lines, exc.pos_start, exc.pos_end); \
+        print_error(os, #Type, exc.what(), split_lines(source, size), exc.pos_start, exc.pos_end); \
         return ret; \
     }
 
 
-static int _run_script(std::istream &input, bool main) {
-    std::vector<ustring> lines;
-    try {
-        lines = split_lines(input);
-    } catch (DecodeError &exc) {
-        print_error("DecodeError", exc.what());
-        return 1;
-    }
-
+// the status of func, errors are printed to os
+template<class Func>
+static int run_guarded(const char *source, size_t size, std::ostream &os, Func func) {
     try {
-        _run_script_inner(lines, main);
+        func();
         return 0;
     }
+    catch (DecodeError &exc) {
+        print_error(os, "DecodeError", exc.what());
+        return 1;
+    }
     CATCH_AND_RETURN(TokenizerError, 2)
     CATCH_AND_RETURN(ParserError, 3)
     CATCH_AND_RETURN(CompileError, 4)
     CATCH_AND_RETURN(JBError, 5)
     catch (...) {
-        print_error("Unknown", "Unknown exception caught");
+        print_error(os, "Unknown", "Unknown exception caught");
         return 6;
     }
 }
@@ -107,11 +177,246 @@ static int _run_script(std::istream &input, bool main) {
 #undef CATCH_AND_RETURN
 
 
+namespace {
+
+// A script from source to evaluation. load() parses and analyzes it, on any thread, run()
+// evaluates it afterwards. Both return a status and print errors to os. Without lazy, function
+// bodies are checked by load() too, and the cache is not used.
+class Script {
+public:
+    Script(const char *source, size_t size, const std::string &cache_path, bool lazy = true)
+        : text(source, size), cache_path(lazy ? cache_path : ""), lazy(lazy)
+    {}
+
+    int load(std::ostream &os);
+    int run(bool main, std::ostream &os);
+
+private:
+    SourceText text;        // lazy functions refer to it
+    std::string cache_path;
+    bool lazy;
+    NodeArena arena;        // all nodes of the program, outlives the nodes and the interpreter
+    Node::Ptr node;
+    std::unique_ptr<AstInterpreter> interp;
+};
+
+
+int Script::load(std::ostream &os) {
+    return run_guarded(this->text.data(), this->text.size(), os, [this]() {
+        auto _arena = this->arena.enter();
+        {
+            PhaseTimer _(Phase::LOAD);
+            if (!this->cache_path.empty()) {
+                this->node = load_cache(this->cache_path, this->text);
+            }
+            if (!this->node) {
+                this->node = parse(this->text, this->lazy);
+                if (!this->cache_path.empty()) {
+                    save_cache(this->cache_path, *this->node, this->text);
+                }
+            }
+        }
+        assert(dynamic_cast<Program *>(this->node.get()));
+
+        this->interp.reset(new AstInterpreter());
+        this->interp->set_default_builtin_table();
+        this->interp->analyze_raw_block(static_cast<Program &>(*this->node));
+    });
+}
+
+
+int Script::run(bool main, std::ostream &os) {
+    FdOutput &output = standard_output();
+    int status = run_guarded(this->text.data(), this->text.size(), os, [this, main, &output]() {
+        auto _arena = this->arena.enter();
+        PhaseTimer _(Phase::EVAL);
+        // the output comes before the error
+        struct Flush {
+            ~Flush() { this->output.flush(); }
+            FdOutput &output;
+        } flush {output};
+
+        AstInterpreter &interp = *this->interp;
+        interp.eval_analyzed_block(static_cast<Program &>(*this->node));
+
+        if (main) {
+            E_Op *call = new E_Op(OpCode::CALL);
+            Node::Ptr _(call);
+            call->args.emplace_back(new E_Var(USTRING("main")));
+            call->args.emplace_back(new E_Op(OpCode::EXPLIST));
+            interp.eval_raw_exp(*call);
+        }
+    });
+    if (status == 0 && !output.error().empty()) {
+        print_error(os, "IOError", output.error());
+        status = 7;
+    }
+    return status;
+}
+
+}   // namespace
+
+
+static int _run_script(
+    const char *source, size_t size, bool main, const std::string &cache_path = "")
+{
+    Script script(source, size, cache_path);
+    int status = script.load(std::cerr);
+    if (status == 0) {
+        status = script.run(main, std::cerr);
+    }
+    PhaseTimer::report(std::cerr);
+    return status;
+}
+
+
 int run_script(std::istream &input) {
-    return _run_script(input, false);
+    std::string source {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+    return _run_script(source.data(), source.size(), false);
 }
 
 
 int run_script_main(std::istream &input) {
-    return _run_script(input, true);
+    std::string source {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+    return _run_script(source.data(), source.size(), true);
+}
+
+
+int run_script_file_main(const std::string &path) {
+    MappedFile file(path);
+    if (!file.is_open()) {
+        print_error(std::cerr, "IOError", file.error());
+        return 7;
+    }
+    std::string cache_path = get_cache_path(path, file.data(), file.size());
+    return _run_script(file.data(), file.size(), true, cache_path);
+}
+
+
+// *.jb files under dir in name order, searched recursively
+static void find_scripts(const std::string &dir, std::vector<std::string> &paths) {
+    DIR *handle = ::opendir(dir.c_str());
+    if (handle == nullptr) {
+        paths.push_back(dir);   // reported when opened
+        return;
+    }
+    std::vector<std::string> names;
+    while (const dirent *entry = ::readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    ::closedir(handle);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string &name : names) {
+        std::string path = dir + (dir.back() == '/' ? "" : "/") + name;
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            find_scripts(path, paths);
+        } else if (name.size() > 3 && name.compare(name.size() - 3, 3, ".jb") == 0) {
+            paths.push_back(path);
+        }
+    }
+}
+
+
+int run_script_files_main(const std::vector<std::string> &inputs, unsigned jobs, bool check_only) {
+    std::vector<std::string> paths;
+    for (const std::string &input : inputs) {
+        struct stat st;
+        if (::stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            find_scripts(input, paths);
+        } else {
+            paths.push_back(input);
+        }
+    }
+
+    struct Loaded {
+        std::unique_ptr<MappedFile> file;
+        std::unique_ptr<Script> script;
+        std::string errors;
+        int status = 0;
+        bool done = false;
+    };
+    std::vector<Loaded> loaded(paths.size());
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<size_t> next(0);
+    size_t reported = 0;    // guarded by mutex
+
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Files are taken in order, so the main thread rarely waits for the one it reports next. A
+    // loaded script is kept until run, so at most jobs of them are loaded ahead.
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            if (!check_only) {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]() { return i < reported + jobs; });
+            }
+            Loaded &item = loaded[i];
+            std::ostringstream os;
+            item.file.reset(new MappedFile(paths[i]));
+            if (!item.file->is_open()) {
+                print_error(os, "IOError", item.file->error());
+                item.status = 7;
+            } else {
+                const MappedFile &file = *item.file;
+                std::string cache_path = get_cache_path(paths[i], file.data(), file.size());
+                item.script.reset(new Script(file.data(), file.size(), cache_path, !check_only));
+                item.status = item.script->load(os);
+            }
+            if (check_only) {
+                item.script.reset();
+                item.file.reset();
+            }
+            item.errors = os.str();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            item.done = true;
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min<size_t>(jobs, paths.size()); ++i) {
+        threads.emplace_back(worker);
+    }
+
+    // reported and run in the order of paths, regardless of which thread finishes first
+    int status = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        Loaded &item = loaded[i];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&item]() { return item.done; });
+        }
+        if (item.status == 0 && !check_only) {
+            std::ostringstream os;
+            item.status = item.script->run(true, os);
+            item.errors += os.str();
+        }
+        if (item.status != 0) {
+            std::cerr << paths[i] << ": " << item.errors;
+            if (status == 0) {
+                status = item.status;
+            }
+        }
+        item.script.reset();
+        item.file.reset();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        reported = i + 1;
+        cond.notify_all();
+    }
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    PhaseTimer::report(std::cerr);
+    return status;
 }
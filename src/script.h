@@ -3,10 +3,19 @@
 
 
 #include <iosfwd>
+#include <string>
+#include <vector>
 
 
 int run_script(std::istream &input);
 int run_script_main(std::istream &input);
+// the file is memory-mapped and tokenized in place, the parsed program is cached, see ast_cache.h
+int run_script_file_main(const std::string &path);
+// Loads the files, and the *.jb files in the directories, on jobs threads (one per core if 0),
+// then runs them in order. With check_only, function bodies are parsed and analyzed too, and
+// nothing is run. Errors are reported in the same order, prefixed by the path, and the status is
+// the one of the first failed file.
+int run_script_files_main(const std::vector<std::string> &inputs, unsigned jobs, bool check_only);
 
 
 #endif //JIAOBENSCRIPT_SCRIPT_H
@@ -1,3 +1,4 @@
+#include <cassert>
 #include <tuple>
 
 #include "sourcepos.h"
@@ -18,13 +19,54 @@ bool SourcePos::is_valid() const {
 }
 
 
-void TracableSourcePos::add_char(unsigned int ch) {
-    if (this->last_newline) {
-        this->lineno++;
-        this->rowno = 0;
-    } else {
-        this->rowno++;
+void TracableSourcePos::add_u8_run(const char *begin, const char *end) {
+    // code points are bytes other than continuation bytes
+    uint32_t count = 0;
+    for (const char *p = begin; p < end; ++p) {
+        count += (static_cast<unsigned char>(*p) & 0xc0) != 0x80;
     }
+    this->offset += count;  // INVALID wraps
+}
+
+
+size_t SourceText::byte_offset(SourceLoc loc) const {
+    assert(loc.is_valid());
+    if (this->checkpoints.empty()) {
+        uint32_t count = 0;
+        for (size_t i = 0; i < this->text_size; ++i) {
+            if ((static_cast<unsigned char>(this->text[i]) & 0xc0) != 0x80) {
+                if (count % CHECKPOINT_INTERVAL == 0) {
+                    this->checkpoints.push_back(i);
+                }
+                ++count;
+            }
+        }
+    }
+    assert(loc.offset / CHECKPOINT_INTERVAL < this->checkpoints.size());
+
+    size_t i = this->checkpoints[loc.offset / CHECKPOINT_INTERVAL];
+    for (uint32_t remain = loc.offset % CHECKPOINT_INTERVAL; ; ++i) {
+        assert(i < this->text_size);
+        if ((static_cast<unsigned char>(this->text[i]) & 0xc0) != 0x80) {
+            if (remain == 0) {
+                return i;
+            }
+            --remain;
+        }
+    }
+}
+
 
-    this->last_newline = (ch == '\n');
+SourcePos find_source_pos(const std::vector<ustring> &lines, SourceLoc loc) {
+    if (!loc.is_valid()) {
+        return SourcePos();
+    }
+    size_t remain = loc.offset;
+    for (size_t lineno = 0; lineno < lines.size(); ++lineno) {
+        if (remain < lines[lineno].size()) {
+            return SourcePos(static_cast<int>(lineno), static_cast<int>(remain));
+        }
+        remain -= lines[lineno].size();
+    }
+    return SourcePos();
 }
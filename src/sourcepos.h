@@ -2,11 +2,16 @@
 #define JIAOBENSCRIPT_SOURCEPOS_H
 
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
+#include "unicode.h"
 #include "repr.hpp"
 
 
+// line and column, only computed from SourceLoc when an error is reported
 struct SourcePos {
     int lineno;
     int rowno;
@@ -24,16 +29,78 @@ struct SourcePos {
 };
 
 
-struct TracableSourcePos : SourcePos {
-    void add_char(unsigned int ch);
+// index of a code point in the source, stored by tokens and nodes
+struct SourceLoc {
+    static const uint32_t INVALID = UINT32_MAX;
 
-    bool last_newline = true;
+    explicit SourceLoc(uint32_t offset) : offset(offset) {}
+    SourceLoc() : offset(INVALID) {}
+
+    bool operator==(const SourceLoc &other) const {
+        return this->offset == other.offset;
+    }
+    bool operator!=(const SourceLoc &other) const {
+        return !(*this == other);
+    }
+    bool is_valid() const {
+        return this->offset != INVALID;
+    }
+
+    uint32_t offset;
 };
 
 
+// location of the last char added
+struct TracableSourcePos : SourceLoc {
+    TracableSourcePos() {}
+    // the next char added is at start
+    explicit TracableSourcePos(uint32_t start) : SourceLoc(start - 1) {}
+
+    void add_char() {
+        ++this->offset;     // INVALID wraps to 0
+    }
+    // same as add_char() on each code point of valid utf-8 bytes
+    void add_u8_run(const char *begin, const char *end);
+};
+
+
+// Utf-8 text of a script, not owned. Kept by the nodes parsed from it so that skipped function
+// bodies can be parsed later, see Parser::set_lazy_source().
+class SourceText {
+public:
+    SourceText(const char *text, size_t size) : text(text), text_size(size) {}
+
+    const char *data() const {
+        return this->text;
+    }
+    size_t size() const {
+        return this->text_size;
+    }
+    // byte offset of the code point at loc, which is inside the text
+    size_t byte_offset(SourceLoc loc) const;
+
+private:
+    static const uint32_t CHECKPOINT_INTERVAL = 4096;   // code points
+
+    const char *text;
+    size_t text_size;
+    // byte offset of every CHECKPOINT_INTERVAL code points, built on first use
+    mutable std::vector<size_t> checkpoints;
+};
+
+
+// lines end with '\n', as split by the script runner and the repl
+SourcePos find_source_pos(const std::vector<ustring> &lines, SourceLoc loc);
+
+
 REPR(SourcePos) {
     return "<Pos " + std::to_string(value.lineno) + ":" + std::to_string(value.rowno) + ">";
 }
 
 
+REPR(SourceLoc) {
+    return "<Loc " + std::to_string(value.offset) + ">";
+}
+
+
 #endif //JIAOBENSCRIPT_SOURCEPOS_H
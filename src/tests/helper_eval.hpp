@@ -0,0 +1,138 @@
+#ifndef HELPER_EVAL_HPP
+#define HELPER_EVAL_HPP
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "catch.hpp"
+
+#include "../exceptions.h"
+#include "../jbobject.h"
+#include "../node.h"
+#include "helper_node.hpp"
+
+
+// The for loops shared by the tests of AstInterpreter and StackInterpreter. The globals x, L, one
+// and two must be declared, and the default builtins set. The nodes are kept in g.
+template<class Interp>
+void check_for_loops(Interp &interp, std::vector<Node::Ptr> &g) {
+    auto eval_exp = [&](Node *exp) -> JBValue & {
+        g.emplace_back(exp);
+        return interp.eval_raw_exp(*exp);
+    };
+    auto eval_stmt = [&](Node *stmt) {
+        g.emplace_back(stmt);
+        interp.eval_raw_stmt(*stmt);
+    };
+    JBInt one(1);
+    JBInt two(2);
+
+    // for (let i = 1, 5) { x = x + i; }
+    eval_exp(make_binop('=', V("x"), T(0)));
+    eval_stmt(make_for_range("i", T(1), T(5), nullptr, make_block({
+        make_s_exp(make_binop('=', V("x"), make_binop('+', V("x"), V("i"))))})));
+    REQUIRE(eval_exp(V("x")) == JBInt(10));
+
+    // for (let i = 9, 0, -2) { if (i == 3) { break; } if (i == 7) { continue; } x += i; }
+    eval_exp(make_binop('=', V("x"), T(0)));
+    eval_stmt(make_for_range("i", T(9), T(0), make_ops('-', {T(2)}), make_block({
+        make_cond(make_binop('==', V("i"), T(3)), make_block({new S_Break()}), nullptr),
+        make_cond(make_binop('==', V("i"), T(7)), make_block({new S_Continue()}), nullptr),
+        make_s_exp(make_binop('+=', V("x"), V("i")))})));
+    REQUIRE(eval_exp(V("x")) == JBInt(9 + 5));
+
+    // each iteration has its own counter once captured
+    // for (let i = 0, 3) { list_append(x, function() { return i; }); }
+    eval_exp(make_binop('=', V("x"), make_list({})));
+    eval_stmt(make_for_range("i", T(0), T(3), nullptr, make_block({
+        make_s_exp(make_call(V("list_append"), {
+            V("x"), make_func(nullptr, make_block({make_return(V("i"))}))}))})));
+    REQUIRE(eval_exp(make_call(make_binop('[]', V("x"), T(1)), {})) == one);
+    REQUIRE(eval_exp(make_call(make_binop('[]', V("x"), T(2)), {})) == two);
+
+    // L = [1, 2]; for (let v in L) { list_append(L, v); if (list_size(L) > 5) { break; } }
+    eval_exp(make_binop('=', V("L"), make_list({T(1), T(2)})));
+    eval_stmt(make_for_in("v", V("L"), make_block({
+        make_s_exp(make_call(V("list_append"), {V("L"), V("v")})),
+        make_cond(
+            make_binop('>', make_call(V("list_size"), {V("L")}), T(5)),
+            make_block({new S_Break()}),
+            nullptr)})));
+    REQUIRE(eval_exp(make_call(V("list_size"), {V("L")})) == JBInt(6));
+    REQUIRE(eval_exp(make_binop('[]', V("L"), T(5))) == two);
+
+    // the counter stops at the ends of int64 instead of wrapping
+    // L = []; for (let i = INT64_MAX - 7, INT64_MAX, 5) { list_append(L, i); }
+    const int64_t max = std::numeric_limits<int64_t>::max();
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    eval_exp(make_binop('=', V("L"), make_list({})));
+    eval_stmt(make_for_range("i", new E_Int(max - 7), new E_Int(max), T(5), make_block({
+        make_s_exp(make_call(V("list_append"), {V("L"), V("i")}))})));
+    REQUIRE(eval_exp(make_call(V("list_size"), {V("L")})) == JBInt(2));
+    REQUIRE(eval_exp(make_binop('[]', V("L"), T(1))) == JBInt(max - 2));
+    // L = []; for (let i = INT64_MIN + 7, INT64_MIN, -5) { list_append(L, i); }
+    eval_exp(make_binop('=', V("L"), make_list({})));
+    eval_stmt(make_for_range("i", new E_Int(min + 7), new E_Int(min), T(-5), make_block({
+        make_s_exp(make_call(V("list_append"), {V("L"), V("i")}))})));
+    REQUIRE(eval_exp(make_call(V("list_size"), {V("L")})) == JBInt(2));
+    REQUIRE(eval_exp(make_binop('[]', V("L"), T(1))) == JBInt(min + 2));
+    // for (let i = INT64_MIN, INT64_MAX, INT64_MAX) { x = i; }
+    eval_stmt(make_for_range("i", new E_Int(min), new E_Int(max), new E_Int(max), make_block({
+        make_s_exp(make_binop('=', V("x"), V("i")))})));
+    REQUIRE(eval_exp(V("x")) == JBInt(max - 1));
+
+    CHECK_THROWS_AS(eval_stmt(make_for_range("i", T(0), T(1), T(0), make_block({}))), JBError);
+    CHECK_THROWS_AS(
+        eval_stmt(make_for_range("i", T(0), V("L"), nullptr, make_block({}))), JBError);
+    CHECK_THROWS_AS(eval_stmt(make_for_in("v", V("one"), make_block({}))), JBError);
+}
+
+
+// Operands are evaluated from left to right, by AstInterpreter whether fused or not. The globals
+// x and L must be declared, and the default builtins set. The nodes are kept in g.
+template<class Interp>
+void check_operand_order(Interp &interp, std::vector<Node::Ptr> &g) {
+    auto eval_exp = [&](Node *exp) -> JBValue & {
+        g.emplace_back(exp);
+        return interp.eval_raw_exp(*exp);
+    };
+    auto eval_stmt = [&](Node *stmt) {
+        g.emplace_back(stmt);
+        interp.eval_raw_stmt(*stmt);
+    };
+    auto reset_x = []() { return make_s_exp(make_binop('=', V("x"), T(1))); };
+    auto append = [](Node *item) {
+        return make_s_exp(make_call(V("list_append"), {V("L"), item}));
+    };
+    auto x_plus_f = []() { return make_binop('+', V("x"), make_call(V("f"), {})); };
+    auto x_less_f = []() {
+        return make_binop('<', V("x"), make_binop('+', make_call(V("f"), {}), T(50)));
+    };
+
+    // { let f = function () { x = 100; return 1; }; L = [];
+    //   x = 1; x = x + f(); list_append(L, x);
+    //   x = 1; list_append(L, x + f());
+    //   x = 1; if (x < f() + 50) { list_append(L, 1); } else { list_append(L, 0); }
+    //   x = 1; list_append(L, x < f() + 50); }
+    eval_stmt(make_block({
+        make_decl_list({{"f", make_func(nullptr, make_block({
+            make_s_exp(make_binop('=', V("x"), T(100))), make_return(T(1))}))}}),
+        make_s_exp(make_binop('=', V("L"), make_list({}))),
+        reset_x(),
+        make_s_exp(make_binop('=', V("x"), x_plus_f())),
+        append(V("x")),
+        reset_x(),
+        append(x_plus_f()),
+        reset_x(),
+        make_cond(x_less_f(), make_block({append(T(1))}), make_block({append(T(0))})),
+        reset_x(),
+        append(x_less_f()),
+    }));
+    REQUIRE(eval_exp(make_binop('[]', V("L"), T(0))) == JBInt(2));
+    REQUIRE(eval_exp(make_binop('[]', V("L"), T(1))) == JBInt(2));
+    REQUIRE(eval_exp(make_binop('[]', V("L"), T(2))) == JBInt(1));
+    REQUIRE(eval_exp(make_binop('[]', V("L"), T(3))) == JBBool(true));
+}
+
+
+#endif  // HELPER_EVAL_HPP
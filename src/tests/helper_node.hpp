@@ -97,6 +97,26 @@ S_While *make_while(Node *test, Node *block) {
 }
 
 
+S_For *make_for_range(const std::string &name, Node *start, Node *stop, Node *step, Node *block) {
+    S_For *loop = new S_For();
+    loop->var.reset(make_decl_list({{name, nullptr}}));
+    loop->start.reset(start);
+    loop->stop.reset(stop);
+    loop->step.reset(step);
+    loop->block.reset(block);
+    return loop;
+}
+
+
+S_For *make_for_in(const std::string &name, Node *iterable, Node *block) {
+    S_For *loop = new S_For();
+    loop->var.reset(make_decl_list({{name, nullptr}}));
+    loop->iterable.reset(iterable);
+    loop->block.reset(block);
+    return loop;
+}
+
+
 S_Return *make_return(Node *value) {
     S_Return *ret = new S_Return();
     ret->value.reset(value);
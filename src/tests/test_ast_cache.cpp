@@ -0,0 +1,92 @@
+#include <string>
+#include "catch.hpp"
+
+#include "../ast_cache.h"
+#include "../node.h"
+#include "../parser.h"
+#include "../tokenizer.h"
+
+
+static Node::Ptr parse_program(const std::string &source, const SourceText *lazy_source = nullptr) {
+    Tokenizer tokenizer;
+    tokenizer.feed(source.data(), source.size());
+    Parser parser;
+    parser.set_lazy_source(lazy_source);
+    parser.start_program();
+    while (const Token *tok = tokenizer.pop()) {
+        parser.feed(*tok);
+    }
+    REQUIRE(parser.can_end());
+    return parser.pop_result();
+}
+
+
+TEST_CASE("Test ast cache round trip") {
+    std::string source =
+        "let a = 1, b = -2.5, c = \"\xe5\x9d\x97\", d = [true, false, null];\n"
+        "let f = function(x, y = a) {\n"
+        "    for (let i = 0, 10, 2) { if (i > x) { break; } else if (i) { continue; } }\n"
+        "    for (let it in d) { d[0] += it; }\n"
+        "    while (x < y && !x) { x = x % 3; }\n"
+        "    ;\n"
+        "    return f(x)[1];\n"
+        "};\n";
+    SourceText text(source.data(), source.size());
+    Node::Ptr prog = parse_program(source);
+    std::string image = dump_ast_cache(*prog, text);
+
+    Node::Ptr loaded = load_ast_cache(image.data(), image.size(), text);
+    REQUIRE(loaded);
+    CHECK(loaded->kind == NodeKind::PROGRAM);
+    CHECK(*loaded == *prog);
+    CHECK(loaded->repr() == prog->repr());
+
+    // positions are kept
+    S_Block &lhs = static_cast<S_Block &>(*loaded);
+    S_Block &rhs = static_cast<S_Block &>(*prog);
+    CHECK(lhs.pos_end == rhs.pos_end);
+    CHECK(lhs.stmts[1]->pos_start == rhs.stmts[1]->pos_start);
+    CHECK(lhs.stmts[1]->pos_end == rhs.stmts[1]->pos_end);
+
+    // stale
+    std::string changed = source + " ";
+    SourceText changed_text(changed.data(), changed.size());
+    CHECK_FALSE(load_ast_cache(image.data(), image.size(), changed_text));
+    std::string edited = source;
+    edited[8] = '2';
+    SourceText edited_text(edited.data(), edited.size());
+    CHECK_FALSE(load_ast_cache(image.data(), image.size(), edited_text));
+
+    // truncated or corrupted
+    for (size_t len = 0; len < image.size(); ++len) {
+        CHECK_FALSE(load_ast_cache(image.data(), len, text));
+    }
+    std::string bad_version = image;
+    bad_version[4] ^= 1;
+    CHECK_FALSE(load_ast_cache(bad_version.data(), bad_version.size(), text));
+}
+
+
+TEST_CASE("Test ast cache lazy function") {
+    std::string source = "let f = function(x) { return function() { return x; }; };\n";
+    SourceText text(source.data(), source.size());
+    Node::Ptr prog = parse_program(source, &text);
+    std::string image = dump_ast_cache(*prog, text);
+
+    Node::Ptr loaded = load_ast_cache(image.data(), image.size(), text);
+    REQUIRE(loaded);
+    CHECK(*loaded == *prog);
+    S_DeclareList &decls = static_cast<S_DeclareList &>(*static_cast<Program &>(*loaded).stmts[0]);
+    E_Func &func = static_cast<E_Func &>(*decls.decls[0].initial);
+    CHECK(func.attr.lazy_source == &text);
+    CHECK(static_cast<S_Block &>(*func.block).stmts.empty());
+
+    parse_lazy_body(func);
+    CHECK(func.attr.lazy_source == nullptr);
+    S_Block &body = static_cast<S_Block &>(*func.block);
+    REQUIRE(body.stmts.size() == 1);
+    REQUIRE(body.stmts[0]->kind == NodeKind::S_RETURN);
+    E_Func &inner = static_cast<E_Func &>(*static_cast<S_Return &>(*body.stmts[0]).value);
+    CHECK(inner.attr.lazy_source == &text);
+    CHECK(inner.block->pos_start.offset == 40);
+}
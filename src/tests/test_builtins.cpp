@@ -5,6 +5,7 @@
 #include "../builtins.h"
 #include "../exceptions.h"
 #include "../jbobject.h"
+#include "../output.h"
 
 
 static JBList make_list(const std::vector<JBValue *> &values) {
@@ -86,6 +87,14 @@ TEST_CASE("Test builtins") {
     }
 
     SECTION("print") {
-        b.builtin_func_print({&one, &two, &negone, &list});
+        StringOutput output;
+        b.set_output(output);
+        JBString str(USTRING("\u4e2d "));
+        JBValue *numbers[] = {&one, &two, &negone, &list};
+        CHECK(b.builtin_func_print(JBArgs(numbers, 4)) == JBNull());
+        JBValue *strings[] = {&str, &one, &str};
+        b.builtin_func_print(JBArgs(strings, 3));
+        b.builtin_func_print(JBArgs(nullptr, 0));
+        CHECK(output.str() == "1 2 -1 [1, 2, 0]\n\u4e2d  1\u4e2d \n\n");
     }
 }
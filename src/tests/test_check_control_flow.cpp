@@ -2,6 +2,7 @@
 #include "catch.hpp"
 
 #include "../check_control_flow.h"
+#include "../name_resolve.h"
 #include "helper_node.hpp"
 
 
@@ -25,6 +26,10 @@ TEST_CASE("Test bad stmt") {
                 new S_Break})))}))})),
         BadBreak
     );
+    CHECK_THROWS_AS(check_control_flow(*mb({
+        make_for_in("x", make_func(nullptr, make_block({new S_Continue()})), make_block({}))})),
+        BadContinue
+    );
 }
 
 
@@ -47,4 +52,41 @@ TEST_CASE("Test normal") {
                         make_return((T(3)))}),
                     make_return(make_func(nullptr, make_block({
                         make_return(T(4))})))})))}))}));
+    check_control_flow(*mb({
+        make_for_range("i", T(0), T(1), nullptr, make_block({
+            new S_Break(),
+            new S_Continue()}))}));
+}
+
+
+TEST_CASE("Test tail call") {
+    S_Return *tail = make_return(make_call(V("f"), {}));
+    S_Return *not_tail = make_return(make_binop('+', make_call(V("f"), {}), T(1)));
+    check_control_flow(*mb({
+        make_s_exp(make_func(nullptr, make_block({
+            make_while(T(1), make_block({
+                tail})),
+            not_tail})))}));
+    CHECK(tail->attr.is_tail_call);
+    CHECK_FALSE(not_tail->attr.is_tail_call);
+}
+
+
+TEST_CASE("Test control flow in analysis") {
+    CHECK_THROWS_AS(analyze_in_block(nullptr, *mb({ new S_Break() })), BadBreak);
+    CHECK_THROWS_AS(analyze_in_block(nullptr, *mb({ make_return(T(1)) })), BadReturn);
+    CHECK_THROWS_AS(analyze_in_block(nullptr, *mb({
+        make_while(T(1), make_block({
+            make_s_exp(make_func(nullptr, make_block({
+                new S_Continue()})))}))})),
+        BadContinue
+    );
+
+    S_Return *tail = make_return(make_call(make_func(nullptr, make_block({})), {}));
+    analyze_in_block(nullptr, *mb({
+        make_for_range("i", T(0), T(1), nullptr, make_block({
+            new S_Break(),
+            make_s_exp(make_func(nullptr, make_block({
+                tail})))}))}));
+    CHECK(tail->attr.is_tail_call);
 }
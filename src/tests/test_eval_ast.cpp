@@ -1,10 +1,14 @@
 #include <functional>
+#include <string>
 #include <vector>
 #include "catch.hpp"
 
 #include "../exceptions.h"
 #include "../eval_ast.h"
+#include "../name_resolve.h"
+#include "../parser.h"
 #include "../unicode.h"
+#include "helper_eval.hpp"
 #include "helper_node.hpp"
 
 
@@ -19,6 +23,7 @@
 TEST_CASE("Test AstInterpreter") {
     std::vector<Node::Ptr> g;
     AstInterpreter interp;
+    interp.set_default_builtin_table();
 
     S_Block *root_block = make_block({
         make_decl_list({
@@ -191,6 +196,41 @@ TEST_CASE("Test AstInterpreter") {
         CHECK_EXP(make_call(V("f4"), {T(3), T(2)}), zero);
     }
 
+    SECTION("fused") {
+        // { let s = "a", f = 0.5; s += "b"; f = f * 3; if (f > 1) { s = s + "c"; } L[0] = s; }
+        eval_stmt(make_block({
+            make_decl_list({{"s", new E_String(USTRING("a"))}, {"f", new E_Float(0.5)}}),
+            make_s_exp(make_binop('+=', V("s"), new E_String(USTRING("b")))),
+            make_s_exp(make_binop('=', V("f"), make_binop('*', V("f"), T(3)))),
+            make_cond(
+                make_binop('>', V("f"), T(1)),
+                make_block({make_s_exp(make_binop('=',
+                    V("s"), make_binop('+', V("s"), new E_String(USTRING("c")))))}),
+                nullptr),
+            make_s_exp(make_binop('=', make_binop('[]', V("L"), T(0)), V("s"))),
+        }));
+        CHECK_EXP(make_binop('[]', V("L"), T(0)), JBString(USTRING("abc")));
+
+        // { x = 0; while (x < 5) { x += 2; } }
+        eval_stmt(make_block({
+            make_s_exp(make_binop('=', V("x"), T(0))),
+            make_while(make_binop('<', V("x"), T(5)), make_block({
+                make_s_exp(make_binop('+=', V("x"), T(2)))}))}));
+        CHECK_EXP(V("x"), JBInt(6));
+
+        // { f1 += 1; }
+        CHECK_THROWS_AS(
+            eval_stmt(make_block({make_s_exp(make_binop('+=', V("f1"), T(1)))})), JBError);
+    }
+
+    SECTION("for") {
+        check_for_loops(interp, g);
+    }
+
+    SECTION("operand order") {
+        check_operand_order(interp, g);
+    }
+
     SECTION("list") {
         // getitem
         CHECK_EXP(make_binop('[]', V("L"), V("one")), two);
@@ -247,6 +287,33 @@ TEST_CASE("Test AstInterpreter") {
         CHECK_EXP(make_call(V("f"), {T(5)}), n120);
     }
 
+    SECTION("tail call") {
+        // let sum = function(n, acc) { if (n == 0) { return acc; } else { return sum(n - 1, acc + n); } };
+        eval_stmt(make_decl_list({
+            {"sum", make_func(
+                make_decl_list({{"n", nullptr}, {"acc", T(0)}}),
+                make_block({
+                    make_cond(
+                        make_binop('==', V("n"), T(0)),
+                        make_block({
+                            make_return(V("acc"))}),
+                        make_block({
+                            make_return(
+                                make_call(
+                                    V("sum"),
+                                    {
+                                        make_binop('-', V("n"), T(1)),
+                                        make_binop('+', V("acc"), V("n")),
+                                    }))}))}))}}));
+
+        JBInt n15(15);
+        CHECK_EXP(make_call(V("sum"), {T(5)}), n15);
+        // deep enough to overflow the native stack without tail calls
+        JBInt big(100000LL * 100001LL / 2);
+        CHECK_EXP(make_call(V("sum"), {T(100000)}), big);
+        CHECK_THROWS_AS(eval_exp(make_call(V("sum"), {})), JBError);
+    }
+
     // TODO: test and, or, explist
 }
 
@@ -268,8 +335,79 @@ TEST_CASE("Test set_builtin_table") {
 TEST_CASE("Test default builtin table") {
     AstInterpreter interp;
     interp.set_default_builtin_table();
+    StringOutput output;
+    interp.set_output(output);
 
     E_Op *call = make_call(V("print"), {T(1), T(2)});
     Node::Ptr _(call);
     CHECK(interp.eval_raw_exp(*call) == JBNull());
+    CHECK(output.str() == "1 2\n");
+
+    std::vector<Node::Ptr> g;
+    auto eval_exp = [&](Node *exp) -> JBValue & {
+        g.emplace_back(exp);
+        return interp.eval_raw_exp(*exp);
+    };
+
+    JBValue &list = eval_exp(make_list({}));
+    JBBuiltinFunc &append = dynamic_cast<JBBuiltinFunc &>(eval_exp(V("list_append")));
+    JBBuiltinFunc &size = dynamic_cast<JBBuiltinFunc &>(eval_exp(V("list_size")));
+    JBInt one(1);
+    JBValue *args[] = {&list, &one};
+    append.call2(list, one);
+    append.call(JBArgs(args, 2));
+    CHECK(size.call1(list) == JBInt(2));
+    CHECK(size.call(JBArgs(args, 1)) == JBInt(2));
+    CHECK_THROWS_AS(size.call(JBArgs(args, 2)), JBError);
+    CHECK_THROWS_AS(append.call1(list), JBError);
+}
+
+
+TEST_CASE("Test lazy function call") {
+    std::string source =
+        "let x = 1;\n"
+        "let f = function (a, b = x) { return a + b + y; };\n"
+        "let y = 2;\n"
+        "let g = function (n) { if (n == 0) { return x; } return g(n - 1); };\n"
+        "let h = function () {\n"
+        "    let fs = [];\n"
+        "    for (let i = 0, 3) { list_append(fs, function () { return i; }); }\n"
+        "    return fs[0]() + fs[2]();\n"
+        "};\n"
+        "let k = function () { return z; };\n";
+    SourceText text(source.data(), source.size());
+
+    Tokenizer tokenizer;
+    tokenizer.feed(source.data(), source.size());
+    Parser parser;
+    parser.set_lazy_source(&text);
+    parser.start_program();
+    while (const Token *tok = tokenizer.pop()) {
+        parser.feed(*tok);
+    }
+    Node::Ptr prog = parser.pop_result();
+
+    AstInterpreter interp;
+    interp.set_default_builtin_table();
+    interp.eval_incomplete_raw_block(static_cast<Program &>(*prog));
+
+    std::vector<Node::Ptr> g;
+    auto call = [&](const std::string &name, const std::vector<Node *> &args) -> JBValue & {
+        E_Op *exp = make_call(V(name), args);
+        g.emplace_back(exp);
+        return interp.eval_raw_exp(*exp);
+    };
+
+    CHECK(call("g", {T(10000)}) == JBInt(1));
+    CHECK(call("g", {T(1)}) == JBInt(1));
+    // the counter is not reused, the closures are only parsed after the loop
+    CHECK(call("h", {}) == JBInt(2));
+    // names declared after the function are not visible, as if analyzed eagerly
+    CHECK_THROWS_AS(call("f", {T(1)}), NoSuchName);
+    try {
+        call("k", {});
+        FAIL("no error");
+    } catch (NoSuchName &exc) {
+        CHECK(exc.pos_start.offset == source.find('z'));
+    }
 }
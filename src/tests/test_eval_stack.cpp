@@ -0,0 +1,158 @@
+#include <vector>
+#include "catch.hpp"
+
+#include "../exceptions.h"
+#include "../eval_stack.h"
+#include "../unicode.h"
+#include "helper_eval.hpp"
+#include "helper_node.hpp"
+
+
+#define CHECK_EXP(exp, expect) \
+    do { \
+        Node *node = exp; \
+        g.emplace_back(node); \
+        REQUIRE(interp.eval_raw_exp(*node) == expect); \
+    } while (0)
+
+
+TEST_CASE("Test StackInterpreter") {
+    std::vector<Node::Ptr> g;
+    StackInterpreter interp;
+    interp.set_default_builtin_table();
+
+    S_Block *root_block = make_block({
+        make_decl_list({
+            {"zero", T(0)},
+            {"one", T(1)},
+            {"two", T(2)},
+            {"x", nullptr},
+            {"L", make_list({V("one"), V("two")})},
+            {"f", nullptr},
+        }),
+    });
+    g.emplace_back(root_block);
+    interp.eval_incomplete_raw_block(*root_block);
+
+    auto eval_exp = [&](Node *exp) {
+        g.emplace_back(exp);
+        interp.eval_raw_exp(*exp);
+    };
+
+    auto eval_stmt = [&](Node *stmt) {
+        g.emplace_back(stmt);
+        interp.eval_raw_stmt(*stmt);
+    };
+
+    JBInt zero(0);
+    JBInt one(1);
+    JBInt two(2);
+    JBInt three(3);
+
+    SECTION("expression") {
+        CHECK_EXP(make_binop('+', V("one"), V("two")), three);
+        CHECK_EXP(make_binop('=', V("x"), make_binop('*', V("two"), T(2))), JBInt(4));
+        CHECK_EXP(make_binop('-=', V("x"), V("one")), three);
+        CHECK_EXP(make_binop('&&', V("zero"), V("one")), zero);
+        CHECK_EXP(make_binop('||', V("zero"), V("one")), one);
+        CHECK_EXP(make_ops(',', {T(1), T(2)}), two);
+        CHECK_EXP(make_ops('!', {V("zero")}), JBBool(true));
+        CHECK_EXP(make_binop('[]', V("L"), V("one")), two);
+        CHECK_EXP(make_binop('+=', make_binop('[]', V("L"), V("zero")), V("two")), three);
+        CHECK_EXP(make_binop('[]', V("L"), V("zero")), three);
+        CHECK_EXP(make_call(V("list_size"), {V("L")}), two);
+        CHECK_THROWS_AS(eval_exp(make_binop('[]', V("L"), T(2))), JBError);
+        CHECK_THROWS_AS(eval_exp(V("f")), JBError);
+    }
+
+    SECTION("loop and call") {
+        // f = function(n, step = 1) { let i = 0, sum = 0; while (1) { ... } return sum; }
+        eval_exp(make_binop('=', V("f"), make_func(
+            make_decl_list({{"n", nullptr}, {"step", T(1)}}),
+            make_block({
+                make_decl_list({{"i", T(0)}, {"sum", T(0)}}),
+                make_while(T(1), make_block({
+                    make_cond(
+                        make_binop('>=', V("i"), V("n")),
+                        make_block({new S_Break()}),
+                        nullptr),
+                    make_s_exp(make_binop('+=', V("i"), V("step"))),
+                    make_cond(
+                        make_binop('==', V("i"), T(2)),
+                        make_block({new S_Continue()}),
+                        nullptr),
+                    make_s_exp(make_binop('+=', V("sum"), V("i"))),
+                })),
+                make_return(V("sum")),
+            }))));
+        CHECK_EXP(make_call(V("f"), {T(4)}), JBInt(1 + 3 + 4));
+        CHECK_EXP(make_call(V("f"), {T(4), T(2)}), JBInt(4));
+        CHECK_THROWS_AS(eval_exp(make_call(V("f"), {})), JBError);
+        CHECK_THROWS_AS(eval_exp(make_call(V("one"), {})), JBError);
+    }
+
+    SECTION("for") {
+        check_for_loops(interp, g);
+    }
+
+    SECTION("operand order") {
+        check_operand_order(interp, g);
+    }
+
+    // let depth = function(n) { if (n == 0) { return 0; } return 1 + depth(n - 1); };
+    eval_stmt(make_decl_list({
+        {"depth", make_func(
+            make_decl_list({{"n", nullptr}}),
+            make_block({
+                make_cond(
+                    make_binop('==', V("n"), T(0)),
+                    make_block({make_return(T(0))}),
+                    nullptr),
+                make_return(make_binop('+',
+                    T(1),
+                    make_call(V("depth"), {make_binop('-', V("n"), T(1))})))}))}}));
+
+    SECTION("deep recursion") {
+        // overflows the native stack of AstInterpreter
+        CHECK_EXP(make_call(V("depth"), {T(200000)}), JBInt(200000));
+    }
+
+    SECTION("stack limit") {
+        interp.set_stack_limit(64 * 1024);
+        CHECK_THROWS_AS(eval_exp(make_call(V("depth"), {T(100000)})), JBError);
+        CHECK(interp.is_finished());
+        CHECK_EXP(make_call(V("depth"), {T(10)}), JBInt(10));
+    }
+
+    SECTION("tail call") {
+        // let loop = function(n) { if (n == 0) { return 0; } return loop(n - 1); };
+        eval_stmt(make_decl_list({
+            {"loop", make_func(
+                make_decl_list({{"n", nullptr}}),
+                make_block({
+                    make_cond(
+                        make_binop('==', V("n"), T(0)),
+                        make_block({make_return(T(0))}),
+                        nullptr),
+                    make_return(make_call(V("loop"), {make_binop('-', V("n"), T(1))}))}))}}));
+
+        // constant interpreter stack
+        interp.set_stack_limit(4 * 1024);
+        CHECK_EXP(make_call(V("loop"), {T(100000)}), zero);
+    }
+
+    SECTION("suspend and resume") {
+        Node *call = make_call(V("depth"), {T(1000)});
+        g.emplace_back(call);
+        interp.start_raw_exp(*call);
+        CHECK_FALSE(interp.resume(100));
+        CHECK_FALSE(interp.is_finished());
+        CHECK(interp.stack_bytes() > 0);
+        while (!interp.resume(100)) {}
+        CHECK(interp.take_result() == JBInt(1000));
+    }
+
+    SECTION("Bad stmt") {
+        CHECK_THROWS_AS(eval_stmt(make_return(T(1))), BadReturn);
+    }
+}
@@ -0,0 +1,132 @@
+#include <vector>
+#include "catch.hpp"
+
+#include "../fuse_nodes.h"
+#include "../name_resolve.h"
+#include "../node.h"
+#include "helper_node.hpp"
+
+
+static Node::Ptr resolve_and_fuse(S_Block *block) {
+    Node::Ptr g(block);
+    S_Block *outter = make_block({
+        make_decl_list({{"x", nullptr}, {"y", nullptr}, {"L", nullptr}}),
+    });
+    outter->stmts.push_back(std::move(g));
+
+    resolve_names(*outter);
+    fuse_nodes(*outter);
+    return Node::Ptr(outter);
+}
+
+
+static Node &get_stmt(Node::Ptr &outter, size_t i) {
+    S_Block &block = static_cast<S_Block &>(*static_cast<S_Block &>(*outter).stmts[1]);
+    return *block.stmts[i];
+}
+
+
+TEST_CASE("Test fuse nodes") {
+    Node::Ptr root = resolve_and_fuse(make_block({
+        make_s_exp(make_binop('+=', V("x"), T(1))),
+        make_s_exp(make_binop('=', V("x"), make_binop('*', V("x"), V("y")))),
+        make_s_exp(make_binop('=', make_binop('[]', V("L"), V("x")), V("y"))),
+        make_cond(make_binop('<', V("x"), V("y")), make_block({}), nullptr),
+        make_while(make_binop('!=', V("x"), T(0)), make_block({
+            make_s_exp(make_binop('-=', V("x"), T(1))),
+        })),
+    }));
+    E_Var vx(USTRING("x"));
+    E_Var vy(USTRING("y"));
+    E_Var vL(USTRING("L"));
+    E_Int one(1);
+    Node::Ptr original(make_binop('+=', V("x"), T(1)));
+
+    auto *inc = dynamic_cast<E_FusedVarUpdate *>(
+        static_cast<S_Exp &>(get_stmt(root, 0)).value.get());
+    REQUIRE(inc != nullptr);
+    CHECK(inc->op_code == OpCode::PLUS);
+    CHECK(inc->var.name == USTRING("x"));
+    CHECK(inc->value == one);
+    CHECK(*inc == *original);
+    CHECK(inc->repr() == "(x += 1)");
+
+    auto *update = dynamic_cast<E_FusedVarUpdate *>(
+        static_cast<S_Exp &>(get_stmt(root, 1)).value.get());
+    REQUIRE(update != nullptr);
+    CHECK(update->op_code == OpCode::STAR);
+    CHECK(update->value == vy);
+
+    auto *setitem = dynamic_cast<E_FusedSetItem *>(
+        static_cast<S_Exp &>(get_stmt(root, 2)).value.get());
+    REQUIRE(setitem != nullptr);
+    CHECK(setitem->base == vL);
+    CHECK(setitem->index == vx);
+    CHECK(setitem->value == vy);
+
+    auto *cond = dynamic_cast<S_FusedCondition *>(&get_stmt(root, 3));
+    REQUIRE(cond != nullptr);
+    CHECK(cond->test.op_code == OpCode::LESS);
+    CHECK(cond->test.lhs == vx);
+    CHECK(cond->test.rhs == vy);
+
+    auto *wh = dynamic_cast<S_FusedWhile *>(&get_stmt(root, 4));
+    REQUIRE(wh != nullptr);
+    CHECK(wh->test.op_code == OpCode::NEQ);
+    // children are fused too
+    S_Block &body = static_cast<S_Block &>(*wh->wh().block);
+    CHECK(dynamic_cast<E_FusedVarUpdate *>(
+        static_cast<S_Exp &>(*body.stmts[0]).value.get()) != nullptr);
+}
+
+
+TEST_CASE("Test fuse nodes not matched") {
+    std::vector<Node *> stmts = {
+        make_s_exp(make_binop('=', V("x"), make_binop('+', V("y"), V("x")))),
+        make_s_exp(make_binop('=', V("x"), make_binop('<', V("x"), V("y")))),
+        make_s_exp(make_binop('+=', make_binop('[]', V("L"), V("x")), V("y"))),
+        make_cond(make_binop('&&', V("x"), V("y")), make_block({}), nullptr),
+        make_while(V("x"), make_block({})),
+    };
+    Node::Ptr root = resolve_and_fuse(make_block(stmts));
+
+    for (size_t i = 0; i < stmts.size(); ++i) {
+        Node &stmt = get_stmt(root, i);
+        CHECK(&stmt == stmts[i]);
+        if (S_Exp *exp = dynamic_cast<S_Exp *>(&stmt)) {
+            CHECK(dynamic_cast<FusedNode *>(exp->value.get()) == nullptr);
+        }
+    }
+}
+
+
+TEST_CASE("Test fuse nodes in analysis") {
+    auto make_stmts = []() {
+        return make_block({
+            make_decl_list({{"x", T(0)}, {"L", make_list({})}}),
+            make_while(make_binop('<', V("x"), T(3)), make_block({
+                make_s_exp(make_binop('+=', V("x"), T(1))),
+                make_s_exp(make_binop('=', make_binop('[]', V("L"), V("x")), V("x"))),
+            })),
+        });
+    };
+    Node::Ptr expected(make_stmts());
+    resolve_names(static_cast<S_Block &>(*expected));
+    fuse_nodes(*expected);
+
+    Node::Ptr fused(make_stmts());
+    analyze_in_block(nullptr, *fused, true);
+    CHECK(fused->repr() == expected->repr());
+    S_Block &block = static_cast<S_Block &>(*fused);
+    auto *wh = dynamic_cast<S_FusedWhile *>(block.stmts[1].get());
+    REQUIRE(wh != nullptr);
+    S_Block &body = static_cast<S_Block &>(*wh->wh().block);
+    CHECK(dynamic_cast<E_FusedVarUpdate *>(
+        static_cast<S_Exp &>(*body.stmts[0]).value.get()) != nullptr);
+    CHECK(dynamic_cast<E_FusedSetItem *>(
+        static_cast<S_Exp &>(*body.stmts[1]).value.get()) != nullptr);
+
+    Node::Ptr plain(make_stmts());
+    analyze_in_block(nullptr, *plain, false);
+    CHECK(dynamic_cast<S_While *>(static_cast<S_Block &>(*plain).stmts[1].get()) != nullptr);
+}
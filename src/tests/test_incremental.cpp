@@ -0,0 +1,281 @@
+#include <random>
+#include <string>
+#include <vector>
+#include "catch.hpp"
+
+#include "../exceptions.h"
+#include "../incremental.h"
+#include "../name_resolve.h"
+#include "../parser.h"
+#include "../visitor.h"
+#include "helper_node.hpp"
+
+
+// positions and resolved indexes of the nodes in traversal order
+class AttrDumper final : private TraversalNodeVisitor {
+    NODE_DISPATCH_FRIEND;
+
+public:
+    std::string dump(Node &node) {
+        node_dispatch(*this, node);
+        return this->out;
+    }
+
+private:
+    void pos(const Node &node) {
+        this->out += std::to_string(node.pos_start.offset) + "-"
+            + std::to_string(node.pos_end.offset) + " ";
+    }
+
+    void locals(const S_Block &block) {
+        this->out += "locals";
+        for (const auto &info : block.attr.local_info) {
+            this->out += " " + u8_encode(info.name);
+        }
+        this->out += "\n";
+    }
+
+    virtual void visit_block(S_Block &block) {
+        this->pos(block);
+        this->locals(block);
+        for (const auto &info : block.attr.nonlocal_indexes) {
+            this->out += "nonlocal " + std::to_string(info.index) + "\n";
+        }
+        TraversalNodeVisitor::visit_block(block);
+    }
+
+    // the nonlocals of the program are not compared, they may be left from replaced statements
+    virtual void visit_program(Program &prog) {
+        this->locals(prog);
+        TraversalNodeVisitor::visit_block(prog);
+    }
+
+    virtual void visit_declare_list(S_DeclareList &decls) {
+        this->pos(decls);
+        this->out += "let " + std::to_string(decls.attr.start_index) + "\n";
+        TraversalNodeVisitor::visit_declare_list(decls);
+    }
+
+    virtual void visit_stmt_exp(S_Exp &stmt) {
+        this->pos(stmt);
+        this->out += "exp\n";
+        TraversalNodeVisitor::visit_stmt_exp(stmt);
+    }
+
+    virtual void visit_op(E_Op &exp) {
+        this->pos(exp);
+        this->out += "op\n";
+        TraversalNodeVisitor::visit_op(exp);
+    }
+
+    virtual void visit_var(E_Var &var) {
+        this->pos(var);
+        this->out += u8_encode(var.name) + (var.attr.is_local ? " local " : " nonlocal ")
+            + std::to_string(var.attr.index) + "\n";
+    }
+
+    virtual void visit_int(E_Int &num) {
+        this->pos(num);
+        this->out += std::to_string(num.value) + "\n";
+    }
+
+    std::string out;
+};
+
+
+static std::string dump_attrs(Node &node) {
+    return AttrDumper().dump(node);
+}
+
+
+// the attrs of the source analyzed from scratch
+static std::string analyze_string(const ustring &source, S_Block *scope) {
+    Tokenizer tokenizer;
+    for (auto ch : source) {
+        tokenizer.feed(ch);
+    }
+    tokenizer.feed('\n');
+
+    Parser parser;
+    parser.start_program();
+    while (const Token *tok = tokenizer.pop()) {
+        parser.feed(*tok);
+    }
+    Node::Ptr prog = parser.pop_result();
+    analyze_in_block(scope, *prog);
+    return dump_attrs(*prog);
+}
+
+
+static uint32_t find(IncrementalProgram &inc, const std::string &pattern) {
+    size_t pos = inc.source().find(u8_decode(pattern));
+    REQUIRE(pos != ustring::npos);
+    return static_cast<uint32_t>(pos);
+}
+
+
+static void insert(IncrementalProgram &inc, uint32_t pos, const std::string &text) {
+    inc.edit(pos, pos, text);
+}
+
+
+static void remove(IncrementalProgram &inc, uint32_t pos, uint32_t size) {
+    inc.edit(pos, pos + size, "");
+}
+
+
+TEST_CASE("Test incremental edit") {
+    Node::Ptr scope(make_block({make_decl_list({{"print", nullptr}})}));
+    resolve_names(static_cast<S_Block &>(*scope));
+    S_Block *scope_block = static_cast<S_Block *>(scope.get());
+
+    IncrementalProgram inc(scope_block);
+    inc.edit(0, 0,
+        "let a = 1, b = 2;\n"
+        "let f = function(x) {\n"
+        "    return x + a;\n"
+        "};\n"
+        "while (a < 10) {\n"
+        "    a = f(b);\n"
+        "}\n"
+        "print(a);\n"
+    );
+    CHECK_FALSE(inc.has_error());
+    CHECK(inc.reparsed_count() == 4);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), scope_block));
+
+    // only the function is parsed again
+    insert(inc, find(inc, "x + a") + 5, " * b");
+    CHECK(inc.reparsed_count() == 1);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), scope_block));
+
+    // statements added and removed
+    insert(inc, find(inc, "print"), "let c = [a, b];\nb = c[0];\n");
+    CHECK(inc.reparsed_count() == 3);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), scope_block));
+    remove(inc, find(inc, "b = c[0];"), 10);
+    CHECK(inc.reparsed_count() == 1);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), scope_block));
+
+    // an else continues the if before it
+    insert(inc, find(inc, "print"), "if (a) { print(1); }\n");
+    insert(inc, find(inc, "print(a)"), "else { b = 1; }\n");
+    CHECK(inc.reparsed_count() == 2);
+    CHECK(inc.program().stmts.size() == 6);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), scope_block));
+}
+
+
+TEST_CASE("Test incremental open construct") {
+    IncrementalProgram inc;
+    inc.edit(0, 0, "let a = 1;\nlet b = 2;\na = b;\n");
+
+    // the rest of the source is commented out
+    insert(inc, 0, "/*");
+    CHECK(inc.reparsed_count() == 0);
+    CHECK(inc.program().stmts.empty());
+    insert(inc, find(inc, "let a"), "*/");
+    CHECK(inc.reparsed_count() == 3);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), nullptr));
+
+    // an open block takes the statements after it until closed
+    CHECK_THROWS_AS(insert(inc, find(inc, "let b"), "while (a) {"), ParserError);
+    CHECK(inc.has_error());
+    CHECK(inc.program().stmts.size() == 3);
+    insert(inc, static_cast<uint32_t>(inc.source().size()), "}");
+    CHECK_FALSE(inc.has_error());
+    CHECK(inc.program().stmts.size() == 2);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), nullptr));
+
+    // an expression statement is continued by the next one
+    insert(inc, static_cast<uint32_t>(inc.source().size()), "a;\n+a;\n");
+    remove(inc, find(inc, "a;\n+a;") + 1, 1);
+    CHECK(inc.program().stmts.size() == 3);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), nullptr));
+}
+
+
+TEST_CASE("Test incremental errors") {
+    IncrementalProgram inc;
+    inc.edit(0, 0, "let a = 1;\nlet b = a;\nb = 2;\n");
+
+    // the statements after a renamed declaration are analyzed again
+    CHECK_THROWS_AS(inc.edit(4, 5, "x"), NoSuchName);
+    CHECK(inc.has_error());
+    CHECK(inc.program().stmts.size() == 3);
+    inc.edit(4, 5, "a");
+    CHECK_FALSE(inc.has_error());
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), nullptr));
+
+    // the failed statement is parsed again with the next edit
+    CHECK_THROWS_AS(remove(inc, find(inc, "2;"), 1), ParserError);
+    CHECK_THROWS_AS(inc.edit(8, 9, "3"), ParserError);
+    CHECK(inc.source().substr(0, 10) == u8_decode("let a = 3;"));
+    insert(inc, find(inc, "b = ;") + 4, "4");
+    CHECK_FALSE(inc.has_error());
+    CHECK(inc.reparsed_count() == 1);
+    CHECK(dump_attrs(inc.program()) == analyze_string(inc.source(), nullptr));
+}
+
+
+TEST_CASE("Test incremental random edits") {
+    const std::string base =
+        "let a = 1, b = [2];\n"
+        "let f = function(x, y) {\n"
+        "    if (x < y) { return x; } else { return y; }\n"
+        "};\n"
+        "/* comment */\n"
+        "for (let i = 0, 10) {\n"
+        "    a = a + f(i, b[0]); // comment\n"
+        "}\n"
+        "if (a) { b = []; }\n"
+        "while (a > 0) { a = a - 1; }\n";
+    const std::vector<std::string> fragments {
+        "let ", "a", "b", " = ", "1", ";", "{", "}", "(", ")", "if (a) ", "else ", "while (b) ",
+        "function(z) { return z; }", "/*", "*/", "//", "\n", "\"", "+", ",", "return;", "break;",
+    };
+
+    IncrementalProgram inc;
+    inc.edit(0, 0, base);
+    std::mt19937 rng(42);
+    auto check = [&]() {
+        std::string expected;
+        bool ok = true;
+        try {
+            expected = analyze_string(inc.source(), nullptr);
+        } catch (BaseException &) {
+            ok = false;
+        }
+        REQUIRE(inc.has_error() == !ok);
+        if (ok) {
+            REQUIRE(dump_attrs(inc.program()) == expected);
+        }
+    };
+    auto edit = [&](uint32_t begin, uint32_t end, const std::string &text) {
+        try {
+            inc.edit(begin, end, text);
+        } catch (BaseException &) {
+            REQUIRE(inc.has_error());
+        }
+        check();
+    };
+
+    for (int i = 0; i < 2000; ++i) {
+        uint32_t size = static_cast<uint32_t>(inc.source().size());
+        uint32_t begin = rng() % (size + 1);
+        if (rng() % 2) {
+            const std::string &text = fragments[rng() % fragments.size()];
+            edit(begin, begin, text);
+            if (rng() % 2) {
+                edit(begin, begin + static_cast<uint32_t>(text.size()), "");
+            }
+        } else {
+            uint32_t end = std::min(size, begin + 1 + static_cast<uint32_t>(rng() % 3));
+            std::string removed = u8_encode(inc.source().substr(begin, end - begin));
+            edit(begin, end, "");
+            if (rng() % 2) {
+                edit(begin, begin, removed);
+            }
+        }
+    }
+}
@@ -1,6 +1,9 @@
+#include <string>
+#include <vector>
 #include "catch.hpp"
 
 #include "../jbobject.h"
+#include "../output.h"
 
 
 TEST_CASE("Test ==") {
@@ -51,3 +54,37 @@ TEST_CASE("Test truth") {
     list.value.push_back(&a);
     CHECK(list.is_truthy());
 }
+
+
+TEST_CASE("Test repr") {
+    CHECK(JBNull().repr() == "null");
+    CHECK(JBBool(true).repr() == "true");
+    CHECK(JBInt(-12).repr() == "-12");
+    CHECK(JBString(USTRING("a\"\\/\b\f\n\t\r\x01中")).repr()
+        == "\"a\\\"\\\\/\\b\\f\\n\\t\\u000d\\u0001中\"");
+
+    JBInt one(1);
+    JBString str(USTRING("s"));
+    JBList empty;
+    JBList inner;
+    inner.value = {&one, &empty};
+    JBList list;
+    list.value = {&inner, &str, &inner, &empty};
+    CHECK(list.repr() == "[[1, []], \"s\", [1, []], []]");
+
+    // cycles
+    JBList self;
+    self.value = {&one, &self};
+    CHECK(self.repr() == "[1, [...]]");
+    inner.value.push_back(&list);
+    CHECK(list.repr() == "[[1, [], [...]], \"s\", [1, [], [...]], []]");
+
+    // deeper than the call stack allows
+    std::vector<JBList> nested(100000);
+    for (size_t i = 0; i + 1 < nested.size(); ++i) {
+        nested[i].value.push_back(&nested[i + 1]);
+    }
+    StringOutput out;
+    nested[0].write_repr(out);
+    CHECK(out.str() == std::string(nested.size(), '[') + std::string(nested.size(), ']'));
+}
@@ -0,0 +1,36 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include "catch.hpp"
+
+#include "../mapped_file.h"
+
+
+TEST_CASE("Test mapped file") {
+    std::string path = "jbscript_test_mapped_file.tmp";
+    std::string content = "let a = 1;\n\xe5\x9d\x97\n";
+    {
+        std::ofstream fs(path, std::ios::binary);
+        fs << content;
+    }
+
+    {
+        MappedFile file(path);
+        REQUIRE(file.is_open());
+        CHECK(std::string(file.data(), file.size()) == content);
+    }
+
+    {
+        std::ofstream fs(path, std::ios::binary | std::ios::trunc);
+    }
+    {
+        MappedFile file(path);
+        REQUIRE(file.is_open());
+        CHECK(file.size() == 0);
+    }
+    std::remove(path.c_str());
+
+    MappedFile missing(path);
+    CHECK_FALSE(missing.is_open());
+    CHECK(missing.error().find(path) != std::string::npos);
+}
@@ -242,6 +242,60 @@ TEST_CASE("Test name resolve misc") {
 }
 
 
+TEST_CASE("Test name resolve for loop") {
+    std::vector<Node::Ptr> g;
+
+    // for (let i = n, n + 1) { L[i] = i * 2; }
+    E_Var *vn = V("n");
+    E_Var *vi = V("i");
+    S_Block *body = make_block({
+        make_s_exp(make_binop('=',
+            make_binop('[]', V("L"), V("i")),
+            make_binop('*', vi, T(2)))),
+    });
+    S_For *loop = make_for_range("i", vn, make_binop('+', V("n"), T(1)), nullptr, body);
+    S_Block *outter = make_block({
+        make_decl_list({{"n", nullptr}, {"L", nullptr}}),
+        loop,
+    });
+    g.emplace_back(outter);
+
+    resolve_names(*outter);
+    CHECK(vn->attr.is_local);   CHECK(vn->attr.index == 0);
+    CHECK(vi->attr.is_local);   CHECK(vi->attr.index == 0);
+    CHECK(body->attr.local_info == make_local_info({"i"}));
+    CHECK(outter->attr.local_info == make_local_info({"n", "L"}));
+    CHECK(loop->attr.reuse_counter);
+
+    // the counter escapes
+    std::vector<Node *> escapes = {
+        make_s_exp(make_binop('=', V("n"), V("i"))),
+        make_s_exp(make_call(V("f"), {V("i")})),
+        make_s_exp(make_list({V("i")})),
+        make_s_exp(make_ops('+', {V("i")})),
+        make_s_exp(make_binop('&&', T(1), V("i"))),
+        make_s_exp(make_func(nullptr, make_block({make_s_exp(make_binop('+', V("i"), T(1)))}))),
+        make_block({make_decl_list({{"x", V("i")}})}),
+    };
+    for (Node *stmt : escapes) {
+        S_For *loop = make_for_range("i", T(0), T(1), nullptr, make_block({stmt}));
+        S_Block *outter = make_block({
+            make_decl_list({{"n", nullptr}, {"f", nullptr}}),
+            loop,
+        });
+        g.emplace_back(outter);
+
+        resolve_names(*outter);
+        CHECK_FALSE(loop->attr.reuse_counter);
+    }
+
+    // iterable is resolved outside of the loop
+    outter = make_block({make_for_in("x", V("x"), make_block({}))});
+    g.emplace_back(outter);
+    CHECK_THROWS_AS(resolve_names(*outter), NoSuchName);
+}
+
+
 TEST_CASE("Test use before declare") {
     std::vector<Node::Ptr> g;
 
@@ -278,7 +332,43 @@ TEST_CASE("Test no such name") {
     // resolve_names() should not corrupt block->attr if failed
     CHECK(block->attr.local_info.size() == 0);
     CHECK(block->attr.nonlocal_indexes.size() == 0);
-    CHECK(block->attr.name_to_local_index.size() == 0);
-    CHECK(block->attr.name_to_nonlocal_index.size() == 0);
     CHECK_THROWS_AS(resolve_names(*block), NoSuchName);
 }
+
+
+TEST_CASE("Test name resolve incrementally") {
+    S_Block *outter = make_block({
+        make_decl_list({
+            {"a", nullptr},
+        }),
+    });
+    S_Block *inner = make_block({
+        make_decl_list({
+            {"b", nullptr},
+        }),
+        make_s_exp(V("a")),
+    });
+    outter->stmts.emplace_back(inner);
+    Node::Ptr g(outter);
+    resolve_names(*outter);
+    REQUIRE(inner->attr.nonlocal_indexes.size() == 1);
+
+    // names of previous resolutions are visible, non-locals are not added twice
+    E_Var *va = V("a");
+    E_Var *vb = V("b");
+    Node::Ptr stmt(make_s_exp(make_binop('+', va, vb)));
+    resolve_names_in_block(inner, *stmt);
+    CHECK(!va->attr.is_local);  CHECK(va->attr.index == 0);
+    CHECK(vb->attr.is_local);   CHECK(vb->attr.index == 0);
+    CHECK(inner->attr.nonlocal_indexes.size() == 1);
+
+    Node::Ptr decls(make_decl_list({{"b", nullptr}}));
+    CHECK_THROWS_AS(resolve_names_in_block(inner, *decls), DuplicatedLocalName);
+
+    Node::Ptr shadow(make_decl_list({{"a", nullptr}}));
+    resolve_names_in_block(inner, *shadow);
+    E_Var *va2 = V("a");
+    Node::Ptr use(make_s_exp(va2));
+    resolve_names_in_block(inner, *use);
+    CHECK(va2->attr.is_local);  CHECK(va2->attr.index == 1);
+}
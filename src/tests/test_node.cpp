@@ -1,4 +1,9 @@
+#include <string>
+#include <vector>
+
 #include "../node.h"
+#include "../node_arena.h"
+#include "../visitor.h"
 
 #include "catch.hpp"
 
@@ -7,3 +12,77 @@ TEST_CASE("Test node comparison") {
     CHECK(E_Null() == E_Null());
     CHECK(E_Null() != S_Break());
 }
+
+
+TEST_CASE("Test node arena") {
+    NodeArena arena;
+    CHECK(NodeArena::current() == nullptr);
+    {
+        auto _ = arena.enter();
+        CHECK(NodeArena::current() == &arena);
+
+        Node::Ptr first(new E_Int(1));
+        size_t used = arena.bytes_allocated();
+        // a pointer to the arena precedes the node
+        CHECK(used == sizeof(E_Int) + sizeof(NodeArena *));
+
+        // many chunks
+        std::vector<Node::Ptr> nodes;
+        for (int i = 0; i < 10000; ++i) {
+            nodes.emplace_back(new E_Int(i));
+        }
+        CHECK(arena.bytes_allocated() >= used * 10001);
+        // laid out in creation order
+        CHECK(reinterpret_cast<char *>(nodes[1].get()) - reinterpret_cast<char *>(nodes[0].get())
+              == static_cast<ptrdiff_t>(used));
+        CHECK(static_cast<E_Int &>(*nodes[9999]).value == 9999);
+
+        // destructor is run, memory is kept by arena
+        nodes.clear();
+        CHECK(arena.bytes_allocated() >= used * 10001);
+    }
+    CHECK(NodeArena::current() == nullptr);
+
+    size_t used = arena.bytes_allocated();
+    Node::Ptr heap(new E_Int(1));
+    CHECK(arena.bytes_allocated() == used);
+}
+
+
+namespace {
+
+struct KindRecorder final : NodeVisitor {
+    std::vector<std::string> visited;
+
+    virtual void visit_op(E_Op &) override { this->visited.push_back("op"); }
+    virtual void visit_int(E_Int &) override { this->visited.push_back("int"); }
+    virtual void visit_string(E_String &) override { this->visited.push_back("string"); }
+    virtual void visit_program(Program &) override { this->visited.push_back("program"); }
+    virtual void visit_block(S_Block &) override { this->visited.push_back("block"); }
+};
+
+}   // namespace
+
+
+TEST_CASE("Test node kind dispatch") {
+    E_Op op(OpCode::PLUS);
+    E_Int int_node(1);
+    E_String str(USTRING("s"));
+    Program prog;
+    S_Block block;
+
+    CHECK(op.kind == NodeKind::E_OP);
+    CHECK(int_node.kind == NodeKind::E_INT);
+    CHECK(str.kind == NodeKind::E_STRING);
+    CHECK(prog.kind == NodeKind::PROGRAM);
+    CHECK(block.kind == NodeKind::S_BLOCK);
+
+    KindRecorder rec;
+    for (Node *node : std::vector<Node *> {&op, &int_node, &str, &prog, &block}) {
+        node_dispatch(rec, *node);
+    }
+    // through NodeVisitor
+    prog.accept(rec);
+    std::vector<std::string> expected = {"op", "int", "string", "program", "block", "program"};
+    CHECK(rec.visited == expected);
+}
@@ -0,0 +1,119 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include "catch.hpp"
+
+#include "../number_format.h"
+
+
+static std::string fmt_int(int64_t value) {
+    char buf[INT_FORMAT_SIZE];
+    return std::string(buf, format_int(buf, value));
+}
+
+
+static std::string fmt_double(double value) {
+    char buf[DOUBLE_FORMAT_SIZE];
+    return std::string(buf, format_double(buf, value));
+}
+
+
+// the fewest significant digits that read back as value, by trying all precisions
+static int shortest_digits(double value) {
+    char buf[64];
+    for (int precision = 1; precision < 17; ++precision) {
+        std::snprintf(buf, sizeof(buf), "%.*e", precision - 1, value);
+        if (std::strtod(buf, nullptr) == value) {
+            return precision;
+        }
+    }
+    return 17;
+}
+
+
+static int significant_digits(const std::string &str) {
+    std::string digits;
+    for (char ch : str.substr(0, str.find('e'))) {
+        if ('0' <= ch && ch <= '9' && !(digits.empty() && ch == '0')) {
+            digits += ch;
+        }
+    }
+    digits.erase(digits.find_last_not_of('0') + 1);
+    return static_cast<int>(digits.size());
+}
+
+
+TEST_CASE("Test format int") {
+    CHECK(fmt_int(0) == "0");
+    CHECK(fmt_int(7) == "7");
+    CHECK(fmt_int(-7) == "-7");
+    CHECK(fmt_int(10) == "10");
+    CHECK(fmt_int(100) == "100");
+    CHECK(fmt_int(-123456789) == "-123456789");
+    CHECK(fmt_int(std::numeric_limits<int64_t>::max()) == "9223372036854775807");
+    CHECK(fmt_int(std::numeric_limits<int64_t>::min()) == "-9223372036854775808");
+}
+
+
+TEST_CASE("Test format double") {
+    CHECK(fmt_double(0.0) == "0.0");
+    CHECK(fmt_double(-0.0) == "-0.0");
+    CHECK(fmt_double(1.0) == "1.0");
+    CHECK(fmt_double(-1.5) == "-1.5");
+    CHECK(fmt_double(0.1) == "0.1");
+    CHECK(fmt_double(0.1 + 0.2) == "0.30000000000000004");
+    CHECK(fmt_double(1234.5678) == "1234.5678");
+    CHECK(fmt_double(1e15) == "1000000000000000.0");
+    CHECK(fmt_double(1e16) == "1.0e+16");
+    CHECK(fmt_double(1.5e300) == "1.5e+300");
+    CHECK(fmt_double(1e-4) == "0.0001");
+    CHECK(fmt_double(1.5e-5) == "1.5e-05");
+    CHECK(fmt_double(1e23) == "1.0e+23");
+    CHECK(fmt_double(DBL_MAX) == "1.7976931348623157e+308");
+    CHECK(fmt_double(DBL_MIN) == "2.2250738585072014e-308");
+    CHECK(fmt_double(5e-324) == "5.0e-324");
+    CHECK(fmt_double(1e-323) == "1.0e-323");
+    CHECK(fmt_double(5e-323) == "5.0e-323");
+    CHECK(fmt_double(7e-323) == "7.0e-323");
+    CHECK(fmt_double(8e-323) == "8.0e-323");
+    CHECK(fmt_double(9e-323) == "9.0e-323");
+    CHECK(fmt_double(1.5e-323) == "1.5e-323");
+    CHECK(fmt_double(INFINITY) == "inf");
+    CHECK(fmt_double(-INFINITY) == "-inf");
+    CHECK(fmt_double(NAN) == "nan");
+
+    // random bits, subnormals and quotients of small integers
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 20000; ++i) {
+        uint64_t bits = rng();
+        double value;
+        if (i % 3 == 1) {
+            bits &= (1ull << 52) - 1;
+        }
+        std::memcpy(&value, &bits, sizeof(value));
+        if (i % 3 == 2) {
+            value = static_cast<double>(rng() % 100000) / static_cast<double>(1 + rng() % 1000);
+        }
+        if (!std::isfinite(value) || value == 0) {
+            continue;
+        }
+        std::string str = fmt_double(value);
+        REQUIRE(std::strtod(str.data(), nullptr) == value);
+        REQUIRE(significant_digits(str) == shortest_digits(value));
+    }
+
+    // the smallest subnormals have few digits
+    for (uint64_t bits = 1; bits < 2000; ++bits) {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        std::string str = fmt_double(value);
+        REQUIRE(std::strtod(str.data(), nullptr) == value);
+        REQUIRE(significant_digits(str) == shortest_digits(value));
+    }
+}
@@ -0,0 +1,91 @@
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "catch.hpp"
+
+#include "../output.h"
+#include "../unicode.h"
+
+
+// the bytes available from a nonblocking pipe
+static std::string read_pipe(int fd) {
+    std::string ans;
+    char chunk[4096];
+    ssize_t got;
+    while ((got = ::read(fd, chunk, sizeof(chunk))) > 0) {
+        ans.append(chunk, static_cast<size_t>(got));
+    }
+    return ans;
+}
+
+
+TEST_CASE("Test string output") {
+    StringOutput output;
+    output.write("abc");
+    output.put(' ');
+    output.write(USTRING("中\U0001F600"));
+    output.end_line();
+    CHECK(output.str() == "abc 中\U0001F600\n");
+
+    // larger than the buffer
+    std::string large(10000, 'x');
+    ustring ularge(5000, UCHAR('中'));
+    output.clear();
+    output.write(large);
+    output.write(ularge);
+    output.write(large.data(), 3);
+    CHECK(output.str() == large + u8_encode(ularge) + "xxx");
+
+    // 5 and 6 byte sequences at the end of the buffer
+    for (unichar ch : {static_cast<unichar>(0x3ffffff), static_cast<unichar>(0x7fffffff)}) {
+        for (size_t size = 4088; size < 4096; ++size) {
+            output.clear();
+            output.write(std::string(size, 'a'));
+            output.write(ustring(2, ch));
+            CHECK(output.str() == std::string(size, 'a') + u8_encode(ustring(2, ch)));
+        }
+    }
+}
+
+
+TEST_CASE("Test fd output") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    ::fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    SECTION("buffered") {
+        FdOutput output(fds[1], false);
+        output.write("a");
+        output.end_line();
+        CHECK(read_pipe(fds[0]) == "");
+        output.flush();
+        CHECK(read_pipe(fds[0]) == "a\n");
+        CHECK(output.error().empty());
+    }
+
+    SECTION("line buffered") {
+        FdOutput output(fds[1], true);
+        output.write("a");
+        CHECK(read_pipe(fds[0]) == "");
+        output.end_line();
+        CHECK(read_pipe(fds[0]) == "a\n");
+    }
+
+    SECTION("flushed when destroyed") {
+        {
+            FdOutput output(fds[1]);
+            output.write("b");
+        }
+        CHECK(read_pipe(fds[0]) == "b");
+    }
+
+    SECTION("error") {
+        FdOutput output(fds[0], false);
+        output.write("c");
+        output.flush();
+        CHECK_FALSE(output.error().empty());
+    }
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
@@ -7,8 +7,7 @@
 #include "helper_node.hpp"
 
 
-// XXX: copied from test_tokenizer.cpp
-std::vector<Token::Ptr> get_tokens(const std::string &input) {
+Node::Ptr parse_string(const std::string &input, bool repl = true) {
     Tokenizer tokenizer;
     for (auto ch : u8_decode(input)) {
         tokenizer.feed(ch);
@@ -16,17 +15,6 @@ std::vector<Token::Ptr> get_tokens(const std::string &input) {
     tokenizer.feed('\n');
     REQUIRE(tokenizer.is_ready());
 
-    std::vector<Token::Ptr> tokens;
-    Token::Ptr tok;
-    while ((tok = tokenizer.pop())) {
-        tokens.emplace_back(std::move(tok));
-    }
-    return tokens;
-}
-
-
-Node::Ptr parse_string(const std::string &input, bool repl = true) {
-    auto tokens = get_tokens(input);
     Parser parser;
     if (repl) {
         parser.start_repl();
@@ -34,10 +22,12 @@ Node::Ptr parse_string(const std::string &input, bool repl = true) {
         parser.start_program();
     }
 
-    for (const Token::Ptr &tok : tokens) {
+    while (const Token *tok = tokenizer.pop()) {
         parser.feed(*tok);
     }
-    REQUIRE(parser.can_end());
+    // errors are thrown from can_end()
+    bool can_end = parser.can_end();
+    REQUIRE(can_end);
     return parser.pop_result();
 }
 
@@ -248,6 +238,88 @@ TEST_CASE("Test function") {
 }
 
 
+// the tokens are pulled by the parser, a char is fed to the tokenizer at a time
+static Node::Ptr parse_program(const std::string &input, const SourceText *source = nullptr) {
+    Tokenizer tokenizer;
+    size_t fed = 0;
+    auto refill = [&]() {
+        if (fed > input.size()) {
+            return false;
+        }
+        tokenizer.feed(fed < input.size() ? input.data() + fed : "\n", 1);
+        ++fed;
+        return true;
+    };
+
+    Parser parser;
+    parser.set_lazy_source(source);
+    return parser.parse_program(tokenizer, refill);
+}
+
+
+static Node::Ptr parse_lazy(const std::string &input, const SourceText &source) {
+    return parse_program(input, &source);
+}
+
+
+TEST_CASE("Test lazy function") {
+    std::string input =
+        "let f = function (a, b = 1) { let s = \"}{\"; /* } */ if (a) { return b; } };\n"
+        "let g = function () { return function (c) { return c; }; };";
+    SourceText source(input.data(), input.size());
+    Node::Ptr lazy = parse_lazy(input, source);
+    Node::Ptr eager = parse_string(input, false);
+
+    auto get_func = [](Node::Ptr &prog, size_t i) -> E_Func & {
+        Node &stmt = *static_cast<Program &>(*prog).stmts[i];
+        return static_cast<E_Func &>(*static_cast<S_DeclareList &>(stmt).decls[0].initial);
+    };
+
+    E_Func &f = get_func(lazy, 0);
+    CHECK(f.attr.lazy_source == &source);
+    CHECK(static_cast<S_Block &>(*f.block).stmts.empty());
+    CHECK(*f.args == *get_func(eager, 0).args);
+    CHECK(f.block->pos_start == get_func(eager, 0).block->pos_start);
+    CHECK(f.block->pos_end == get_func(eager, 0).block->pos_end);
+
+    parse_lazy_body(f);
+    CHECK(f.attr.lazy_source == nullptr);
+    CHECK(f == get_func(eager, 0));
+    S_Block &body = static_cast<S_Block &>(*f.block);
+    S_Block &eager_body = static_cast<S_Block &>(*get_func(eager, 0).block);
+    CHECK(body.stmts[1]->pos_start == eager_body.stmts[1]->pos_start);
+
+    // nested functions stay lazy
+    E_Func &g = get_func(lazy, 1);
+    parse_lazy_body(g);
+    E_Func &inner = static_cast<E_Func &>(
+        *static_cast<S_Return &>(*static_cast<S_Block &>(*g.block).stmts[0]).value);
+    CHECK(inner.attr.lazy_source == &source);
+    parse_lazy_body(inner);
+    CHECK(g == get_func(eager, 1));
+
+    // braces are still matched
+    CHECK_THROWS_AS(parse_lazy("let h = function () { {};", source), ParserError);
+    CHECK_THROWS_AS(parse_lazy("let h = function () a;", source), ParserError);
+}
+
+
+TEST_CASE("Test lazy function error") {
+    std::string input = "let f = function () {\n    let a = ;\n};";
+    SourceText source(input.data(), input.size());
+    Node::Ptr prog = parse_lazy(input, source);
+    Node &stmt = *static_cast<Program &>(*prog).stmts[0];
+    E_Func &f = static_cast<E_Func &>(*static_cast<S_DeclareList &>(stmt).decls[0].initial);
+
+    try {
+        parse_lazy_body(f);
+        FAIL("no error");
+    } catch (ParserError &exc) {
+        CHECK(exc.pos_start == SourceLoc(34));
+    }
+}
+
+
 TEST_CASE("Test if-else") {
     check_stmt("if (a) {}", make_cond(V("a"), make_block({}), nullptr));
     check_stmt("if (a) {} else {}", make_cond(V("a"), make_block({}), make_block({})));
@@ -272,10 +344,32 @@ TEST_CASE("Test if-else") {
 
 TEST_CASE("Test loop") {
     check_stmt("while (a) {}", make_while(V("a"), make_block({})));
+    check_stmt(
+        "for (let i = 0, n) {}",
+        make_for_range("i", T(0), V("n"), nullptr, make_block({}))
+    );
+    check_stmt(
+        "for (let i = a = 1, n + 1, -1) {}",
+        make_for_range("i",
+            make_binop('=', V("a"), T(1)),
+            make_binop('+', V("n"), T(1)),
+            make_ops('-', {T(1)}),
+            make_block({}))
+    );
+    check_stmt(
+        "for (let x in a, L) { break; }",
+        make_for_in("x", make_ops(',', {V("a"), V("L")}), make_block({new S_Break()}))
+    );
+
+    CHECK_THROWS_AS(parse_string("for (i = 0, 1) {}"), ParserError);
+    CHECK_THROWS_AS(parse_string("for (let i = 0) {}"), ParserError);
+    CHECK_THROWS_AS(parse_string("for (let i = 0, 1, 2, 3) {}"), ParserError);
+    CHECK_THROWS_AS(parse_string("for (let i of L) {}"), ParserError);
+    CHECK_THROWS_AS(parse_string("for (let i in L) ;"), ParserError);
 }
 
 
-std::tuple<int, int> get_node_start_end(const std::string &input) {
+std::tuple<uint32_t, uint32_t> get_node_start_end(const std::string &input) {
     Node::Ptr node = parse_string(input);
     Node *target = nullptr;
     if (Program *prog = dynamic_cast<Program *>(node.get())) {
@@ -284,7 +378,7 @@ std::tuple<int, int> get_node_start_end(const std::string &input) {
     } else {
         target = node.get();
     }
-    return std::make_tuple(target->pos_start.rowno, target->pos_end.rowno);
+    return std::make_tuple(target->pos_start.offset, target->pos_end.offset);
 }
 
 
@@ -312,6 +406,7 @@ TEST_CASE("Test source pos") {
     CHECK(get_node_start_end("if (a) {}") == std::make_tuple(0, 8));
     CHECK(get_node_start_end("if (a) {} else {}") == std::make_tuple(0, 16));
     CHECK(get_node_start_end("while (a) {}") == std::make_tuple(0, 11));
+    CHECK(get_node_start_end("for (let x in a) {}") == std::make_tuple(0, 18));
 
     CHECK(get_node_start_end("[]") == std::make_tuple(0, 1));
     CHECK(get_node_start_end("[1]") == std::make_tuple(0, 2));
@@ -325,11 +420,86 @@ TEST_CASE("Test source pos") {
 
     Node::Ptr func = parse_string("function (a) {}");
     Node::Ptr &args = dynamic_cast<E_Func &>(*func).args;
-    CHECK(args->pos_start == SourcePos(0, 10));
-    CHECK(args->pos_end == SourcePos(0, 10));
+    CHECK(args->pos_start == SourceLoc(10));
+    CHECK(args->pos_end == SourceLoc(10));
 
     Node::Ptr call = parse_string("a(b)");
     E_Op &call_args = dynamic_cast<E_Op &>(*dynamic_cast<E_Op &>(*call).args[1]);
-    CHECK(call_args.pos_start.rowno == 2);
-    CHECK(call_args.pos_end.rowno == 2);
+    CHECK(call_args.pos_start.offset == 2);
+    CHECK(call_args.pos_end.offset == 2);
+
+    Node::Ptr chain = parse_string("1 + 2 + 3");
+    Node &inner = *dynamic_cast<E_Op &>(*chain).args[0];
+    CHECK(inner.pos_start.offset == 0);
+    CHECK(inner.pos_end.offset == 4);
+}
+
+
+// returns can_end() after feeding input
+bool feed_string(Parser &parser, const std::string &input) {
+    Tokenizer tokenizer;
+    for (auto ch : u8_decode(input)) {
+        tokenizer.feed(ch);
+    }
+    tokenizer.feed('\n');
+    parser.feed(tokenizer);
+    return parser.can_end();
+}
+
+
+TEST_CASE("Test incomplete input") {
+    Parser parser;
+    parser.start_repl();
+    CHECK_FALSE(feed_string(parser, "if (a) {"));
+    CHECK_FALSE(feed_string(parser, "b = [1,"));
+    CHECK_FALSE(feed_string(parser, "2]"));
+    CHECK(feed_string(parser, ";}"));
+    CHECK(*parser.pop_result() == *parse_string("if (a) { b = [1, 2]; }"));
+    CHECK(parser.is_empty());
+
+    parser.start_repl();
+    CHECK_FALSE(feed_string(parser, "1 +"));
+    CHECK(feed_string(parser, "2"));
+    CHECK(*parser.pop_result() == *parse_string("1 + 2"));
+
+    parser.start_program();
+    CHECK_FALSE(feed_string(parser, "while (a) {"));
+    CHECK_THROWS_AS(feed_string(parser, ")"), ParserError);
+
+    parser.start_program();
+    CHECK_THROWS_AS(feed_string(parser, "a"), ParserError);
+
+    // an error inside open brackets is found when they are closed
+    parser.start_program();
+    CHECK_FALSE(feed_string(parser, "let f = function(a) {"));
+    CHECK_FALSE(feed_string(parser, "return a a;"));
+    CHECK_THROWS_AS(feed_string(parser, "};"), ParserError);
+
+    parser.start_program();
+    CHECK_FALSE(feed_string(parser, "f([1, {"));
+    CHECK_THROWS_AS(feed_string(parser, "]"), ParserError);
+}
+
+
+TEST_CASE("Test parse program") {
+    std::string input =
+        "// the tokens of each statement are dropped once parsed\n"
+        "let long_name_1 = \"a long string\", long_name_2 = [long_name_1];\n"
+        "/* { */ if (long_name_1) { long_name_2 = long_name_1 + 1; } else { f(); }\n"
+        "let g = function (argument) { while (argument) { argument -= 1; } };";
+    CHECK(*parse_program(input) == *parse_string(input, false));
+
+    CHECK_THROWS_AS(parse_program("if (a) {"), ParserError);
+    CHECK_THROWS_AS(parse_program("a; b"), ParserError);
+    CHECK_THROWS_AS(parse_program("a; )"), ParserError);
+}
+
+
+TEST_CASE("Test nesting limit") {
+    auto nested = [](size_t depth, char open, const std::string &inner, char close) {
+        return std::string(depth, open) + inner + std::string(depth, close);
+    };
+    CHECK_THROWS_AS(parse_string(nested(2000, '(', "1", ')')), ParserError);
+    CHECK_THROWS_AS(parse_string(nested(2000, '{', "", '}')), ParserError);
+    CHECK_NOTHROW(parse_string(nested(100, '(', "1", ')')));
 }
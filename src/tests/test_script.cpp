@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "catch.hpp"
+
+#include "../script.h"
+
+
+// stderr of func
+template<class Func>
+static std::string capture_errors(Func func) {
+    std::ostringstream os;
+    std::streambuf *old = std::cerr.rdbuf(os.rdbuf());
+    func();
+    std::cerr.rdbuf(old);
+    return os.str();
+}
+
+
+TEST_CASE("Test check script files") {
+    std::string dir = "jbscript_test_scripts.tmp";
+    ::mkdir(dir.c_str(), 0755);
+    ::mkdir((dir + "/sub").c_str(), 0755);
+    std::vector<std::string> files {
+        dir + "/a.jb", dir + "/b.jb", dir + "/sub/c.jb", dir + "/sub/d.jb", dir + "/sub/e.txt",
+    };
+    std::vector<std::string> contents {
+        "let main = function() { return 1; };\n",
+        "let main = function() { return x; };\n",
+        "let main = function() { return 1 };\n",
+        "let main = function() { return 2; };\n",
+        "not a script",
+    };
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::ofstream fs(files[i], std::ios::binary);
+        fs << contents[i];
+    }
+
+    int status = -1;
+    std::string expected = capture_errors([&]() {
+        status = run_script_files_main({dir}, 1, true);
+    });
+    CHECK(status == 4);
+    // function bodies are checked, and errors are ordered by path
+    size_t name_error = expected.find(dir + "/b.jb: CompileError: No such name: x");
+    size_t syntax_error = expected.find(dir + "/sub/c.jb: ParserError:");
+    CHECK(name_error != std::string::npos);
+    CHECK(syntax_error != std::string::npos);
+    CHECK(name_error < syntax_error);
+    CHECK(expected.find("a.jb") == std::string::npos);
+    CHECK(expected.find("e.txt") == std::string::npos);
+
+    for (unsigned jobs : {2u, 4u, 16u}) {
+        std::string errors = capture_errors([&]() {
+            status = run_script_files_main({dir}, jobs, true);
+        });
+        CHECK(status == 4);
+        CHECK(errors == expected);
+    }
+
+    std::string errors = capture_errors([&]() {
+        status = run_script_files_main({files[3], dir + "/missing.jb", files[0]}, 2, false);
+    });
+    CHECK(status == 7);
+    CHECK(errors.find(dir + "/missing.jb: IOError:") == 0);
+
+    for (const std::string &file : files) {
+        std::remove(file.c_str());
+        std::remove((file + "c").c_str());
+    }
+    ::rmdir((dir + "/sub").c_str());
+    ::rmdir(dir.c_str());
+}
@@ -1,3 +1,5 @@
+#include <vector>
+
 #include "catch.hpp"
 
 #include "../sourcepos.h"
@@ -7,27 +9,34 @@ TEST_CASE("Test SourcePos") {
     TracableSourcePos pos;
     CHECK_FALSE(pos.is_valid());
 
-    pos.add_char('a');
-    CHECK(pos.lineno == 0);
-    CHECK(pos.rowno == 0);
+    pos.add_char();
+    CHECK(pos == SourceLoc(0));
     CHECK(pos.is_valid());
 
-    pos.add_char('b');
-    CHECK(pos.lineno == 0);
-    CHECK(pos.rowno == 1);
-
-    pos.add_char('\n');
-    CHECK(pos.lineno == 0);
-    CHECK(pos.rowno == 2);
+    pos.add_char();
+    CHECK(pos.offset == 1);
 
-    pos.add_char('c');
-    CHECK(pos.lineno == 1);
-    CHECK(pos.rowno == 0);
+    const char *run = "a\xe5\x9d\x97\n";
+    pos.add_u8_run(run, run + 5);
+    CHECK(pos.offset == 4);
 
     pos = TracableSourcePos();
-    pos.add_char('\n');
-    CHECK(pos == SourcePos(0, 0));
+    pos.add_u8_run(run, run + 5);
+    CHECK(pos == SourceLoc(2));
+
+    pos = TracableSourcePos(10);
+    pos.add_char();
+    CHECK(pos == SourceLoc(10));
+}
+
 
-    pos.add_char('a');
-    CHECK(pos == SourcePos(1, 0));
+TEST_CASE("Test find source pos") {
+    std::vector<ustring> lines = {USTRING("ab\n"), USTRING("\n"), USTRING("c\n")};
+    CHECK(find_source_pos(lines, SourceLoc(0)) == SourcePos(0, 0));
+    CHECK(find_source_pos(lines, SourceLoc(2)) == SourcePos(0, 2));
+    CHECK(find_source_pos(lines, SourceLoc(3)) == SourcePos(1, 0));
+    CHECK(find_source_pos(lines, SourceLoc(4)) == SourcePos(2, 0));
+    CHECK(find_source_pos(lines, SourceLoc(5)) == SourcePos(2, 1));
+    CHECK_FALSE(find_source_pos(lines, SourceLoc(6)).is_valid());
+    CHECK_FALSE(find_source_pos(lines, SourceLoc()).is_valid());
 }
@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <vector>
 #include "catch.hpp"
 
+#include "../exceptions.h"
 #include "../tokenizer.h"
+#include "../unicode.h"
 
 
 TEST_CASE("Test tokencode_to_string") {
@@ -10,30 +15,30 @@ TEST_CASE("Test tokencode_to_string") {
 }
 
 
-std::vector<Token::Ptr> get_tokens(const std::string &input) {
-    Tokenizer tokenizer;
+// the text of tokens is owned by the tokenizer
+std::vector<Token> get_tokens(Tokenizer &tokenizer, const std::string &input) {
     for (auto ch : u8_decode(input)) {
         tokenizer.feed(ch);
     }
     tokenizer.feed('\n');
     REQUIRE(tokenizer.is_ready());
 
-    std::vector<Token::Ptr> tokens;
-    Token::Ptr tok;
-    while ((tok = tokenizer.pop())) {
-        tokens.emplace_back(std::move(tok));
+    std::vector<Token> tokens;
+    while (const Token *tok = tokenizer.pop()) {
+        tokens.push_back(*tok);
     }
     return tokens;
 }
 
 
 void check_single_chars(const std::string &input) {
-    auto tokens = get_tokens(input);
+    Tokenizer tokenizer;
+    auto tokens = get_tokens(tokenizer, input);
 
     std::string got;
     for (const auto &tok : tokens) {
-        CHECK(static_cast<uint32_t>(tok->tokencode) < 0xff);
-        got.push_back(static_cast<char>(tok->tokencode));
+        CHECK(static_cast<uint32_t>(tok.tokencode) < 0xff);
+        got.push_back(static_cast<char>(tok.tokencode));
     }
     CHECK(got == input);
 }
@@ -63,9 +68,10 @@ std::vector<std::string> split(const std::string &input) {
 
 
 void check_multi_chars(const std::string &input) {
+    Tokenizer tokenizer;
     std::vector<TokenCode> got;
-    for (const Token::Ptr &tok : get_tokens(input)) {
-        got.emplace_back(tok->tokencode);
+    for (const Token &tok : get_tokens(tokenizer, input)) {
+        got.emplace_back(tok.tokencode);
     }
 
     std::vector<TokenCode> expected;
@@ -82,33 +88,192 @@ TEST_CASE("Test multi-char operator") {
 }
 
 
-void check_tokens(const std::string &input, const std::vector<Token *> &expected) {
-    std::vector<Token::Ptr> expected_wrapped;
-    for (Token *tok : expected) {
-        expected_wrapped.emplace_back(tok);
-    }
-
-    auto tokens = get_tokens(input);
-    REQUIRE(tokens.size() == expected.size());
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        CHECK(*tokens[i] == *expected[i]);
+void check_tokens(const std::string &input, const std::vector<std::string> &expected) {
+    Tokenizer tokenizer;
+    std::vector<std::string> got;
+    for (const Token &tok : get_tokens(tokenizer, input)) {
+        got.push_back(tok.repr_short());
     }
+    CHECK(got == expected);
 }
 
 
 TEST_CASE("Test basic") {
-    check_tokens("123", {new TokenInt(123)});
-    check_tokens("asdf", {new TokenId(USTRING("asdf"))});
+    check_tokens("123", {"Tok:INT 123"});
+    check_tokens("asdf", {"Tok:ID asdf"});
     check_tokens(
         "asdf // 123\n"
         "qwer /* asdf\n"
         "*123 */ 1.0e-3",
         {
-            new TokenId(USTRING("asdf")),
-            new TokenComment(USTRING(" 123")),
-            new TokenId(USTRING("qwer")),
-            new TokenComment(USTRING(" asdf\n*123 ")),
-            new TokenFloat(1e-3),
+            "Tok:ID asdf",
+            "Tok:CMT  123",
+            "Tok:ID qwer",
+            "Tok:CMT  asdf\n*123 ",
+            "Tok:FLT 0.001000",
         }
     );
 }
+
+
+TEST_CASE("Test keywords") {
+    std::vector<std::pair<std::string, TokenCode>> keywords = {
+        {"let", TokenCode::KW_LET},
+        {"if", TokenCode::KW_IF},
+        {"else", TokenCode::KW_ELSE},
+        {"while", TokenCode::KW_WHILE},
+        {"for", TokenCode::KW_FOR},
+        {"in", TokenCode::KW_IN},
+        {"return", TokenCode::KW_RETURN},
+        {"break", TokenCode::KW_BREAK},
+        {"continue", TokenCode::KW_CONTINUE},
+        {"function", TokenCode::KW_FUNCTION},
+        {"null", TokenCode::KW_NULL},
+        {"true", TokenCode::KW_TRUE},
+        {"false", TokenCode::KW_FALSE},
+    };
+    for (const auto &pair : keywords) {
+        CHECK(keyword_to_tokencode(u8_decode(pair.first)) == pair.second);
+    }
+    for (const char *id : {"", "i", "le", "lets", "fo", "nul", "True", "functions", "elif"}) {
+        CHECK(keyword_to_tokencode(u8_decode(id)) == TokenCode::ID);
+    }
+
+    check_tokens(
+        "let lets = if_ in null;",
+        {"Tok:LET ", "Tok:ID lets", "Tok:= ", "Tok:ID if_", "Tok:IN ", "Tok:NULL ", "Tok:; "}
+    );
+}
+
+
+std::vector<Token> get_tokens_bulk(
+    Tokenizer &tokenizer, const std::string &input, size_t chunk_size)
+{
+    for (size_t start = 0; start < input.size(); start += chunk_size) {
+        tokenizer.feed(input.data() + start, std::min(chunk_size, input.size() - start));
+    }
+    tokenizer.feed("\n", 1);
+    REQUIRE(tokenizer.is_ready());
+
+    std::vector<Token> tokens;
+    while (const Token *tok = tokenizer.pop()) {
+        tokens.push_back(*tok);
+    }
+    return tokens;
+}
+
+
+TEST_CASE("Test bulk feed") {
+    std::string input =
+        "let abc_1 = [1, 23, 4.56e+7];\n"
+        "\t\"str \\u4e2d\\\"\xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x98\x80\" // \xe6\xb3\xa8\xe9\x87\x8a\n"
+        "/* \xe5\x9d\x97 ** 2\n */ x += .5 >= a_b || !c";
+
+    Tokenizer expected_tokenizer;
+    auto expected = get_tokens(expected_tokenizer, input);
+    REQUIRE(expected.size() == 22);
+    for (size_t chunk_size = 1; chunk_size <= input.size(); ++chunk_size) {
+        Tokenizer tokenizer;
+        auto tokens = get_tokens_bulk(tokenizer, input, chunk_size);
+        REQUIRE(tokens.size() == expected.size());
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            CHECK(tokens[i] == expected[i]);
+            CHECK(tokens[i].pos_start == expected[i].pos_start);
+            CHECK(tokens[i].pos_end == expected[i].pos_end);
+        }
+    }
+
+    // bad utf-8, also when split between inputs
+    Tokenizer tokenizer;
+    CHECK_THROWS_AS(tokenizer.feed("\"\xe4\x41\"", 4), DecodeError);
+    tokenizer.reset();
+    tokenizer.feed("// \xe4", 4);
+    CHECK_FALSE(tokenizer.is_ready());
+    CHECK_THROWS_AS(tokenizer.feed("\n", 1), DecodeError);
+    tokenizer.reset();
+    CHECK_THROWS_AS(tokenizer.feed("\xff", 1), DecodeError);
+}
+
+
+TEST_CASE("Test token ring buffer") {
+    Tokenizer tokenizer;
+    std::string input;
+    for (int i = 0; i < 1000; ++i) {
+        input += "a" + std::to_string(i) + " " + std::to_string(i) + " ";
+    }
+
+    // the ring grows while tokens are not popped, and slots are reused after
+    for (int round = 0; round < 3; ++round) {
+        tokenizer.feed(input.data(), input.size());
+        for (int i = 0; i < 1000; ++i) {
+            const Token *id = tokenizer.pop();
+            REQUIRE(id != nullptr);
+            CHECK(id->tokencode == TokenCode::ID);
+            CHECK(*id->text == u8_decode("a" + std::to_string(i)));
+            const Token *num = tokenizer.pop();
+            REQUIRE(num != nullptr);
+            CHECK(num->int_value == i);
+        }
+        CHECK(tokenizer.pop() == nullptr);
+    }
+}
+
+
+TEST_CASE("Test number literal") {
+    auto get_number = [](const std::string &input) {
+        Tokenizer tokenizer;
+        std::vector<Token> tokens = get_tokens(tokenizer, input);
+        REQUIRE(tokens.size() == 1);
+
+        // parsed in place when the literal is terminated in the input
+        Tokenizer bulk_tokenizer;
+        std::string terminated = input + "\n";
+        bulk_tokenizer.feed(terminated.data(), terminated.size());
+        const Token *bulk = bulk_tokenizer.pop();
+        REQUIRE(bulk != nullptr);
+        CHECK(*bulk == tokens[0]);
+        CHECK(bulk->pos_end == tokens[0].pos_end);
+        return tokens[0];
+    };
+    auto check_float = [&](const std::string &input, double expected) {
+        Token tok = get_number(input);
+        REQUIRE(tok.tokencode == TokenCode::FLOAT);
+        CHECK(tok.float_value == expected);
+    };
+    auto check_int = [&](const std::string &input, int64_t expected) {
+        Token tok = get_number(input);
+        REQUIRE(tok.tokencode == TokenCode::INT);
+        CHECK(tok.int_value == expected);
+    };
+
+    check_int("0", 0);
+    check_int("007", 7);
+    check_int("12e3", 12000);
+    check_int("0e999999999999", 0);
+    check_int("9223372036854775807", std::numeric_limits<int64_t>::max());
+    check_float("9223372036854775808", 9223372036854775808.0);
+    check_float("1e19", 1e19);
+    check_float("1e-0", 1.0);
+
+    // correctly rounded, including beyond the fast path
+    check_float("0.1", 0.1);
+    check_float(".5", 0.5);
+    check_float("3.", 3.0);
+    check_float("1.7976931348623157e308", 1.7976931348623157e308);
+    check_float("2.2250738585072014e-308", 2.2250738585072014e-308);
+    check_float("4.9e-324", 4.9e-324);
+    check_float("1e-400", 0.0);
+    check_float("0.30000000000000004441", 0.30000000000000004441);
+    check_float("9007199254740993.0", 9007199254740992.0);  // ties to even
+    check_float("123456789012345678901234567890e-10", 12345678901234567890.1234567890);
+    check_float("0.000000000000000000000000000001", 1e-30);
+
+    Tokenizer tokenizer;
+    CHECK_THROWS_AS(get_tokens(tokenizer, "1e309"), TokenizerError);
+    tokenizer.reset();
+    CHECK_THROWS_AS(tokenizer.feed("1e309 ", 6), TokenizerError);
+    for (const char *bad : {"1e ", "1e+ ", ". "}) {
+        tokenizer.reset();
+        CHECK_THROWS_AS(tokenizer.feed(bad, std::strlen(bad)), TokenizerError);
+    }
+}
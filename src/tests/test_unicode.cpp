@@ -84,3 +84,43 @@ TEST_CASE("Test DecodeError") {
     CHECK_THROWS_WITH(u8_decode(buf), Contains("truncate"));
     CHECK_THROWS_AS(u8_decode(std::string(buf)), DecodeError);
 }
+
+
+TEST_CASE("Test char class") {
+    for (unichar ch = 0; ch < 0x100; ++ch) {
+        bool space = ('\t' <= ch && ch <= '\r') || ch == ' ';
+        bool digit = '0' <= ch && ch <= '9';
+        bool alpha = ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z');
+        bool xdigit = digit || ('a' <= ch && ch <= 'f') || ('A' <= ch && ch <= 'F');
+        CHECK(is_space(ch) == space);
+        CHECK(is_digit(ch) == digit);
+        CHECK(is_alpha(ch) == alpha);
+        CHECK(is_xdigit(ch) == xdigit);
+        CHECK(has_char_class(ch, CHAR_WORD) == (alpha || digit || ch == '_'));
+    }
+    CHECK_FALSE(is_space(0x3000));  // ideographic space
+    CHECK_FALSE(is_alpha(0x10000 + 'a'));
+}
+
+
+TEST_CASE("Test unicode encode/decode long runs") {
+    // non-ascii chars at every offset of ascii runs, across the 16 bytes blocks
+    for (size_t prefix = 0; prefix < 40; ++prefix) {
+        for (const char *mb : {"\xc3\xa9", "\xe4\xb8\xad", "\xf0\x9f\x98\x80"}) {
+            std::string str = std::string(prefix, 'a') + mb + std::string(prefix % 19, 'b');
+            ustring expected;
+            for (const char *p = str.data(); *p != 0; p += u8_read_char_len(p)) {
+                expected.push_back(u8_read_char(p));
+            }
+
+            ustring decoded = u8_decode(str);
+            REQUIRE(decoded == expected);
+            CHECK(u8_encode(decoded) == str);
+        }
+    }
+
+    std::string ascii(100, 'x');
+    CHECK_THROWS_WITH(u8_decode(ascii + "\xe4\x41" + ascii), Contains("\\x41"));
+    CHECK_THROWS_WITH(u8_decode(ascii + "\xff" + ascii), Contains("\\xff"));
+    CHECK_THROWS_AS(u8_decode(ascii + "\xe4\xb8"), DecodeError);
+}
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
 #include <limits>
 #include <utility>
 
@@ -22,8 +24,119 @@ std::string tokencode_to_string(TokenCode tc) {
 }
 
 
+namespace {
+
+struct Keyword {
+    const char *word;
+    TokenCode tokencode;
+};
+
+
+constexpr size_t KEYWORD_TABLE_SIZE = 32;
+
+
+// (len + first * 5 + last * 6) % 32 is a perfect hash of keywords
+template<class Str>
+constexpr size_t keyword_hash(const Str &word, size_t len) {
+    return (len + static_cast<size_t>(word[0]) * 5 + static_cast<size_t>(word[len - 1]) * 6)
+        % KEYWORD_TABLE_SIZE;
+}
+
+
+constexpr Keyword keyword_table[KEYWORD_TABLE_SIZE] = {
+    {nullptr, TokenCode::ID},
+    {"false", TokenCode::KW_FALSE},         // 1
+    {nullptr, TokenCode::ID},
+    {"in", TokenCode::KW_IN},               // 3
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {"true", TokenCode::KW_TRUE},           // 6
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {"for", TokenCode::KW_FOR},             // 13
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {"break", TokenCode::KW_BREAK},         // 17
+    {"null", TokenCode::KW_NULL},           // 18
+    {"if", TokenCode::KW_IF},               // 19
+    {"return", TokenCode::KW_RETURN},       // 20
+    {"continue", TokenCode::KW_CONTINUE},   // 21
+    {"while", TokenCode::KW_WHILE},         // 22
+    {"let", TokenCode::KW_LET},             // 23
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {"function", TokenCode::KW_FUNCTION},   // 26
+    {"else", TokenCode::KW_ELSE},           // 27
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+    {nullptr, TokenCode::ID},
+};
+
+
+constexpr size_t const_strlen(const char *s) {
+    size_t len = 0;
+    while (s[len] != '\0') {
+        ++len;
+    }
+    return len;
+}
+
+
+constexpr bool is_keyword_table_valid() {
+    for (size_t i = 0; i < KEYWORD_TABLE_SIZE; ++i) {
+        const char *word = keyword_table[i].word;
+        if (word != nullptr && keyword_hash(word, const_strlen(word)) != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static_assert(is_keyword_table_valid(), "keyword is not in its hash slot");
+
+}   // namespace
+
+
+TokenCode keyword_to_tokencode(const ustring &id) {
+    if (id.empty()) {
+        return TokenCode::ID;
+    }
+    const Keyword &kw = keyword_table[keyword_hash(id, id.size())];
+    if (kw.word == nullptr) {
+        return TokenCode::ID;
+    }
+    for (size_t i = 0; i < id.size(); ++i) {
+        if (kw.word[i] == '\0' || static_cast<unichar>(kw.word[i]) != id[i]) {
+            return TokenCode::ID;
+        }
+    }
+    return kw.word[id.size()] == '\0' ? kw.tokencode : TokenCode::ID;
+}
+
+
 bool Token::operator==(const Token &rhs) const {
-    return this->tokencode == rhs.tokencode;
+    if (this->tokencode != rhs.tokencode) {
+        return false;
+    }
+    switch (this->tokencode) {
+    case TokenCode::INT:
+        return this->int_value == rhs.int_value;
+    case TokenCode::FLOAT:
+        return this->float_value == rhs.float_value;
+    case TokenCode::ID:
+    case TokenCode::STRING:
+    case TokenCode::COMMENT:
+        return *this->text == *rhs.text;
+    default:
+        return true;
+    }
 }
 
 
@@ -32,6 +145,13 @@ bool Token::operator!=(const Token &rhs) const {
 }
 
 
+bool Token::has_text() const {
+    return this->tokencode == TokenCode::ID
+        || this->tokencode == TokenCode::STRING
+        || this->tokencode == TokenCode::COMMENT;
+}
+
+
 std::string Token::name() const {
     return "Tok:" + tokencode_to_string(this->tokencode);
 }
@@ -51,18 +171,347 @@ std::string Token::repr_short() const {
 
 
 std::string Token::repr_value() const {
-    return "";
+    if (this->tokencode == TokenCode::INT) {
+        return std::to_string(this->int_value);
+    } else if (this->tokencode == TokenCode::FLOAT) {
+        return std::to_string(this->float_value);
+    } else if (this->has_text()) {
+        return u8_encode(*this->text);
+    } else {
+        return "";
+    }
 }
 
 
 void Tokenizer::feed(unichar ch) {
     // TODO: limit stack depth
     this->prev_pos = this->cur_pos;
-    this->cur_pos.add_char(ch);
+    this->cur_pos.add_char();
     this->refeed(ch);
 }
 
 
+void Tokenizer::feed(const char *utf8, size_t len) {
+    const char *p = utf8;
+    const char *end = utf8 + len;
+
+    // complete the char split by the last input
+    while (!this->partial_char.empty() && p < end) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        if ((byte >> 6) != 0b10) {
+            throw DecodeError("Bad following char", byte);
+        }
+        this->partial_char.push_back(byte);
+        if (static_cast<int>(this->partial_char.size()) == u8_read_char_len(this->partial_char.data())) {
+            unichar ch = u8_read_char(this->partial_char.data());
+            this->partial_char.clear();
+            this->feed(ch);
+        }
+    }
+
+    while (p < end) {
+        const char *run_end = this->feed_run(p, end);
+        if (run_end != p) {
+            p = run_end;
+            continue;
+        }
+
+        // a char which may change the state
+        int clen = u8_read_char_len(p);
+        if (clen > end - p) {
+            this->partial_char.assign(p, end);
+            break;
+        }
+        this->feed(u8_read_char(p));
+        p += clen;
+    }
+}
+
+
+static bool is_bracket_char(unichar ch) {
+    switch (ch) {
+    case '[': case ']': case '{': case '}': case '(': case ')': case ',': case ';':
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+// appends chars to value until stop() on an ascii byte or a char truncated by end
+template<class StopFunc>
+static const char *u8_append_until(const char *p, const char *end, ustring &value, StopFunc stop) {
+    while (p < end) {
+        uint8_t byte = static_cast<uint8_t>(*p);
+        if (byte < 0x80) {
+            if (stop(byte)) {
+                break;
+            }
+            value.push_back(byte);
+            ++p;
+        } else {
+            int clen = u8_read_char_len(p);
+            if (clen > end - p) {
+                break;
+            }
+            value.push_back(u8_read_char(p));
+            p += clen;
+        }
+    }
+    return p;
+}
+
+
+template<class StopFunc>
+static const char *ascii_append_until(const char *p, const char *end, std::string &value, StopFunc stop) {
+    const char *begin = p;
+    while (p < end && !stop(static_cast<uint8_t>(*p))) {
+        ++p;
+    }
+    value.append(begin, p);
+    return p;
+}
+
+
+namespace {
+
+// digits of a number literal, either in the source or in NumberState
+struct DecimalParts {
+    const char *int_begin;
+    const char *int_end;
+    const char *frac_begin;
+    const char *frac_end;
+    int64_t exp;
+    bool is_float;      // has dot or negative exponent
+};
+
+
+// exact powers of ten representable by double
+const double EXACT_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+
+// saturated, digits beyond are irrelevant to any double
+int64_t digits_to_exp(const char *begin, const char *end) {
+    static const int64_t MAX_EXP = 1000000;
+    int64_t exp = 0;
+    for (; begin < end; ++begin) {
+        exp = std::min(exp * 10 + (*begin - '0'), MAX_EXP);
+    }
+    return exp;
+}
+
+
+// false if overflows
+bool digits_to_int(const char *begin, const char *end, int64_t exp, int64_t &value) {
+    const uint64_t limit = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+    uint64_t ans = 0;
+    for (; begin < end; ++begin) {
+        uint64_t digit = static_cast<uint64_t>(*begin - '0');
+        if (ans > (limit - digit) / 10) {
+            return false;
+        }
+        ans = ans * 10 + digit;
+    }
+    for (int64_t i = 0; i < exp && ans != 0; ++i) {
+        if (ans > limit / 10) {
+            return false;
+        }
+        ans *= 10;
+    }
+    value = static_cast<int64_t>(ans);
+    return true;
+}
+
+
+// correctly rounded
+double decimal_to_double(const DecimalParts &parts) {
+    uint64_t mantissa = 0;
+    int ndigits = 0;
+    bool truncated = false;
+    int64_t exp = parts.exp - (parts.frac_end - parts.frac_begin);
+
+    auto add_digits = [&](const char *begin, const char *end) {
+        for (; begin < end; ++begin) {
+            if (ndigits == 0 && *begin == '0') {
+                continue;
+            } else if (ndigits < 19) {
+                mantissa = mantissa * 10 + (*begin - '0');
+                ndigits++;
+            } else {
+                truncated = truncated || *begin != '0';
+                exp++;
+            }
+        }
+    };
+    add_digits(parts.int_begin, parts.int_end);
+    add_digits(parts.frac_begin, parts.frac_end);
+
+    if (mantissa == 0) {
+        return 0.0;
+    }
+    // Clinger's fast path, the mantissa and the power of ten are both exact, so the result
+    // is rounded only once
+    if (!truncated && mantissa <= (1ull << 53) && -22 <= exp && exp <= 22) {
+        double value = static_cast<double>(mantissa);
+        if (exp >= 0) {
+            return value * EXACT_POWERS_OF_TEN[exp];
+        } else {
+            return value / EXACT_POWERS_OF_TEN[-exp];
+        }
+    }
+
+    // strtod() rounds correctly, no decimal point so it does not depend on locale
+    std::string normalized(parts.int_begin, parts.int_end);
+    normalized.append(parts.frac_begin, parts.frac_end);
+    normalized += "e" + std::to_string(parts.exp - (parts.frac_end - parts.frac_begin));
+    return std::strtod(normalized.data(), nullptr);
+}
+
+
+void decimal_to_token(const DecimalParts &parts, Token &tok) {
+    int64_t iv;
+    if (!parts.is_float && digits_to_int(parts.int_begin, parts.int_end, parts.exp, iv)) {
+        tok.tokencode = TokenCode::INT;
+        tok.int_value = iv;
+    } else {
+        tok.tokencode = TokenCode::FLOAT;
+        tok.float_value = decimal_to_double(parts);
+    }
+}
+
+
+const char *scan_digits(const char *p, const char *end) {
+    while (p < end && is_digit(static_cast<uint8_t>(*p))) {
+        ++p;
+    }
+    return p;
+}
+
+
+// Scans a whole number literal in the input, see Tokenizer::st_number() for the syntax. Returns
+// nullptr if the literal is malformed or may continue after end, both left to st_number().
+const char *scan_number(const char *p, const char *end, DecimalParts &parts) {
+    parts.int_begin = p;
+    parts.int_end = p = scan_digits(p, end);
+    parts.frac_begin = parts.frac_end = p;
+    parts.exp = 0;
+    parts.is_float = false;
+
+    if (p < end && *p == '.') {
+        parts.is_float = true;
+        parts.frac_begin = ++p;
+        parts.frac_end = p = scan_digits(p, end);
+        if (parts.int_begin == parts.int_end && parts.frac_begin == parts.frac_end) {
+            return nullptr;     // leading dot without digits
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        int sign = 1;
+        if (p < end && (*p == '+' || *p == '-')) {
+            sign = *p == '-' ? -1 : 1;
+            ++p;
+        }
+        const char *exp_begin = p;
+        p = scan_digits(p, end);
+        if (p == exp_begin) {
+            return nullptr;
+        }
+        parts.exp = digits_to_exp(exp_begin, p) * sign;
+        parts.is_float = parts.is_float || sign < 0;
+    }
+    // the terminator must be seen
+    return p < end ? p : nullptr;
+}
+
+}   // namespace
+
+
+// Consumes chars that keep the tokenizer in its current state, so the bulk of the input
+// skips the per-char dispatch. The char ending the run is left to feed(unichar).
+const char *Tokenizer::feed_run(const char *begin, const char *end) {
+    const char *p = begin;
+    switch (this->state) {
+    case TokenizerState::INIT:
+        while (p < end) {
+            uint8_t byte = static_cast<uint8_t>(*p);
+            if (is_space(byte)) {
+                ++p;
+            } else if (is_bracket_char(byte)) {
+                ++p;
+                this->cur_pos.add_u8_run(begin, p);
+                begin = p;
+
+                this->emit(static_cast<TokenCode>(byte), this->cur_pos, this->cur_pos);
+            } else if (is_digit(byte) || byte == '.') {
+                // a number literal in place
+                DecimalParts parts;
+                const char *num_end = scan_number(p, end, parts);
+                if (num_end == nullptr) {
+                    break;
+                }
+                this->cur_pos.add_u8_run(begin, p + 1);
+                SourceLoc num_start = this->cur_pos;
+                this->cur_pos.add_u8_run(p + 1, num_end);
+                begin = p = num_end;
+
+                Token tok;
+                decimal_to_token(parts, tok);
+                this->emit_number(tok, num_start, this->cur_pos);
+            } else {
+                break;
+            }
+        }
+        break;
+    case TokenizerState::ID:
+        while (p < end && has_char_class(static_cast<uint8_t>(*p), CHAR_WORD)) {
+            this->id_state.value.push_back(static_cast<uint8_t>(*p));
+            ++p;
+        }
+        break;
+    case TokenizerState::NUMBER: {
+        auto not_digit = [](uint8_t byte) { return !is_digit(byte); };
+        NumberState &ns = this->num_state;
+        if (ns.state == NumberSubState::INT_DIGIT) {
+            p = ascii_append_until(p, end, ns.int_digits, not_digit);
+        } else if (ns.state == NumberSubState::DOTTED) {
+            p = ascii_append_until(p, end, ns.dot_digits, not_digit);
+        } else if (ns.state == NumberSubState::EXP_DIGIT) {
+            p = ascii_append_until(p, end, ns.exp_digits, not_digit);
+        }
+        break;
+    }
+    case TokenizerState::STRING:
+        if (this->string_state.state == StringSubState::NORMAL) {
+            p = u8_append_until(p, end, this->string_state.value, [](uint8_t byte) {
+                return byte == '"' || byte == '\\' || byte < 0x20;
+            });
+        }
+        break;
+    case TokenizerState::LINE_COMMENT:
+        p = u8_append_until(p, end, this->line_cmt_state.value, [](uint8_t byte) {
+            return byte == '\n';
+        });
+        break;
+    case TokenizerState::BLOCK_COMMENT:
+        if (this->block_cmt_state.state == BlockCommentSubState::NORMAL) {
+            p = u8_append_until(p, end, this->block_cmt_state.value, [](uint8_t byte) {
+                return byte == '*';
+            });
+        }
+        break;
+    default:
+        break;
+    }
+
+    this->cur_pos.add_u8_run(begin, p);
+    return p;
+}
+
+
 void Tokenizer::refeed(unichar ch) {
     switch (this->state) {
     case TokenizerState::INIT:
@@ -84,37 +533,166 @@ void Tokenizer::refeed(unichar ch) {
 }
 
 
-Token::Ptr Tokenizer::pop() {
-    if (!this->buffer.empty()) {
-        Token::Ptr ret = std::move(this->buffer.front());
-        this->buffer.pop();
-        return ret;
-    } else {
-        return Token::Ptr();
+const Token *Tokenizer::pop() {
+    if (this->ring_count == 0) {
+        return nullptr;
+    }
+    const Token *tok = &this->ring[this->ring_head];
+    this->ring_head = (this->ring_head + 1) & (this->ring.size() - 1);
+    this->ring_count--;
+    return tok;
+}
+
+
+const Token *Tokenizer::pop(ustring &text) {
+    const Token *tok = this->pop();
+    if (tok != nullptr && tok->has_text()) {
+        text.swap(this->ring_text[tok - this->ring.data()]);
+    }
+    return tok;
+}
+
+
+Token &Tokenizer::emit(TokenCode tc, const SourceLoc &pos_start, const SourceLoc &pos_end) {
+    if (this->ring_count == this->ring.size()) {
+        this->grow_ring();
+    }
+    size_t index = (this->ring_head + this->ring_count) & (this->ring.size() - 1);
+    this->ring_count++;
+
+    Token &tok = this->ring[index];
+    tok = Token(tc);
+    tok.pos_start = pos_start;
+    tok.pos_end = pos_end;
+    return tok;
+}
+
+
+// takes the value, which is left empty
+void Tokenizer::emit_text(
+    TokenCode tc, ustring &value, const SourceLoc &pos_start, const SourceLoc &pos_end)
+{
+    Token &tok = this->emit(tc, pos_start, pos_end);
+    ustring &text = this->ring_text[&tok - this->ring.data()];
+    // swap to keep the capacity of both
+    text.swap(value);
+    value.clear();
+    tok.text = &text;
+}
+
+
+void Tokenizer::grow_ring() {
+    static const size_t MIN_RING_SIZE = 64;
+    size_t new_size = std::max(MIN_RING_SIZE, this->ring.size() * 2);   // power of two
+
+    std::vector<Token> tokens(new_size);
+    std::vector<ustring> texts(new_size);
+    for (size_t i = 0; i < this->ring_count; ++i) {
+        size_t index = (this->ring_head + i) & (this->ring.size() - 1);
+        tokens[i] = this->ring[index];
+        texts[i].swap(this->ring_text[index]);
+        if (tokens[i].has_text()) {
+            tokens[i].text = &texts[i];
+        }
     }
+
+    this->ring.swap(tokens);
+    this->ring_text.swap(texts);
+    this->ring_head = 0;
 }
 
 
 bool Tokenizer::is_ready() const {
-    return this->state == TokenizerState::INIT;
+    return this->state == TokenizerState::INIT && this->partial_char.empty();
 }
 
 
+// the ring buffers are kept for the next input
 void Tokenizer::reset() {
-    *this = Tokenizer();
+    this->state = TokenizerState::INIT;
+    this->ring_head = 0;
+    this->ring_count = 0;
+    this->start_pos = SourceLoc();
+    this->prev_pos = SourceLoc();
+    this->cur_pos = TracableSourcePos();
+    this->op_state = OpState {};
+    this->string_state = StringState {};
+    this->num_state = NumberState {};
+    this->id_state = IdState {};
+    this->line_cmt_state = LineCommentState {};
+    this->block_cmt_state = BlockCommentState {};
+    this->partial_char.clear();
+}
+
+
+void Tokenizer::start_at(SourceLoc loc) {
+    assert(this->state == TokenizerState::INIT && this->partial_char.empty());
+    this->cur_pos = TracableSourcePos(loc.offset);
+}
+
+
+namespace {
+
+constexpr char OP_CHARS[] = "+-*/%<>=!&|";
+constexpr size_t NUM_OP_CHARS = sizeof(OP_CHARS) - 1;
+constexpr TokenCode NOT_OP = TokenCode::END;
+
+
+// ops indexed by op_char_index() of their chars
+struct OpTables {
+    uint8_t op_char_index[128];     // 1-based index in OP_CHARS, 0 if not an op char
+    TokenCode single_op[NUM_OP_CHARS + 1];
+    TokenCode double_op[NUM_OP_CHARS + 1][NUM_OP_CHARS + 1];
+};
+
+
+constexpr OpTables make_op_tables() {
+    OpTables tables {};
+    for (size_t i = 0; i <= NUM_OP_CHARS; ++i) {
+        tables.single_op[i] = NOT_OP;
+        for (size_t j = 0; j <= NUM_OP_CHARS; ++j) {
+            tables.double_op[i][j] = NOT_OP;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_OP_CHARS; ++i) {
+        char ch = OP_CHARS[i];
+        tables.op_char_index[static_cast<size_t>(ch)] = static_cast<uint8_t>(i + 1);
+        // && and || only
+        if (ch != '&' && ch != '|') {
+            tables.single_op[i + 1] = static_cast<TokenCode>(ch);
+        }
+    }
+
+    const char *doubles[] = {
+        "<=", ">=", "==", "!=", "&&", "||", "+=", "-=", "*=", "/=", "%=",
+    };
+    for (const char *op : doubles) {
+        uint8_t first = tables.op_char_index[static_cast<size_t>(op[0])];
+        uint8_t second = tables.op_char_index[static_cast<size_t>(op[1])];
+        tables.double_op[first][second] = static_cast<TokenCode>((op[0] << 8) | op[1]);
+    }
+    return tables;
+}
+
+
+constexpr OpTables op_tables = make_op_tables();
+
+
+inline uint8_t op_char_index(unichar ch) {
+    return ch < 0x80 ? op_tables.op_char_index[ch] : 0;
 }
 
+}   // namespace
+
 
 void Tokenizer::st_init(unichar ch) {
     this->start_pos = this->cur_pos;
     if (is_space(ch)) {
         // pass
-    } else if (USTRING("[]{}(),;").find(ch) != ustring::npos) {
-        Token *tok = new Token(static_cast<TokenCode>(ch));
-        tok->pos_start = this->cur_pos;
-        tok->pos_end = this->cur_pos;
-        this->buffer.emplace(tok);
-    } else if (USTRING("+-*/%<>=!&|").find(ch) != ustring::npos) {
+    } else if (is_bracket_char(ch)) {
+        this->emit(static_cast<TokenCode>(ch), this->cur_pos, this->cur_pos);
+    } else if (op_char_index(ch) != 0) {
         this->op_state.op1 = ch;
         this->state = TokenizerState::OP;
     } else if (ch == '"') {
@@ -139,22 +717,17 @@ void Tokenizer::st_op(unichar ch) {
     } else if (combined == '/*') {
         this->state = TokenizerState::BLOCK_COMMENT;
     } else {
-        auto dit = Tokenizer::double_char_op_map.find(combined);
-        if (dit != Tokenizer::double_char_op_map.end()) {
-            Token *tok = new Token(dit->second);
-            tok->pos_start = this->start_pos;
-            tok->pos_end = this->cur_pos;
-            this->buffer.emplace(tok);
+        uint8_t first = op_char_index(this->op_state.op1);
+        TokenCode double_op = op_tables.double_op[first][op_char_index(ch)];
+        if (double_op != NOT_OP) {
+            this->emit(double_op, this->start_pos, this->cur_pos);
             // reset
             this->state = TokenizerState::INIT;
             this->op_state = OpState();
         } else {
-            auto sit = Tokenizer::single_char_op_map.find(this->op_state.op1);
-            if (sit != Tokenizer::single_char_op_map.end()) {
-                Token *tok = new Token(sit->second);
-                tok->pos_start = this->start_pos;
-                tok->pos_end = this->prev_pos;
-                this->buffer.emplace(tok);
+            TokenCode single_op = op_tables.single_op[first];
+            if (single_op != NOT_OP) {
+                this->emit(single_op, this->start_pos, this->prev_pos);
                 // reset
                 this->state = TokenizerState::INIT;
                 this->op_state = OpState();
@@ -181,10 +754,7 @@ void Tokenizer::st_string(unichar ch) {
         }
     } else if (ss.state == StringSubState::NORMAL) {
         if (ch == '"') {
-            Token *tok = new TokenString(ss.value);
-            tok->pos_start = this->start_pos;
-            tok->pos_end = this->cur_pos;
-            this->buffer.emplace(tok);
+            this->emit_text(TokenCode::STRING, ss.value, this->start_pos, this->cur_pos);
             // reset
             this->string_state = StringState();
             this->state = TokenizerState::INIT;
@@ -333,10 +903,9 @@ void Tokenizer::st_number(unichar ch) {
 
 
 void Tokenizer::finish_num(unichar ch) {
-    Token *tok = this->num_state.to_token();
-    tok->pos_start = this->start_pos;
-    tok->pos_end = this->prev_pos;
-    this->buffer.emplace(tok);
+    Token tok;
+    this->num_state.to_token(tok);
+    this->emit_number(tok, this->start_pos, this->prev_pos);
     // reset states
     this->num_state = NumberState();
     this->state = TokenizerState::INIT;
@@ -344,39 +913,30 @@ void Tokenizer::finish_num(unichar ch) {
 }
 
 
-template<class T>
-static T string_to_number(const std::string &digits) {
-    T val = 0;
-    for (auto ch : digits) {
-        val *= 10;
-        val += ch - '0';
+void Tokenizer::emit_number(Token &tok, const SourceLoc &pos_start, const SourceLoc &pos_end) {
+    if (tok.tokencode == TokenCode::FLOAT && std::isinf(tok.float_value)) {
+        throw TokenizerError("Number out of range", pos_start, pos_end);
     }
-    return val;
+    tok.pos_start = pos_start;
+    tok.pos_end = pos_end;
+    this->emit(tok.tokencode, pos_start, pos_end) = tok;
 }
 
 
-Token *NumberState::to_token() const {
-    int64_t iv = string_to_number<int64_t>(this->int_digits);
-    double fv = string_to_number<double>(this->int_digits);
-
-    fv += string_to_number<double>(this->dot_digits) \
-        * pow(10, -static_cast<double>(this->dot_digits.size()));
-
-    if (!this->exp_digits.empty()) {
-        double exp = string_to_number<double>(this->exp_digits) * this->exp_sign;   // inf
-        fv *= std::pow(10, exp);    // inf
-        iv *= std::pow(10, exp);
-    }
-
-    iv *= this->num_sign;
-    fv *= this->num_sign;
-
-    if (!this->has_dot && this->exp_sign > 0
-        && std::numeric_limits<int64_t>::min() < fv && fv < std::numeric_limits<int64_t>::max())
-    {
-        return new TokenInt(iv);
+void NumberState::to_token(Token &tok) const {
+    DecimalParts parts;
+    parts.int_begin = this->int_digits.data();
+    parts.int_end = parts.int_begin + this->int_digits.size();
+    parts.frac_begin = this->dot_digits.data();
+    parts.frac_end = parts.frac_begin + this->dot_digits.size();
+    const char *exp_begin = this->exp_digits.data();
+    parts.exp = digits_to_exp(exp_begin, exp_begin + this->exp_digits.size()) * this->exp_sign;
+    parts.is_float = this->has_dot || this->exp_sign < 0;
+    decimal_to_token(parts, tok);
+    if (tok.tokencode == TokenCode::INT) {
+        tok.int_value *= this->num_sign;
     } else {
-        return new TokenFloat(fv);
+        tok.float_value *= this->num_sign;
     }
 }
 
@@ -384,15 +944,17 @@ Token *NumberState::to_token() const {
 void Tokenizer::st_id(unichar ch) {
     // TODO: limit length
     // TODO: allow unicode
-    if (ch == '_' || is_alpha(ch) || is_digit(ch)) {
+    if (has_char_class(ch, CHAR_WORD)) {
         this->id_state.value.push_back(ch);
     } else {
-        TokenId *tok = new TokenId(this->id_state.value);
-        tok->pos_start = this->start_pos;
-        tok->pos_end = this->prev_pos;
-        this->buffer.emplace(tok);
-        // reset
-        this->id_state = IdState();
+        TokenCode tc = keyword_to_tokencode(this->id_state.value);
+        if (tc == TokenCode::ID) {
+            // value is reset by emit_text()
+            this->emit_text(tc, this->id_state.value, this->start_pos, this->prev_pos);
+        } else {
+            this->emit(tc, this->start_pos, this->prev_pos);
+            this->id_state.value.clear();
+        }
         this->state = TokenizerState::INIT;
         this->refeed(ch);
     }
@@ -401,10 +963,8 @@ void Tokenizer::st_id(unichar ch) {
 
 void Tokenizer::st_line_comment(unichar ch) {
     if (ch == '\n') {
-        TokenComment *tok = new TokenComment(this->line_cmt_state.value);
-        tok->pos_start = this->start_pos;
-        tok->pos_end = this->prev_pos;
-        this->buffer.emplace(tok);
+        this->emit_text(
+            TokenCode::COMMENT, this->line_cmt_state.value, this->start_pos, this->prev_pos);
         // reset
         this->line_cmt_state = LineCommentState();
         this->state = TokenizerState::INIT;
@@ -425,10 +985,7 @@ void Tokenizer::st_block_comment(unichar ch) {
         }
     } else if (cs.state == BlockCommentSubState::STARED) {
         if (ch == '/') {
-            TokenComment *tok = new TokenComment(cs.value);
-            tok->pos_start = this->start_pos;
-            tok->pos_end = cs.terminate_pos;
-            this->buffer.emplace(tok);
+            this->emit_text(TokenCode::COMMENT, cs.value, this->start_pos, cs.terminate_pos);
             // reset
             this->block_cmt_state = BlockCommentState();
             this->state = TokenizerState::INIT;
@@ -462,31 +1019,3 @@ const std::map<unichar, unichar> Tokenizer::escape_map {
     {'\\', '\\'},
     {'/', '/'},
 };
-
-
-const std::map<unichar, TokenCode> Tokenizer::single_char_op_map {
-    {'+', TokenCode::PLUS},
-    {'-', TokenCode::MINUS},
-    {'*', TokenCode::STAR},
-    {'/', TokenCode::SLASH},
-    {'%', TokenCode::PERCENT},
-    {'<', TokenCode::LESS},
-    {'>', TokenCode::GREAT},
-    {'!', TokenCode::NOT},
-    {'=', TokenCode::ASSIGN},
-};
-
-
-const std::map<uint32_t, TokenCode> Tokenizer::double_char_op_map {
-    {'<=', TokenCode::LESSEQ},
-    {'>=', TokenCode::GREATEQ},
-    {'==', TokenCode::EQ},
-    {'!=', TokenCode::NEQ},
-    {'&&', TokenCode::AND},
-    {'||', TokenCode::OR},
-    {'+=', TokenCode::PLUS_ASSIGN},
-    {'-=', TokenCode::MINUS_ASSIGN},
-    {'*=', TokenCode::STAR_ASSIGN},
-    {'/=', TokenCode::SLASH_ASSIGN},
-    {'%=', TokenCode::PERCENT_ASSIGN},
-};
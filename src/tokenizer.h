@@ -2,11 +2,11 @@
 #define JIAOBENSCRIPT_TOKENIZER_H
 
 
+#include <cstddef>
 #include <cstdint>
 #include <map>
-#include <memory>
 #include <string>
-#include <queue>
+#include <vector>
 
 #include "unicode.h"
 #include "sourcepos.h"
@@ -48,10 +48,26 @@ enum class TokenCode : uint32_t {
     STRING          = 'STR',
     COMMENT         = 'CMT',
     END             = 'END',
+    // keywords
+    KW_LET          = 'LET',
+    KW_IF           = 'IF',
+    KW_ELSE         = 'ELSE',
+    KW_WHILE        = 'WHLE',
+    KW_FOR          = 'FOR',
+    KW_IN           = 'IN',
+    KW_RETURN       = 'RET',
+    KW_BREAK        = 'BRK',
+    KW_CONTINUE     = 'CONT',
+    KW_FUNCTION     = 'FUNC',
+    KW_NULL         = 'NULL',
+    KW_TRUE         = 'TRUE',
+    KW_FALSE        = 'FALS',
 };
 
 
 std::string tokencode_to_string(TokenCode tc);
+// returns TokenCode::ID if not a keyword
+TokenCode keyword_to_tokencode(const ustring &id);
 
 
 REPR(TokenCode) {
@@ -59,23 +75,28 @@ REPR(TokenCode) {
 }
 
 
+// A plain value produced into the ring buffer of Tokenizer, nothing is allocated per token.
 struct Token {
-    typedef std::unique_ptr<Token> Ptr;
+    Token() : Token(TokenCode::END) {}
+    explicit Token(TokenCode tc) : tokencode(tc), int_value(0) {}
 
-    explicit Token(TokenCode tc) : tokencode(tc) {}
-    virtual ~Token() {}
+    bool operator==(const Token &rhs) const;
+    bool operator!=(const Token &rhs) const;
 
-    virtual bool operator==(const Token &rhs) const;
-    virtual bool operator!=(const Token &rhs) const;
-
-    virtual std::string name() const;
-    virtual std::string repr_full() const;
-    virtual std::string repr_short() const;
-    virtual std::string repr_value() const;
+    bool has_text() const;
+    std::string name() const;
+    std::string repr_full() const;
+    std::string repr_short() const;
+    std::string repr_value() const;
 
     TokenCode tokencode;
-    SourcePos pos_start;
-    SourcePos pos_end;
+    SourceLoc pos_start;
+    SourceLoc pos_end;
+    union {
+        int64_t int_value;      // INT
+        double float_value;     // FLOAT
+        const ustring *text;    // ID, STRING and COMMENT, owned by the tokenizer
+    };
 };
 
 
@@ -84,50 +105,6 @@ REPR(Token) {
 }
 
 
-template<class ValueType>
-inline std::string my_to_string(const ValueType &value) {
-    return std::to_string(value);
-}
-
-
-template<>
-inline std::string my_to_string<ustring>(const ustring &value) {
-    return u8_encode(value);
-}
-
-
-template<class ValueType, TokenCode tokcode>
-class ExtendedToken : public Token {
-public:
-    typedef ExtendedToken<ValueType, tokcode> _SelfType;
-    typedef std::unique_ptr<_SelfType> Ptr;
-
-    explicit ExtendedToken(const ValueType &value) : Token(tokcode), value(value) {}
-
-    virtual std::string repr_value() const {
-        return my_to_string(this->value);
-    }
-
-    virtual bool operator==(const Token &other) const {
-        auto tok = dynamic_cast<const _SelfType *>(&other);
-        if (tok != nullptr) {
-            return this->value == tok->value;
-        } else {
-            return false;
-        }
-    }
-
-    ValueType value;
-};
-
-
-typedef ExtendedToken<int64_t, TokenCode::INT> TokenInt;
-typedef ExtendedToken<double, TokenCode::FLOAT> TokenFloat;
-typedef ExtendedToken<ustring, TokenCode::STRING> TokenString;
-typedef ExtendedToken<ustring, TokenCode::ID> TokenId;
-typedef ExtendedToken<ustring, TokenCode::COMMENT> TokenComment;
-
-
 enum class TokenizerState {
     INIT,
     OP,
@@ -189,7 +166,7 @@ struct NumberState {
     int exp_sign = 1;
     bool has_dot = false;
 
-    Token *to_token() const;
+    void to_token(Token &tok) const;
 };
 
 
@@ -207,19 +184,28 @@ enum class BlockCommentSubState {
 struct BlockCommentState {
     BlockCommentSubState state = BlockCommentSubState::NORMAL;
     ustring value;
-    SourcePos terminate_pos;
+    SourceLoc terminate_pos;
 };
 
 
 class Tokenizer {
 public:
     void feed(unichar ch);
-    Token::Ptr pop();
+    // utf-8 input, may be split at any byte
+    void feed(const char *utf8, size_t len);
+    // the token is valid until the next feed()
+    const Token *pop();
+    // like pop(), but the text of the token is swapped into text, and the slot keeps the capacity
+    // of text, the text pointer of the token is not valid
+    const Token *pop(ustring &text);
     bool is_ready() const;
     void reset();
+    // the next char fed is at loc, for tokenizing a part of a source
+    void start_at(SourceLoc loc);
 
 private:
     void refeed(unichar ch);
+    const char *feed_run(const char *begin, const char *end);
     void st_init(unichar ch);
     void st_op(unichar ch);
     void st_string(unichar ch);
@@ -229,12 +215,21 @@ private:
     void st_block_comment(unichar ch);
     void unknown_char(unichar ch, const std::string &additional = "");
     void finish_num(unichar ch);
+    void emit_number(Token &tok, const SourceLoc &pos_start, const SourceLoc &pos_end);
+    Token &emit(TokenCode tc, const SourceLoc &pos_start, const SourceLoc &pos_end);
+    void emit_text(
+        TokenCode tc, ustring &value, const SourceLoc &pos_start, const SourceLoc &pos_end);
+    void grow_ring();
 
     TokenizerState state = TokenizerState::INIT;
-    std::queue<Token::Ptr> buffer;
-
-    SourcePos start_pos;
-    SourcePos prev_pos;
+    // produced tokens, slots are reused once popped
+    std::vector<Token> ring;
+    std::vector<ustring> ring_text;     // text of the token in the same slot
+    size_t ring_head = 0;
+    size_t ring_count = 0;
+
+    SourceLoc start_pos;
+    SourceLoc prev_pos;
     TracableSourcePos cur_pos;
 
     OpState op_state {};
@@ -243,10 +238,9 @@ private:
     IdState id_state {};
     LineCommentState line_cmt_state {};
     BlockCommentState block_cmt_state {};
+    std::string partial_char;   // utf-8 sequence split by the end of the last input
 
     static const std::map<unichar, unichar> escape_map;
-    static const std::map<unichar, TokenCode> single_char_op_map;
-    static const std::map<uint32_t, TokenCode> double_char_op_map;
 };
 
 
@@ -1,5 +1,10 @@
 #include <cassert>
 #include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "unicode.h"
 
 
@@ -133,20 +138,65 @@ size_t u8_unicode_len(const std::string &s) {
 }
 
 
+// Copies the leading ascii run of [start, end) to out, 16 bytes at a time with SSE2 or 8 bytes
+// at a time otherwise. Returns the end of the run.
+static const char *_u8_widen_ascii(const char *start, const char *end, unichar *&out) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; end - start >= 16; start += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(start));
+        if (_mm_movemask_epi8(chunk) != 0) {
+            break;
+        }
+        __m128i lo = _mm_unpacklo_epi8(chunk, zero);
+        __m128i hi = _mm_unpackhi_epi8(chunk, zero);
+        __m128i *dst = reinterpret_cast<__m128i *>(out);
+        _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+        out += 16;
+    }
+#else
+    for (; end - start >= 8; start += 8) {
+        uint64_t word;
+        std::memcpy(&word, start, sizeof(word));
+        if ((word & 0x8080808080808080ull) != 0) {
+            break;
+        }
+        for (int i = 0; i < 8; ++i) {
+            *out++ = static_cast<uint8_t>(start[i]);
+        }
+    }
+#endif
+    for (; start < end && static_cast<uint8_t>(*start) < 0x80; ++start) {
+        *out++ = static_cast<uint8_t>(*start);
+    }
+    return start;
+}
+
+
 // TODO: reject overlong encoding
 static ustring _u8_decode(const char *start, const char *end) {
-    ustring ans;
-//    size_t len = _u8_unicode_len_bound(start, end);
-//    ans.reserve(len);
+    // no more chars than bytes
+    ustring ans(end - start, 0);
+    unichar *out = &ans[0];
 
     while (start < end) {
+        start = _u8_widen_ascii(start, end, out);
+        if (start == end) {
+            break;
+        }
+
         int clen = u8_read_char_len(start);
         if (start + clen > end) {
             throw DecodeError("truncated bytes", static_cast<uint8_t>(*end));
         }
-        ans.push_back(u8_read_char(start));
+        *out++ = u8_read_char(start);
         start += clen;
     }
+
+    ans.resize(out - ans.data());
     return ans;
 }
 
@@ -164,42 +214,86 @@ ustring u8_decode(const std::string &str) {
 size_t u8_byte_len(const ustring &us) {
     size_t ans = 0;
     for (unichar ch : us) {
-        ans += u8_char_len(ch);
+        // same as u8_char_len(), without branches
+        ans += 1 + (ch >= 0x80) + (ch >= 0x800) + (ch >= 0x10000)
+            + (ch >= 0x200000) + (ch >= 0x4000000);
     }
     return ans;
 }
 
 
-std::string u8_encode(const ustring &us) {
-    size_t len = u8_byte_len(us);
-    std::string ans(len, '\0');
-    char *data = const_cast<char *>(ans.data());
-    for (unichar ch : us) {
-        data = u8_write_char(data, ch);
+// Copies the leading ascii run of [start, end) to out, 16 chars at a time with SSE2. Returns
+// the end of the run.
+static const unichar *_u8_narrow_ascii(const unichar *start, const unichar *end, char *&out) {
+#if defined(__SSE2__)
+    const __m128i non_ascii = _mm_set1_epi32(~0x7f);
+    const __m128i zero = _mm_setzero_si128();
+    for (; end - start >= 16; start += 16) {
+        const __m128i *src = reinterpret_cast<const __m128i *>(start);
+        __m128i a = _mm_loadu_si128(src + 0);
+        __m128i b = _mm_loadu_si128(src + 1);
+        __m128i c = _mm_loadu_si128(src + 2);
+        __m128i d = _mm_loadu_si128(src + 3);
+        __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        __m128i is_ascii = _mm_cmpeq_epi32(_mm_and_si128(any, non_ascii), zero);
+        if (_mm_movemask_epi8(is_ascii) != 0xffff) {
+            break;
+        }
+        // no saturation, all values are below 0x80
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), bytes);
+        out += 16;
     }
-    return ans;
+#endif
+    for (; start < end && *start < 0x80; ++start) {
+        *out++ = static_cast<char>(*start);
+    }
+    return start;
 }
 
 
-bool is_space(unichar ch) {
-    // \t\n\v\f\r and space
-    return ('\t' <= ch && ch <= '\r') || ch == ' ';
-}
-
+std::string u8_encode(const ustring &us) {
+    std::string ans(u8_byte_len(us), '\0');
+    char *out = &ans[0];
 
-bool is_digit(unichar ch) {
-    return '0' <= ch && ch <= '9';
+    const unichar *start = us.data();
+    const unichar *end = start + us.size();
+    while (start < end) {
+        start = _u8_narrow_ascii(start, end, out);
+        if (start < end) {
+            out = u8_write_char(out, *start++);
+        }
+    }
+    return ans;
 }
 
 
-bool is_xdigit(unichar ch) {
-    return is_digit(ch) || ('a' <= ch && ch <= 'f') || ('A' <= ch && ch <= 'F');
+static constexpr CharClassTable make_ascii_char_class() {
+    CharClassTable table {};
+    for (int ch = 0; ch < 0x80; ++ch) {
+        uint8_t cls = 0;
+        if (('\t' <= ch && ch <= '\r') || ch == ' ') {
+            cls |= CHAR_SPACE;
+        }
+        if ('0' <= ch && ch <= '9') {
+            cls |= CHAR_DIGIT | CHAR_XDIGIT | CHAR_WORD;
+        }
+        if (('a' <= ch && ch <= 'f') || ('A' <= ch && ch <= 'F')) {
+            cls |= CHAR_XDIGIT;
+        }
+        if (('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z')) {
+            cls |= CHAR_ALPHA | CHAR_WORD;
+        }
+        if (ch == '_') {
+            cls |= CHAR_WORD;
+        }
+        table.value[ch] = cls;
+    }
+    return table;
 }
 
 
-bool is_alpha(unichar ch) {
-    return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z');
-}
+constexpr CharClassTable ascii_char_class = make_ascii_char_class();
 
 
 unichar to_lower(unichar ch) {
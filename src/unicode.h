@@ -37,10 +37,48 @@ ustring u8_decode(const std::string &str);
 size_t u8_byte_len(const ustring &us);
 std::string u8_encode(const ustring &us);
 
-bool is_space(unichar ch);
-bool is_digit(unichar ch);
-bool is_xdigit(unichar ch);
-bool is_alpha(unichar ch);
+enum CharClass : uint8_t {
+    CHAR_SPACE  = 1 << 0,   // \t\n\v\f\r and space
+    CHAR_DIGIT  = 1 << 1,
+    CHAR_XDIGIT = 1 << 2,
+    CHAR_ALPHA  = 1 << 3,
+    CHAR_WORD   = 1 << 4,   // alpha, digit and underscore
+};
+
+
+struct CharClassTable {
+    uint8_t value[256];
+};
+
+
+// indexed by ascii chars or by bytes of utf-8, non-ascii has no class
+extern const CharClassTable ascii_char_class;
+
+
+inline bool has_char_class(unichar ch, uint8_t cls) {
+    return ch < 0x80 && (ascii_char_class.value[ch] & cls) != 0;
+}
+
+
+inline bool is_space(unichar ch) {
+    return has_char_class(ch, CHAR_SPACE);
+}
+
+
+inline bool is_digit(unichar ch) {
+    return has_char_class(ch, CHAR_DIGIT);
+}
+
+
+inline bool is_xdigit(unichar ch) {
+    return has_char_class(ch, CHAR_XDIGIT);
+}
+
+
+inline bool is_alpha(unichar ch) {
+    return has_char_class(ch, CHAR_ALPHA);
+}
+
 
 unichar to_lower(unichar ch);
 
@@ -3,7 +3,7 @@
 
 void TraversalNodeVisitor::visit_block(S_Block &block) {
     for (Node::Ptr &stmt : block.stmts) {
-        stmt->accept(*this);
+        node_dispatch(*this, *stmt);
     }
 }
 
@@ -16,56 +16,91 @@ void TraversalNodeVisitor::visit_program(Program &prog) {
 void TraversalNodeVisitor::visit_declare_list(S_DeclareList &decls) {
     for (const auto &pair : decls.decls) {
         if (pair.initial) {
-            pair.initial->accept(*this);
+            node_dispatch(*this, *pair.initial);
         }
     }
 }
 
 
 void TraversalNodeVisitor::visit_condition(S_Condition &cond) {
-    cond.condition->accept(*this);
-    cond.then_block->accept(*this);
+    node_dispatch(*this, *cond.condition);
+    node_dispatch(*this, *cond.then_block);
     if (cond.else_block) {
-        cond.else_block->accept(*this);
+        node_dispatch(*this, *cond.else_block);
     }
 }
 
 
 void TraversalNodeVisitor::visit_while(S_While &wh) {
-    wh.condition->accept(*this);
-    wh.block->accept(*this);
+    node_dispatch(*this, *wh.condition);
+    node_dispatch(*this, *wh.block);
+}
+
+
+void TraversalNodeVisitor::visit_for(S_For &loop) {
+    node_dispatch(*this, *loop.var);
+    if (loop.is_range()) {
+        node_dispatch(*this, *loop.start);
+        node_dispatch(*this, *loop.stop);
+        if (loop.step) {
+            node_dispatch(*this, *loop.step);
+        }
+    } else {
+        node_dispatch(*this, *loop.iterable);
+    }
+    node_dispatch(*this, *loop.block);
 }
 
 
 void TraversalNodeVisitor::visit_return(S_Return &ret) {
     if (ret.value) {
-        ret.value->accept(*this);
+        node_dispatch(*this, *ret.value);
     }
 }
 
 
 void TraversalNodeVisitor::visit_stmt_exp(S_Exp &stmt) {
-    stmt.value->accept(*this);
+    node_dispatch(*this, *stmt.value);
 }
 
 
 void TraversalNodeVisitor::visit_op(E_Op &exp) {
     for (Node::Ptr &arg : exp.args) {
-        arg->accept(*this);
+        node_dispatch(*this, *arg);
     }
 }
 
 
 void TraversalNodeVisitor::visit_func(E_Func &func) {
     if (func.args) {
-        func.args->accept(*this);
+        node_dispatch(*this, *func.args);
     }
-    func.block->accept(*this);
+    node_dispatch(*this, *func.block);
 }
 
 
 void TraversalNodeVisitor::visit_list(E_List &list) {
     for (Node::Ptr &item : list.value) {
-        item->accept(*this);
+        node_dispatch(*this, *item);
     }
 }
+
+
+void TraversalNodeVisitor::visit_fused_var_update(E_FusedVarUpdate &fused) {
+    node_dispatch(*this, *fused.original);
+}
+
+
+void TraversalNodeVisitor::visit_fused_set_item(E_FusedSetItem &fused) {
+    node_dispatch(*this, *fused.original);
+}
+
+
+void TraversalNodeVisitor::visit_fused_condition(S_FusedCondition &fused) {
+    node_dispatch(*this, *fused.original);
+}
+
+
+void TraversalNodeVisitor::visit_fused_while(S_FusedWhile &fused) {
+    node_dispatch(*this, *fused.original);
+}
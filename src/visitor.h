@@ -1,6 +1,8 @@
 #ifndef JIAOBENSCRIPT_VISITOR_H
 #define JIAOBENSCRIPT_VISITOR_H
 
+#include <cassert>
+
 #include "node.h"
 
 
@@ -13,6 +15,7 @@ public:
     virtual void visit_declare_list(S_DeclareList &) {}
     virtual void visit_condition(S_Condition &) {}
     virtual void visit_while(S_While &) {}
+    virtual void visit_for(S_For &) {}
     virtual void visit_return(S_Return &) {}
     virtual void visit_break(S_Break &) {}
     virtual void visit_continue(S_Continue &) {}
@@ -27,9 +30,76 @@ public:
     virtual void visit_string(E_String &) {}
     virtual void visit_list(E_List &) {}
     virtual void visit_null(E_Null &) {}
+    virtual void visit_fused_var_update(E_FusedVarUpdate &) {}
+    virtual void visit_fused_set_item(E_FusedSetItem &) {}
+    virtual void visit_fused_condition(S_FusedCondition &) {}
+    virtual void visit_fused_while(S_FusedWhile &) {}
 };
 
 
+// Calls the visit_*() method of vis for node.kind. With a final Visitor type the call is
+// resolved statically and can be inlined, unlike Node::accept() which costs two virtual calls.
+// Visitors with private visit_*() methods befriend it with NODE_DISPATCH_FRIEND.
+template<class Visitor>
+inline void node_dispatch(Visitor &vis, Node &node) {
+    switch (node.kind) {
+    case NodeKind::S_BLOCK:
+        return vis.visit_block(static_cast<S_Block &>(node));
+    case NodeKind::PROGRAM:
+        return vis.visit_program(static_cast<Program &>(node));
+    case NodeKind::S_DECLARE_LIST:
+        return vis.visit_declare_list(static_cast<S_DeclareList &>(node));
+    case NodeKind::S_CONDITION:
+        return vis.visit_condition(static_cast<S_Condition &>(node));
+    case NodeKind::S_WHILE:
+        return vis.visit_while(static_cast<S_While &>(node));
+    case NodeKind::S_FOR:
+        return vis.visit_for(static_cast<S_For &>(node));
+    case NodeKind::S_RETURN:
+        return vis.visit_return(static_cast<S_Return &>(node));
+    case NodeKind::S_BREAK:
+        return vis.visit_break(static_cast<S_Break &>(node));
+    case NodeKind::S_CONTINUE:
+        return vis.visit_continue(static_cast<S_Continue &>(node));
+    case NodeKind::S_EXP:
+        return vis.visit_stmt_exp(static_cast<S_Exp &>(node));
+    case NodeKind::S_EMPTY:
+        return vis.visit_stmt_empty(static_cast<S_Empty &>(node));
+    case NodeKind::E_OP:
+        return vis.visit_op(static_cast<E_Op &>(node));
+    case NodeKind::E_VAR:
+        return vis.visit_var(static_cast<E_Var &>(node));
+    case NodeKind::E_FUNC:
+        return vis.visit_func(static_cast<E_Func &>(node));
+    case NodeKind::E_BOOL:
+        return vis.visit_bool(static_cast<E_Bool &>(node));
+    case NodeKind::E_INT:
+        return vis.visit_int(static_cast<E_Int &>(node));
+    case NodeKind::E_FLOAT:
+        return vis.visit_float(static_cast<E_Float &>(node));
+    case NodeKind::E_STRING:
+        return vis.visit_string(static_cast<E_String &>(node));
+    case NodeKind::E_LIST:
+        return vis.visit_list(static_cast<E_List &>(node));
+    case NodeKind::E_NULL:
+        return vis.visit_null(static_cast<E_Null &>(node));
+    case NodeKind::E_FUSED_VAR_UPDATE:
+        return vis.visit_fused_var_update(static_cast<E_FusedVarUpdate &>(node));
+    case NodeKind::E_FUSED_SET_ITEM:
+        return vis.visit_fused_set_item(static_cast<E_FusedSetItem &>(node));
+    case NodeKind::S_FUSED_CONDITION:
+        return vis.visit_fused_condition(static_cast<S_FusedCondition &>(node));
+    case NodeKind::S_FUSED_WHILE:
+        return vis.visit_fused_while(static_cast<S_FusedWhile &>(node));
+    }
+    assert(!"unknown node kind");
+}
+
+
+#define NODE_DISPATCH_FRIEND \
+    template<class Visitor> friend void ::node_dispatch(Visitor &vis, Node &node)
+
+
 class TraversalNodeVisitor : public NodeVisitor {
 public:
     virtual void visit_block(S_Block &block);
@@ -37,11 +107,16 @@ public:
     virtual void visit_declare_list(S_DeclareList &decls);
     virtual void visit_condition(S_Condition &cond);
     virtual void visit_while(S_While &wh);
+    virtual void visit_for(S_For &loop);
     virtual void visit_return(S_Return &ret);
     virtual void visit_stmt_exp(S_Exp &stmt);
     virtual void visit_op(E_Op &exp);
     virtual void visit_func(E_Func &func);
     virtual void visit_list(E_List &list);
+    virtual void visit_fused_var_update(E_FusedVarUpdate &fused);
+    virtual void visit_fused_set_item(E_FusedSetItem &fused);
+    virtual void visit_fused_condition(S_FusedCondition &fused);
+    virtual void visit_fused_while(S_FusedWhile &fused);
 };
 
 